@@ -0,0 +1,499 @@
+/* Copyright (c) 2026, Codership Oy. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*! @file Example of a simulated multi-node cluster. Runs several members of
+ *        a "dummy.mode=cluster" cluster in one process, each with master
+ *        threads replicating transactions on a shared set of keys and a
+ *        receiver thread applying writesets of the other members, and
+ *        reports commit rate, certification conflicts, commit latency and
+ *        flow control pauses. To get a general picture you should start with
+ *        main() function. */
+
+#include <wsrep_api.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*! Cluster member context, it is also the receiver context */
+struct member
+{
+    wsrep_t*     wsrep;
+    pthread_t    recv_thread;
+    int          index;
+    atomic_long  committed;  /*!< local transactions committed */
+    atomic_long  conflicts;  /*!< local transactions failed certification */
+    atomic_long  applied;    /*!< writesets of other members applied */
+    atomic_llong latency;    /*!< total commit latency, ns */
+    atomic_llong latency_max;
+};
+
+/*! Master thread context */
+struct master
+{
+    struct member* member;
+    pthread_t      thread;
+    wsrep_trx_id_t trx_id;
+    unsigned int   seed;
+    int            index;
+};
+
+static const char* const cluster_name = "cluster";
+
+static volatile sig_atomic_t stop = 0;
+static atomic_bool           masters_stop;
+static long                  keys = 1000;
+
+/* members synced with the cluster */
+static pthread_mutex_t synced_mtx  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  synced_cond = PTHREAD_COND_INITIALIZER;
+static int             synced      = 0;
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+logger_cb(wsrep_log_level_t const level, const char* const msg)
+{
+    if (level <= WSREP_LOG_WARN) fprintf(stderr, "WSREP: %s\n", msg);
+}
+
+static wsrep_cb_status_t
+view_cb(void*                    app_ctx,
+        void*                    recv_ctx  __attribute__((unused)),
+        const wsrep_view_info_t* view,
+        const char*              state     __attribute__((unused)),
+        size_t                   state_len __attribute__((unused)))
+{
+    const struct member* const m = app_ctx;
+
+    printf("member %d: view of %d members, my index is %d, seqno %lld\n",
+           m->index, view->memb_num, view->my_idx,
+           (long long)view->state_id.seqno);
+
+    return WSREP_CB_SUCCESS;
+}
+
+static wsrep_cb_status_t
+synced_cb(void* app_ctx __attribute__((unused)))
+{
+    pthread_mutex_lock(&synced_mtx);
+    synced++;
+    pthread_cond_broadcast(&synced_cond);
+    pthread_mutex_unlock(&synced_mtx);
+
+    return WSREP_CB_SUCCESS;
+}
+
+/*! Applies writeset of another member: there is no state here, it only
+ *  passes through commit order. */
+static wsrep_cb_status_t
+apply_cb(void*                    recv_ctx,
+         const wsrep_ws_handle_t* ws_handle,
+         uint32_t                 flags,
+         const wsrep_buf_t*       ws        __attribute__((unused)),
+         const wsrep_trx_meta_t*  meta,
+         wsrep_bool_t*            exit_loop __attribute__((unused)))
+{
+    struct member* const m = recv_ctx;
+
+    if (m->wsrep->commit_order_enter(m->wsrep, ws_handle, meta) ||
+        m->wsrep->commit_order_leave(m->wsrep, ws_handle, meta, NULL))
+    {
+        return WSREP_CB_FAILURE;
+    }
+
+    if (!(flags & WSREP_FLAG_ROLLBACK))
+        atomic_fetch_add_explicit(&m->applied, 1, memory_order_relaxed);
+
+    return WSREP_CB_SUCCESS;
+}
+
+static void*
+recv_thread(void* const arg)
+{
+    struct member* const m = arg;
+
+    wsrep_status_t const rc = m->wsrep->recv(m->wsrep, m);
+    if (WSREP_OK != rc)
+        fprintf(stderr, "member %d: receiver exited with code %d\n",
+                m->index, rc);
+
+    return NULL;
+}
+
+/*! Replicates one transaction updating a random key.
+ *  @return 0, WSREP_TRX_FAIL on certification conflict or other error */
+static wsrep_status_t
+master_trx(struct master* const ms)
+{
+    wsrep_t* const wsrep = ms->member->wsrep;
+
+    uint32_t const key = (uint32_t)(rand_r(&ms->seed) % keys);
+    wsrep_buf_t const key_part = { &key, sizeof(key) };
+    wsrep_key_t const ws_key   = { &key_part, 1 };
+    wsrep_buf_t const ws_data  = { &key, sizeof(key) };
+
+    wsrep_ws_handle_t ws_handle = { ++ms->trx_id, NULL };
+    wsrep_trx_meta_t  ws_meta;
+    ws_meta.gtid = (wsrep_gtid_t){ WSREP_UUID_UNDEFINED, WSREP_SEQNO_UNDEFINED };
+
+    long long const start = now_ns();
+
+    wsrep_status_t cert = wsrep->append_key(wsrep, &ws_handle, &ws_key, 1,
+                                            WSREP_KEY_UPDATE, true);
+    if (!cert)
+        cert = wsrep->append_data(wsrep, &ws_handle, &ws_data, 1,
+                                  WSREP_DATA_ORDERED, true);
+    if (!cert)
+        cert = wsrep->certify(wsrep, (wsrep_conn_id_t)ms->index, &ws_handle,
+                              WSREP_FLAG_TRX_START | WSREP_FLAG_TRX_END,
+                              &ws_meta);
+
+    /* ordered writeset must pass through commit order even if it failed
+     * certification */
+    wsrep_status_t ret = cert;
+    if (ws_meta.gtid.seqno > 0 &&
+        (wsrep->commit_order_enter(wsrep, &ws_handle, &ws_meta) ||
+         wsrep->commit_order_leave(wsrep, &ws_handle, &ws_meta, NULL)))
+    {
+        fprintf(stderr, "member %d: commit order failed for %lld\n",
+                ms->member->index, (long long)ws_meta.gtid.seqno);
+        ret = WSREP_NODE_FAIL;
+    }
+
+    wsrep->release(wsrep, &ws_handle);
+
+    if (WSREP_OK == ret)
+    {
+        long long const latency = now_ns() - start;
+        struct member* const m = ms->member;
+        atomic_fetch_add_explicit(&m->committed, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&m->latency, latency, memory_order_relaxed);
+
+        long long max = atomic_load_explicit(&m->latency_max,
+                                             memory_order_relaxed);
+        while (latency > max &&
+               !atomic_compare_exchange_weak(&m->latency_max, &max, latency));
+    }
+    else if (WSREP_TRX_FAIL == ret)
+    {
+        atomic_fetch_add_explicit(&ms->member->conflicts, 1,
+                                  memory_order_relaxed);
+    }
+
+    return ret;
+}
+
+static void*
+master_thread(void* const arg)
+{
+    struct master* const ms = arg;
+
+    while (!atomic_load_explicit(&masters_stop, memory_order_relaxed))
+    {
+        wsrep_status_t const ret = master_trx(ms);
+        if (WSREP_OK != ret && WSREP_TRX_FAIL != ret)
+        {
+            fprintf(stderr, "member %d: master %d failed: %d\n",
+                    ms->member->index, ms->index, ret);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int
+member_start(struct member* const m, const char* const provider,
+             const char* const options)
+{
+    if (WSREP_OK != wsrep_load(provider, &m->wsrep, logger_cb))
+    {
+        fprintf(stderr, "Failed to load wsrep provider '%s'\n", provider);
+        return 1;
+    }
+
+    /* every member gets its own jitter seed */
+    char opts[4096];
+    snprintf(opts, sizeof(opts), "dummy.mode=cluster; dummy.seed=%d; %s",
+             m->index, options);
+
+    char name[32];
+    snprintf(name, sizeof(name), "member%d", m->index);
+
+    wsrep_gtid_t state_id = { WSREP_UUID_UNDEFINED, WSREP_SEQNO_UNDEFINED };
+
+    struct wsrep_init_args args =
+    {
+        .app_ctx       = m,
+
+        .node_name     = name,
+        .node_address  = "",
+        .node_incoming = "",
+        .data_dir      = ".",
+        .options       = opts,
+        .proto_ver     = 127,
+
+        .state_id      = &state_id,
+        .state         = NULL,
+
+        .logger_cb     = logger_cb,
+        .view_cb       = view_cb,
+        .apply_cb      = apply_cb,
+        .synced_cb     = synced_cb
+    };
+
+    wsrep_status_t rc = m->wsrep->init(m->wsrep, &args);
+    if (WSREP_OK != rc)
+    {
+        fprintf(stderr, "member %d: wsrep::init() failed: %d\n", m->index, rc);
+        return 1;
+    }
+
+    rc = m->wsrep->connect(m->wsrep, cluster_name, "", "", 0);
+    if (WSREP_OK != rc)
+    {
+        fprintf(stderr, "member %d: wsrep::connect() failed: %d\n",
+                m->index, rc);
+        return 1;
+    }
+
+    int const err = pthread_create(&m->recv_thread, NULL, recv_thread, m);
+    if (err)
+    {
+        fprintf(stderr, "member %d: failed to start receiver: %d (%s)\n",
+                m->index, err, strerror(err));
+        return 1;
+    }
+
+    return 0;
+}
+
+/*! @return value of provider status variable or -1 if there is no such */
+static long long
+member_stat(const struct member* const m, const char* const name)
+{
+    struct wsrep_stats_var* const stats = m->wsrep->stats_get(m->wsrep);
+    long long ret = -1;
+
+    int i;
+    for (i = 0; stats && stats[i].name; i++)
+    {
+        if (WSREP_VAR_INT64 == stats[i].type && !strcmp(stats[i].name, name))
+        {
+            ret = stats[i].value._int64;
+            break;
+        }
+    }
+
+    if (stats) m->wsrep->stats_free(m->wsrep, stats);
+
+    return ret;
+}
+
+static void
+stop_handler(int const signum __attribute__((unused)))
+{
+    stop = 1;
+}
+
+static void
+usage(const char* const prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-n members] [-m masters] [-k keys] [-t seconds] "
+            "[-p provider] [-o options]\n"
+            "  -n  number of cluster members (3)\n"
+            "  -m  master threads per member (4)\n"
+            "  -k  number of keys transactions are spread over (1000)\n"
+            "  -t  duration of the run, seconds (10)\n"
+            "  -p  provider, e.g. 'profile:none' (none)\n"
+            "  -o  extra provider options, e.g. "
+            "'dummy.latency=500;dummy.fc_limit=64'\n",
+            prog);
+}
+
+int main(int const argc, char* argv[])
+{
+    int         members_num = 3;
+    int         masters_num = 4;
+    long        duration    = 10;
+    const char* provider    = "none";
+    const char* options     = "";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:k:t:p:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': members_num = atoi(optarg);         break;
+        case 'm': masters_num = atoi(optarg);         break;
+        case 'k': keys        = strtol(optarg, NULL, 10); break;
+        case 't': duration    = strtol(optarg, NULL, 10); break;
+        case 'p': provider    = optarg;               break;
+        case 'o': options     = optarg;               break;
+        default:  usage(argv[0]); exit(EXIT_FAILURE);
+        }
+    }
+
+    if (members_num < 1 || masters_num < 0 || keys < 1 || duration < 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct member* const members = calloc((size_t)members_num,
+                                          sizeof(*members));
+    struct master* const masters = calloc((size_t)(members_num*masters_num)+1,
+                                          sizeof(*masters));
+    if (!members || !masters)
+    {
+        fprintf(stderr, "Failed to allocate %d members\n", members_num);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Members join one by one, every next one joins the cluster formed by
+     * the previous ones. */
+    int i;
+    for (i = 0; i < members_num; i++)
+    {
+        members[i].index = i;
+        if (member_start(&members[i], provider, options)) exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&synced_mtx);
+    while (synced < members_num) pthread_cond_wait(&synced_cond, &synced_mtx);
+    pthread_mutex_unlock(&synced_mtx);
+
+    signal(SIGTERM, stop_handler);
+    signal(SIGINT,  stop_handler);
+
+    /* Transaction IDs must be unique within a member, masters of the same
+     * member use disjoint ranges. */
+    int const total_masters = members_num * masters_num;
+    for (i = 0; i < total_masters; i++)
+    {
+        struct master* const ms = &masters[i];
+        ms->member = &members[i / masters_num];
+        ms->index  = i % masters_num;
+        ms->trx_id = (wsrep_trx_id_t)ms->index << 40;
+        ms->seed   = (unsigned int)i;
+
+        int const err = pthread_create(&ms->thread, NULL, master_thread, ms);
+        if (err)
+        {
+            fprintf(stderr, "Failed to start master %d: %d (%s)\n",
+                    i, err, strerror(err));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("%4s %12s %12s %12s\n", "sec", "commits/s", "conflicts/s",
+           "latency,us");
+
+    long committed = 0, conflicts = 0;
+    long long latency = 0;
+    long sec;
+    for (sec = 1; sec <= duration && !stop; sec++)
+    {
+        sleep(1);
+
+        long c = 0, f = 0;
+        long long l = 0;
+        for (i = 0; i < members_num; i++)
+        {
+            c += atomic_load(&members[i].committed);
+            f += atomic_load(&members[i].conflicts);
+            l += atomic_load(&members[i].latency);
+        }
+
+        printf("%4ld %12ld %12ld %12.1f\n", sec, c - committed, f - conflicts,
+               c > committed ? (double)(l - latency) / (double)(c - committed)
+               * 1.0e-3 : 0.0);
+
+        committed = c;
+        conflicts = f;
+        latency   = l;
+    }
+
+    atomic_store(&masters_stop, true);
+    for (i = 0; i < total_masters; i++) pthread_join(masters[i].thread, NULL);
+
+    /* All members must have committed the same history by now. */
+    int ret = EXIT_SUCCESS;
+    wsrep_seqno_t last = WSREP_SEQNO_UNDEFINED;
+
+    printf("\n%6s %10s %10s %8s %10s %10s %10s %10s %10s\n", "member",
+           "committed", "conflicts", "confl,%", "avg,us", "max,us", "applied",
+           "fc,ms", "seqno");
+    for (i = 0; i < members_num; i++)
+    {
+        struct member* const m = &members[i];
+
+        wsrep_gtid_t gtid;
+        if (m->wsrep->sync_wait(m->wsrep, NULL, -1, &gtid))
+        {
+            fprintf(stderr, "member %d: failed to sync\n", i);
+            ret = EXIT_FAILURE;
+        }
+
+        long const c = atomic_load(&m->committed);
+        long const f = atomic_load(&m->conflicts);
+        long long const fc = member_stat(m, "flow_control_paused_ns");
+
+        printf("%6d %10ld %10ld %8.2f %10.1f %10.1f %10ld %10.1f %10lld\n",
+               i, c, f, c + f ? 100.0 * (double)f / (double)(c + f) : 0.0,
+               c ? (double)atomic_load(&m->latency) / (double)c * 1.0e-3 : 0.0,
+               (double)atomic_load(&m->latency_max) * 1.0e-3,
+               atomic_load(&m->applied), fc >= 0 ? (double)fc * 1.0e-6 : 0.0,
+               (long long)gtid.seqno);
+
+        if (i > 0 && gtid.seqno != last)
+        {
+            fprintf(stderr, "member %d committed up to %lld, member 0 - to "
+                    "%lld\n", i, (long long)gtid.seqno, (long long)last);
+            ret = EXIT_FAILURE;
+        }
+        last = gtid.seqno;
+    }
+
+    /* Leaving the cluster makes the receivers exit. */
+    for (i = 0; i < members_num; i++)
+    {
+        members[i].wsrep->disconnect(members[i].wsrep);
+        pthread_join(members[i].recv_thread, NULL);
+    }
+
+    /* Unload providers after nobody uses them any more. */
+    for (i = 0; i < members_num; i++) wsrep_unload(members[i].wsrep);
+
+    free(masters);
+    free(members);
+
+    return ret;
+}
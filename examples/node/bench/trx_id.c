@@ -0,0 +1,153 @@
+/* Copyright (c) 2026, Codership Oy. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/**
+ * Microbenchmark of store trx ID allocation against the number of workers.
+ *
+ * Every thread allocates and frees trx IDs in a loop, the way master and
+ * slave workers do for each transaction, so it measures both contention on
+ * the allocator and false sharing between the pool slots.
+ *
+ * Usage: trx_id_bench [iterations per thread] [threads...]
+ */
+
+/* allocator functions are internal to the store */
+#include "../store.c"
+
+#include <stdio.h>
+#include <stdlib.h> // mkdtemp(), strtol()
+#include <time.h>   // clock_gettime()
+
+struct bench_thread
+{
+    pthread_t           id;
+    struct node_store*  store;
+    long                iterations;
+};
+
+static void*
+bench_thread_run(void* const arg)
+{
+    struct bench_thread* const t = arg;
+
+    long i;
+    for (i = 0; i < t->iterations; i++)
+    {
+        wsrep_trx_id_t const trx_id = store_new_trx_id(t->store);
+        store_free_trx_id(t->store, trx_id);
+    }
+
+    return NULL;
+}
+
+static double
+bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+static int
+bench_run(const char* const dir, long const threads, long const iterations)
+{
+    struct node_options opts =
+    {
+        .data_dir    = dir,
+        .masters     = threads,
+        .slaves      = 0,
+        .pipeline    = 1,
+        .apply_batch = 1,
+        .ws_size     = 1024,
+        .records     = 1024,
+        .operations  = 1
+    };
+
+    struct node_store* const store = node_store_open(&opts);
+    if (!store)
+    {
+        fprintf(stderr, "Failed to open store in %s\n", dir);
+        return 1;
+    }
+
+    struct bench_thread* const t = calloc((size_t)threads, sizeof(*t));
+    if (!t)
+    {
+        node_store_close(store);
+        return 1;
+    }
+
+    double const start = bench_now();
+
+    long i;
+    for (i = 0; i < threads; i++)
+    {
+        t[i].store      = store;
+        t[i].iterations = iterations;
+        pthread_create(&t[i].id, NULL, bench_thread_run, &t[i]);
+    }
+    for (i = 0; i < threads; i++) pthread_join(t[i].id, NULL);
+
+    double const elapsed = bench_now() - start;
+    double const ops = (double)threads * (double)iterations;
+
+    printf("%7ld %12.1f %12.2f\n", threads,
+           elapsed * 1.0e9 / (double)iterations, ops / elapsed * 1.0e-6);
+
+    free(t);
+    node_store_close(store);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    long const iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+    static const long default_threads[] = { 1, 2, 4, 8, 16, 32 };
+
+    char dir[] = "/tmp/trx_id_bench.XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp()");
+        return 1;
+    }
+
+    printf("threads ns/op/thread  total Mop/s\n");
+
+    int ret = 0;
+    if (argc > 2)
+    {
+        int i;
+        for (i = 2; i < argc && !ret; i++)
+            ret = bench_run(dir, strtol(argv[i], NULL, 10), iterations);
+    }
+    else
+    {
+        size_t i;
+        for (i = 0; i < sizeof(default_threads)/sizeof(default_threads[0]) &&
+                 !ret; i++)
+            ret = bench_run(dir, default_threads[i], iterations);
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/" STORE_CKPT_NAME, dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/" STORE_LOG_NAME, dir);
+    unlink(path);
+    rmdir(dir);
+
+    return ret;
+}
@@ -0,0 +1,351 @@
+/* Copyright (c) 2020, Codership Oy. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "codec.h"
+
+#include <ctype.h>  // isspace()
+#include <errno.h>  // EPROTO
+#include <string.h> // memcpy()
+
+static size_t
+codec_none_encode(const void* const src, size_t const src_len,
+                  void*       const dst, size_t const dst_len)
+{
+    if (src_len > dst_len) return 0;
+
+    memcpy(dst, src, src_len);
+    return src_len;
+}
+
+static int
+codec_none_decode(const void* const src, size_t const src_len,
+                  void*       const dst, size_t const dst_len)
+{
+    if (src_len != dst_len) return -EPROTO;
+
+    memcpy(dst, src, src_len);
+    return 0;
+}
+
+/*
+ * RLE: the fastest one, good for long runs of the same byte (like zeroes in
+ * the high bytes of small integers). A control byte c < 128 is followed by
+ * c + 1 literal bytes, c >= 128 is followed by a single byte repeated
+ * c - 128 + CODEC_RLE_MIN_RUN times.
+ */
+#define CODEC_RLE_MIN_RUN 3
+#define CODEC_RLE_MAX_RUN (127 + CODEC_RLE_MIN_RUN)
+#define CODEC_RLE_MAX_LIT 128
+
+static size_t
+codec_rle_encode(const void* const src, size_t const src_len,
+                 void*       const dst, size_t const dst_len)
+{
+    const uint8_t*       ip     = src;
+    const uint8_t* const in_end = ip + src_len;
+    const uint8_t*       lit    = ip; // start of pending literals
+    uint8_t*             op     = dst;
+    uint8_t*       const out_end = op + dst_len;
+
+    while (ip < in_end)
+    {
+        size_t run = 1;
+        while (ip + run < in_end && ip[run] == ip[0] && run < CODEC_RLE_MAX_RUN)
+            run++;
+
+        if (run < CODEC_RLE_MIN_RUN && ip + run < in_end)
+        {
+            ip += run;
+            continue;
+        }
+
+        if (run < CODEC_RLE_MIN_RUN) ip += run; /* tail becomes literals */
+
+        while (lit < ip)
+        {
+            size_t const n = (size_t)(ip - lit) < CODEC_RLE_MAX_LIT ?
+                (size_t)(ip - lit) : CODEC_RLE_MAX_LIT;
+            if ((size_t)(out_end - op) < n + 1) return 0;
+            *op++ = (uint8_t)(n - 1);
+            memcpy(op, lit, n);
+            op  += n;
+            lit += n;
+        }
+
+        if (run >= CODEC_RLE_MIN_RUN)
+        {
+            if (out_end - op < 2) return 0;
+            *op++ = (uint8_t)(128 + run - CODEC_RLE_MIN_RUN);
+            *op++ = ip[0];
+            ip  += run;
+            lit  = ip;
+        }
+    }
+
+    return (size_t)(op - (uint8_t*)dst);
+}
+
+static int
+codec_rle_decode(const void* const src, size_t const src_len,
+                 void*       const dst, size_t const dst_len)
+{
+    const uint8_t*       ip      = src;
+    const uint8_t* const in_end  = ip + src_len;
+    uint8_t*             op      = dst;
+    uint8_t*       const out_end = op + dst_len;
+
+    while (ip < in_end)
+    {
+        uint8_t const c = *ip++;
+
+        if (c < 128)
+        {
+            size_t const n = (size_t)c + 1;
+            if ((size_t)(in_end - ip) < n || (size_t)(out_end - op) < n)
+                return -EPROTO;
+            memcpy(op, ip, n);
+            ip += n;
+            op += n;
+        }
+        else
+        {
+            size_t const n = (size_t)c - 128 + CODEC_RLE_MIN_RUN;
+            if (ip == in_end || (size_t)(out_end - op) < n) return -EPROTO;
+            memset(op, *ip++, n);
+            op += n;
+        }
+    }
+
+    return op == out_end ? 0 : -EPROTO;
+}
+
+/*
+ * LZ: LZ77 with a single-probe hash table, compresses repeating patterns
+ * (like similar records) much better than RLE at a lower speed. Data is
+ * encoded as a sequence of
+ *     token | [literals length ext] | literals | offset | [match length ext]
+ * where the high nibble of the token is literals length and the low nibble is
+ * match length - CODEC_LZ_MIN_MATCH, value of 15 meaning that it is continued
+ * in the following bytes, each adding up to 255. Offset is 2 bytes little
+ * endian. The last sequence contains only literals.
+ */
+#define CODEC_LZ_MIN_MATCH  4
+#define CODEC_LZ_MAX_OFFSET 65535
+#define CODEC_LZ_HASH_BITS  13
+
+static inline uint32_t
+codec_lz_hash(const uint8_t* const p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761U) >> (32 - CODEC_LZ_HASH_BITS);
+}
+
+/* writes length continuation bytes */
+static inline uint8_t*
+codec_lz_put_len(uint8_t* op, uint8_t* const out_end, size_t len)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (op == out_end) return NULL;
+        *op++ = 255;
+    }
+    if (op == out_end) return NULL;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t*
+codec_lz_put_seq(uint8_t* op, uint8_t* const out_end,
+                 const uint8_t* const lit, size_t const lit_len,
+                 size_t const offset, size_t const match_len)
+{
+    size_t const mlen = match_len ? match_len - CODEC_LZ_MIN_MATCH : 0;
+
+    if (op == out_end) return NULL;
+    *op++ = (uint8_t)(((lit_len < 15 ? lit_len : 15) << 4) |
+                      (mlen < 15 ? mlen : 15));
+
+    if (lit_len >= 15 && !(op = codec_lz_put_len(op, out_end, lit_len - 15)))
+        return NULL;
+
+    if ((size_t)(out_end - op) < lit_len) return NULL;
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (0 == match_len) return op; /* last sequence */
+
+    if (out_end - op < 2) return NULL;
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+
+    if (mlen >= 15 && !(op = codec_lz_put_len(op, out_end, mlen - 15)))
+        return NULL;
+
+    return op;
+}
+
+static size_t
+codec_lz_encode(const void* const src, size_t const src_len,
+                void*       const dst, size_t const dst_len)
+{
+    const uint8_t* const in      = src;
+    const uint8_t* const in_end  = in + src_len;
+    const uint8_t*       ip      = in;
+    const uint8_t*       anchor  = in; // start of pending literals
+    uint8_t*             op      = dst;
+    uint8_t*       const out_end = op + dst_len;
+
+    /* positions in src, 0 initially: stale entries are checked by memcmp() */
+    uint32_t table[1 << CODEC_LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    if (src_len >= CODEC_LZ_MIN_MATCH && src_len <= UINT32_MAX)
+    {
+        const uint8_t* const match_end = in_end - CODEC_LZ_MIN_MATCH;
+
+        while (ip <= match_end)
+        {
+            uint32_t const h = codec_lz_hash(ip);
+            const uint8_t* const ref = in + table[h];
+            table[h] = (uint32_t)(ip - in);
+
+            if (ref >= ip || ip - ref > CODEC_LZ_MAX_OFFSET ||
+                memcmp(ref, ip, CODEC_LZ_MIN_MATCH))
+            {
+                /* skip faster over incompressible data */
+                ip += 1 + ((size_t)(ip - anchor) >> 6);
+                continue;
+            }
+
+            size_t len = CODEC_LZ_MIN_MATCH;
+            while (ip + len < in_end && ref[len] == ip[len]) len++;
+
+            op = codec_lz_put_seq(op, out_end, anchor, (size_t)(ip - anchor),
+                                  (size_t)(ip - ref), len);
+            if (!op) return 0;
+
+            ip    += len;
+            anchor = ip;
+        }
+    }
+
+    op = codec_lz_put_seq(op, out_end, anchor, (size_t)(in_end - anchor), 0,0);
+    if (!op) return 0;
+
+    return (size_t)(op - (uint8_t*)dst);
+}
+
+/* reads length continuation bytes */
+static inline const uint8_t*
+codec_lz_get_len(const uint8_t* ip, const uint8_t* const in_end,
+                 size_t* const len)
+{
+    uint8_t b;
+    do
+    {
+        if (ip == in_end) return NULL;
+        b = *ip++;
+        *len += b;
+    }
+    while (255 == b);
+
+    return ip;
+}
+
+static int
+codec_lz_decode(const void* const src, size_t const src_len,
+                void*       const dst, size_t const dst_len)
+{
+    const uint8_t*       ip      = src;
+    const uint8_t* const in_end  = ip + src_len;
+    uint8_t*       const out     = dst;
+    uint8_t*             op      = out;
+    uint8_t*       const out_end = op + dst_len;
+
+    while (ip < in_end)
+    {
+        uint8_t const token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (15 == lit_len && !(ip = codec_lz_get_len(ip, in_end, &lit_len)))
+            return -EPROTO;
+
+        if ((size_t)(in_end - ip) < lit_len ||
+            (size_t)(out_end - op) < lit_len) return -EPROTO;
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == in_end) break; /* last sequence */
+
+        if (in_end - ip < 2) return -EPROTO;
+        size_t const offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        size_t len = token & 15;
+        if (15 == len && !(ip = codec_lz_get_len(ip, in_end, &len)))
+            return -EPROTO;
+        len += CODEC_LZ_MIN_MATCH;
+
+        if (0 == offset || offset > (size_t)(op - out) ||
+            (size_t)(out_end - op) < len) return -EPROTO;
+
+        /* byte by byte: the match may overlap with the output */
+        const uint8_t* ref = op - offset;
+        uint8_t* const end = op + len;
+        while (op < end) *op++ = *ref++;
+    }
+
+    return op == out_end ? 0 : -EPROTO;
+}
+
+static const struct node_codec codecs[] =
+{
+    { "none", NODE_CODEC_NONE_ID, codec_none_encode, codec_none_decode },
+    { "rle",  1,                  codec_rle_encode,  codec_rle_decode  },
+    { "lz",   2,                  codec_lz_encode,   codec_lz_decode   }
+};
+
+#define CODECS_NUM (sizeof(codecs)/sizeof(codecs[0]))
+
+const struct node_codec*
+node_codec_find(const char* const name)
+{
+    size_t len = 0;
+    while (name[len] != '\0' && !isspace((unsigned char)name[len])) len++;
+
+    size_t i;
+    for (i = 0; i < CODECS_NUM; i++)
+    {
+        if (strlen(codecs[i].name) == len &&
+            0 == strncmp(codecs[i].name, name, len)) return &codecs[i];
+    }
+
+    return NULL;
+}
+
+const struct node_codec*
+node_codec_get(uint32_t const id)
+{
+    size_t i;
+    for (i = 0; i < CODECS_NUM; i++)
+    {
+        if (codecs[i].id == id) return &codecs[i];
+    }
+
+    return NULL;
+}
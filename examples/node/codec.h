@@ -0,0 +1,67 @@
+/* Copyright (c) 2020, Codership Oy. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/**
+ * @file This unit implements simple self-contained compression codecs for
+ *       SST purposes. It has nothing wsrep related.
+ */
+
+#ifndef NODE_CODEC_H
+#define NODE_CODEC_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t
+
+struct node_codec
+{
+    const char* name;
+    uint32_t    id;    // identifies codec on the wire
+
+    /**
+     * Compress src_len bytes from src to dst.
+     *
+     * @return size of the compressed data or 0 if it would not fit in dst_len
+     */
+    size_t (*encode)(const void* src, size_t src_len, void* dst, size_t dst_len);
+
+    /**
+     * Decompress src_len bytes from src to dst.
+     *
+     * @return 0 if exactly dst_len bytes were decoded or a negative error code
+     */
+    int (*decode)(const void* src, size_t src_len, void* dst, size_t dst_len);
+};
+
+/* codec that leaves data as is */
+#define NODE_CODEC_NONE_ID 0
+
+/**
+ * Find codec by name. The name is terminated by '\0' or whitespace.
+ *
+ * @return codec or NULL if there is no such codec
+ */
+extern const struct node_codec*
+node_codec_find(const char* name);
+
+/**
+ * Find codec by its wire id.
+ *
+ * @return codec or NULL if there is no such codec
+ */
+extern const struct node_codec*
+node_codec_get(uint32_t id);
+
+#endif /* NODE_CODEC_H */
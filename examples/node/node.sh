@@ -5,7 +5,11 @@ NODE_ID=$1
 NODE_NAME=${NODE_NAME:-$NODE_ID}
 
 NODE_DIR=${NODE_DIR:-/tmp/node/$NODE_NAME}
-rm -rf $NODE_DIR/*
+# set NODE_RECOVER to restart the node from its persisted state
+if [ -z "${NODE_RECOVER:-}" ]
+then
+    rm -rf $NODE_DIR/*
+fi
 mkdir -p $NODE_DIR
 
 NODE_OPT=${NODE_OPT:-}
@@ -16,6 +16,8 @@
 
 #include "options.h"
 
+#include "codec.h"
+
 #include <ctype.h>  // isspace()
 #include <errno.h>
 #include <getopt.h>
@@ -49,7 +51,13 @@ typedef enum opt
     OPTS_BASE_HOST = 't',
     OPTS_PROVIDER  = 'v',
     OPTS_WS_SIZE   = 'w',
-    OPTS_OPS       = 'x'
+    OPTS_OPS       = 'x',
+    /* long options only */
+    OPTS_SST_STREAMS = 256,
+    OPTS_SST_CODEC,
+    OPTS_PIPELINE,
+    OPTS_RATE,
+    OPTS_APPLY_BATCH
 }
     opt_t;
 
@@ -71,6 +79,11 @@ static struct option s_opts[] =
     { "provider",  OPTS_RA, NULL, OPTS_PROVIDER  },
     { "size",      OPTS_RA, NULL, OPTS_WS_SIZE   },
     { "ops",       OPTS_RA, NULL, OPTS_OPS       },
+    { "sst-streams", OPTS_RA, NULL, OPTS_SST_STREAMS },
+    { "sst-codec",   OPTS_RA, NULL, OPTS_SST_CODEC   },
+    { "pipeline",    OPTS_RA, NULL, OPTS_PIPELINE    },
+    { "rate",        OPTS_RA, NULL, OPTS_RATE        },
+    { "apply-batch", OPTS_RA, NULL, OPTS_APPLY_BATCH },
     { NULL, 0, NULL, 0 }
 };
 
@@ -93,9 +106,14 @@ static const struct node_options opts_defaults =
     .ws_size   = 1024,
     .records   = 1024*1024,
     .delay     = 0,
+    .rate      = 0,
     .base_port = 4567,
     .period    = 10,
     .operations= 1,
+    .pipeline  = 1,
+    .apply_batch = 16,
+    .sst_streams = 1,
+    .sst_codec   = "none",
     .bootstrap = true
 };
 
@@ -114,7 +132,8 @@ opts_print_help(FILE* out, const char* prog_name)
         "  -o, --options=STRING       a string of wsrep provider options.\n"
         "  -n, --name=STRING          human-readable node name.\n"
         "  -f, --data-dir=PATH        a directory to save working data in.\n"
-        "                             Should be private to the process.\n"
+        "                             Should be private to the process. The store\n"
+        "                             state persisted there survives restarts.\n"
         "  -t, --base-host=ADDRESS    address of this node at which other members can\n"
         "                             connect to it\n"
         "  -p, --base-port=NUM        base port which the node shall listen for\n"
@@ -128,12 +147,27 @@ opts_print_help(FILE* out, const char* prog_name)
         "                             (approximate lower boundary). Default: 1K\n"
         "  -r, --records=NUM          number of records in the store. Default: 1M\n"
         "  -x, --ops=NUM              number of operations per transaction. Default: 1\n"
-        "  -d, --delay=NUM            delay in milliseconds between \"commits\"\n"
-        "                             (per master thread).\n"
+        "      --pipeline=NUM         number of transactions each master keeps in\n"
+        "                             flight. Default: 1\n"
+        "      --apply-batch=NUM      maximum number of writesets a slave applies\n"
+        "                             and commits at once, if provider supports it\n"
+        "                             (1 to 1024). Default: 16\n"
+        "  -d, --delay=NUM            mean delay in milliseconds between transaction\n"
+        "                             starts (per master thread). Transactions start\n"
+        "                             at random (Poisson) times regardless of how long\n"
+        "                             the previous ones take. Default: 0 (as fast as\n"
+        "                             possible)\n"
+        "      --rate=NUM             target transaction rate of all master threads\n"
+        "                             per second, overrides --delay. Default: 0\n"
         "  -b, --bootstrap            bootstrap the cluster with this node.\n"
         "                             Default: 'Yes' if --address is not given, 'No'\n"
         "                             otherwise.\n"
         "  -i, --period               period in seconds between performance stats output\n"
+        "      --sst-streams=NUM      number of parallel connections to request for\n"
+        "                             state snapshot transfer. Default: 1\n"
+        "      --sst-codec=NAME       compression codec to request for state snapshot\n"
+        "                             transfer: none, rle (fastest) or lz.\n"
+        "                             Default: none\n"
         "\n"
         , prog_name);
 }
@@ -155,15 +189,21 @@ opts_print_config(FILE* out, const struct node_options* opts)
         "writeset size: %ld bytes\n"
         "records:       %ld\n"
         "operations:    %ld\n"
+        "pipeline:      %ld\n"
+        "apply batch:   %ld\n"
         "commit delay:  %ld ms\n"
+        "target rate:   %ld trx/s\n"
         "stats period:  %ld s\n"
+        "sst streams:   %ld\n"
+        "sst codec:     %s\n"
         "bootstrap:     %s\n"
         ,
         opts->provider, opts->address, opts->options, opts->name, opts->data_dir,
         opts->base_host, opts->base_port,
         opts->masters, opts->slaves, opts->ws_size, opts->records,
-        opts->operations,
-        opts->delay, opts->period, opts->bootstrap ? "Yes" : "No"
+        opts->operations, opts->pipeline, opts->apply_batch,
+        opts->delay, opts->rate, opts->period, opts->sst_streams, opts->sst_codec,
+        opts->bootstrap ? "Yes" : "No"
         );
 }
 
@@ -267,6 +307,44 @@ node_options_read(int argc, char* argv[], struct node_options* opts)
                                              opt_idx)))
                 goto err;
             break;
+        case OPTS_SST_STREAMS:
+            opts->sst_streams = strtol(optarg, &endptr, 10);
+            if ((ret = opts_check_conversion(opts->sst_streams >= 1, endptr,
+                                             opt_idx)))
+                goto err;
+            break;
+        case OPTS_RATE:
+            opts->rate = strtol(optarg, &endptr, 10);
+            if ((ret = opts_check_conversion(opts->rate >= 0, endptr, opt_idx)))
+                goto err;
+            break;
+        case OPTS_PIPELINE:
+            opts->pipeline = strtol(optarg, &endptr, 10);
+            if ((ret = opts_check_conversion(opts->pipeline >= 1, endptr,
+                                             opt_idx)))
+                goto err;
+            break;
+        case OPTS_APPLY_BATCH:
+            opts->apply_batch = strtol(optarg, &endptr, 10);
+            if ((ret = opts_check_conversion(opts->apply_batch >= 1 &&
+                                             opts->apply_batch <=
+                                             NODE_APPLY_BATCH_MAX,
+                                             endptr, opt_idx)))
+                goto err;
+            break;
+        case OPTS_SST_CODEC:
+        {
+            const struct node_codec* const codec = node_codec_find(optarg);
+            if (!codec || strcmp(codec->name, optarg))
+            {
+                fprintf(stderr, "Bad value for %s option.\n",
+                        s_opts[opt_idx].name);
+                ret = EINVAL;
+                goto err;
+            }
+            opts->sst_codec = optarg;
+            break;
+        }
         default:
             ret = EINVAL;
         }
@@ -23,6 +23,8 @@
 
 #include <stdbool.h>
 
+#define NODE_APPLY_BATCH_MAX 1024 // upper limit for --apply-batch
+
 struct node_options
 {
     const char* provider; // path to wsrep provider
@@ -35,10 +37,15 @@ struct node_options
     long        slaves;   // number of slave threads
     long        ws_size;  // desired writeset size
     long        records;  // total number of records
-    long        delay;    // delay between commits
+    long        delay;    // mean delay between transactions per master
+    long        rate;     // target transaction rate of all masters
     long        base_port;// base port to use
     long        period;   // statistics output interval
     long        operations;// number of "statements" in a "transaction"
+    long        pipeline; // number of transactions in flight per master
+    long        apply_batch;// max number of writesets applied at once
+    long        sst_streams;// number of parallel SST streams to request
+    const char* sst_codec; // SST compression codec to request
     bool        bootstrap;// bootstrap the cluster with this node
 };
 
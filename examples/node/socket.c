@@ -26,6 +26,7 @@
 #include <stdio.h>      // snprintf()
 #include <string.h>     // strerror()
 #include <sys/socket.h> // bind(), connect(), accept(), send(), recv()
+#include <unistd.h>     // close()
 
 struct node_socket
 {
@@ -113,6 +114,7 @@ socket_get_addrinfo1(const char* const addr)
     }
 
     addr_buf[i] = '\0';
+    errno = 0;
     port = strtol(addr_buf + i + 1, &endptr, 10);
 
     if (port <= 0 || port > USHRT_MAX || errno ||
@@ -268,12 +270,49 @@ node_socket_accept(struct node_socket* socket)
 int
 node_socket_send_bytes(node_socket_t* socket, const void* buf, size_t len)
 {
-    ssize_t const ret = send(socket->fd, buf, len, MSG_NOSIGNAL);
+    struct iovec iov = { .iov_base = (void*)buf, .iov_len = len };
+    return node_socket_send_iov(socket, &iov, 1);
+}
+
+int
+node_socket_send_iov(node_socket_t* socket, struct iovec* iov, int iovcnt)
+{
+    size_t total = 0;
+    int i;
+    for (i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = (size_t)iovcnt };
+    size_t sent = 0;
 
-    if (ret != (ssize_t)len)
+    while (sent < total)
     {
-        NODE_ERROR("Failed to send %zu bytes: %d (%s)", errno, strerror(errno));
-        return -1;
+        ssize_t const ret = sendmsg(socket->fd, &msg, MSG_NOSIGNAL);
+
+        if (ret < 0)
+        {
+            if (EINTR == errno) continue;
+
+            int const err = errno;
+            NODE_ERROR("Failed to send %zu bytes: %d (%s)",
+                       total - sent, err, strerror(err));
+            return -err;
+        }
+
+        sent += (size_t)ret;
+
+        /* skip what was sent: short writes are normal for large buffers */
+        size_t n = (size_t)ret;
+        while (msg.msg_iovlen > 0 && n >= msg.msg_iov->iov_len)
+        {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (n > 0)
+        {
+            msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
     }
 
     return 0;
@@ -282,12 +321,25 @@ node_socket_send_bytes(node_socket_t* socket, const void* buf, size_t len)
 int
 node_socket_recv_bytes(node_socket_t* socket, void* buf, size_t len)
 {
-    ssize_t const ret = recv(socket->fd, buf, len, MSG_WAITALL);
+    size_t received = 0;
 
-    if (ret != (ssize_t)len)
+    while (received < len)
     {
-        NODE_ERROR("Failed to recv %zu bytes: %d (%s)", errno, strerror(errno));
-        return -1;
+        ssize_t const ret = recv(socket->fd, (char*)buf + received,
+                                 len - received, MSG_WAITALL);
+
+        if (ret <= 0)
+        {
+            if (ret < 0 && EINTR == errno) continue;
+
+            int const err = ret < 0 ? errno : ECONNRESET;
+            NODE_ERROR("Failed to recv %zu bytes: %d (%s)",
+                       len - received, err,
+                       ret < 0 ? strerror(err) : "connection closed");
+            return -err;
+        }
+
+        received += (size_t)ret;
     }
 
     return 0;
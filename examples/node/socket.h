@@ -24,6 +24,7 @@
 
 #include <stddef.h> // size_t
 #include <stdint.h> // uint16_t
+#include <sys/uio.h>   // struct iovec
 
 typedef struct node_socket node_socket_t;
 
@@ -51,12 +52,20 @@ extern node_socket_t*
 node_socket_accept(node_socket_t* s);
 
 /**
- * Send a given number of bytes
+ * Send a given number of bytes, retrying on partial writes
  * @return 0 or a negative error code
  */
 extern int
 node_socket_send_bytes(node_socket_t* s, const void* buf, size_t len);
 
+/**
+ * Send all bytes described by iovcnt buffers (scatter-gather), retrying on
+ * partial writes. iov array is modified in the process.
+ * @return 0 or a negative error code
+ */
+extern int
+node_socket_send_iov(node_socket_t* s, struct iovec* iov, int iovcnt);
+
 /**
  * Receive a given number of bytes
  * @return 0 or a negative error code
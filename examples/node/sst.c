@@ -16,6 +16,7 @@
 
 #include "sst.h"
 
+#include "codec.h"
 #include "ctx.h"
 #include "log.h"
 #include "socket.h"
@@ -27,6 +28,7 @@
 #include <stdio.h>  // snprintf()
 #include <stdlib.h> // abort()
 #include <string.h> // strdup()
+#include <time.h>   // clock_gettime()
 #include <unistd.h> // usleep()
 
 /**
@@ -100,6 +102,557 @@ sst_sync_with_parent(const char*      role,
     pthread_mutex_unlock(mtx);
 }
 
+/* size of the chunks in which records are streamed to joiner */
+#define SST_CHUNK_SIZE (1 << 20)
+
+/* upper limit for the state header size: it contains mostly membership */
+#define SST_MAX_HEADER_SIZE (1 << 24)
+
+/* upper limit for the number of parallel SST streams */
+#define SST_MAX_STREAMS 64
+
+/*
+ * State snapshot is sent over one or more parallel streams (connections).
+ * Each stream starts with its index:
+ *     uint32 index
+ * Stream 0 then carries the header:
+ *     uint64 header_len | header | int64 since | uint64 records_len |
+ *     uint32 streams | uint32 codec
+ * where header_len of 0 means bypass (no snapshot, just IST) and nothing else
+ * follows. Then every stream carries a shard of the records in frames:
+ *     uint64 offset | uint64 len | len bytes of records
+ * or, if codec is not "none":
+ *     uint64 offset | uint64 len | uint64 encoded_len | encoded_len bytes
+ * where encoded_len equal to len means that records were not compressible
+ * and are sent as is. Streams are terminated by a frame with len 0.
+ * If since is not WSREP_SEQNO_UNDEFINED, the snapshot is a delta on top of the
+ * joiner state at that seqno, and frames carry only the records modified
+ * after it as entries of node_store_read_delta() instead of plain records.
+ * Delta frames are encoded with the codec the same way.
+ * Integers are sent in network byte order.
+ */
+
+static int
+sst_send_uint32(node_socket_t* const socket, uint32_t const val)
+{
+    uint32_t const tmp = htonl(val);
+    return node_socket_send_bytes(socket, &tmp, sizeof(tmp));
+}
+
+static int
+sst_recv_uint32(node_socket_t* const socket, uint32_t* const val)
+{
+    uint32_t tmp;
+    int const err = node_socket_recv_bytes(socket, &tmp, sizeof(tmp));
+    if (!err) *val = ntohl(tmp);
+    return err;
+}
+
+/**
+ * writes val to dst in network byte order
+ * @return the number of uint32_t words written */
+static inline size_t
+sst_put_uint64(uint32_t* const dst, uint64_t const val)
+{
+    dst[0] = htonl((uint32_t)(val >> 32));
+    dst[1] = htonl((uint32_t)val);
+    return 2;
+}
+
+static int
+sst_send_uint64(node_socket_t* const socket, uint64_t const val)
+{
+    uint32_t tmp[2];
+    sst_put_uint64(tmp, val);
+    return node_socket_send_bytes(socket, tmp, sizeof(tmp));
+}
+
+static int
+sst_recv_uint64(node_socket_t* const socket, uint64_t* const val)
+{
+    uint32_t tmp[2];
+    int const err = node_socket_recv_bytes(socket, tmp, sizeof(tmp));
+    if (!err) *val = ((uint64_t)ntohl(tmp[0]) << 32) | ntohl(tmp[1]);
+    return err;
+}
+
+static double
+sst_time_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1.0e-9;
+}
+
+static void
+sst_report_rate(const char* const action, size_t const len, double const start)
+{
+    double const duration = sst_time_now() - start;
+    NODE_INFO("%s %zu bytes of state in %.3f sec: %.1f MB/s", action, len,
+              duration, (double)len / (duration > 0 ? duration : 1e-9) / 1.0e6);
+}
+
+/**
+ * Finds value of the key=val parameter in the SST request, which is
+ * "host:port[ key=val...]"
+ *
+ * @return pointer to the value or NULL if not found */
+static const char*
+sst_request_param(const char* const req, const char* const key)
+{
+    size_t const key_len = strlen(key);
+    const char* p = strchr(req, ' ');
+
+    while (p)
+    {
+        while (' ' == *p) p++;
+        if (0 == strncmp(p, key, key_len) && '=' == p[key_len])
+            return p + key_len + 1;
+        p = strchr(p, ' ');
+    }
+
+    return NULL;
+}
+
+/* context of a single SST stream */
+struct sst_stream
+{
+    struct node_ctx* node;
+    node_socket_t*   socket;
+    const struct node_codec* codec;
+    size_t           offset;   // donor: shard of records to send
+    size_t           len;
+    size_t           bytes;    // records bytes transferred
+    size_t           encoded;  // encoded records bytes transferred
+    double           duration; // seconds
+    double           codec_time; // seconds spent in encoding/decoding
+    wsrep_seqno_t    since;    // delta since seqno or WSREP_SEQNO_UNDEFINED
+    void*            enc_buf;  // donor: buffer for encoded frames
+    int              err;
+    uint32_t         index;
+};
+
+/**
+ * donor: sends a frame of records, compressing them if there is a codec */
+static int
+sst_send_frame(struct sst_stream* const stream,
+               size_t             const offset,
+               const void*        const buf,
+               size_t             const len,
+               void*              const enc_buf)
+{
+    uint32_t hdr[6];
+    size_t   hdr_len = 0;
+    hdr_len += sst_put_uint64(hdr + hdr_len, offset);
+    hdr_len += sst_put_uint64(hdr + hdr_len, len);
+
+    const void* data     = buf;
+    size_t      data_len = len;
+
+    if (stream->codec->id != NODE_CODEC_NONE_ID)
+    {
+        double const start = sst_time_now();
+        /* encoded data must be smaller, otherwise send records as is */
+        size_t const enc_len = stream->codec->encode(buf, len, enc_buf, len-1);
+        stream->codec_time += sst_time_now() - start;
+
+        if (enc_len > 0)
+        {
+            data     = enc_buf;
+            data_len = enc_len;
+        }
+
+        hdr_len += sst_put_uint64(hdr + hdr_len, data_len);
+    }
+
+    /* frame header and data in one go */
+    struct iovec iov[2] =
+    {
+        { .iov_base = hdr,         .iov_len = hdr_len * sizeof(hdr[0]) },
+        { .iov_base = (void*)data, .iov_len = data_len                 }
+    };
+    int const err = node_socket_send_iov(stream->socket, iov, 2);
+    if (!err)
+    {
+        stream->bytes   += len;
+        stream->encoded += data_len;
+    }
+
+    return err;
+}
+
+/**
+ * donor: node_store_send_state() callback, sends records straight from the
+ * pinned store view */
+static int
+sst_send_records(void*       const ctx,
+                 size_t      const offset,
+                 const void* const buf,
+                 size_t      const len)
+{
+    struct sst_stream* const stream = ctx;
+    return sst_send_frame(stream, offset, buf, len, stream->enc_buf);
+}
+
+/**
+ * donor: sends the shard of records of the pinned store view in frames */
+static void*
+sst_send_stream(void* const arg)
+{
+    struct sst_stream* const stream = arg;
+    double const start = sst_time_now();
+
+    bool const delta = WSREP_SEQNO_UNDEFINED != stream->since;
+    size_t const buf_len = stream->len < SST_CHUNK_SIZE && !delta ?
+        stream->len : SST_CHUNK_SIZE;
+    /* full state is sent from the view in place, only delta entries need to
+     * be read into the buffer. The rest of it is for encoded data. */
+    size_t const alloc_len = (delta ? buf_len : 0) +
+        (stream->codec->id != NODE_CODEC_NONE_ID ? buf_len : 0);
+    void* const buf = malloc(alloc_len ? alloc_len : 1);
+    if (!buf)
+    {
+        NODE_ERROR("Failed to allocate %zu bytes for SST buffer.", alloc_len);
+        stream->err = -ENOMEM;
+        return NULL;
+    }
+    stream->enc_buf = (char*)buf + (delta ? buf_len : 0);
+
+    int err = 0;
+    size_t const end = stream->offset + stream->len;
+    size_t offset = stream->offset;
+    while (offset < end && !err)
+    {
+        size_t const frame_offset = offset;
+        size_t len;
+
+        if (delta)
+        {
+            /* REPLICATION: send only records modified after joiner's seqno */
+            long const ret = node_store_read_delta(stream->node->store,
+                                                   stream->since, &offset, end,
+                                                   buf, buf_len);
+            if (ret < 0) { err = (int)ret; break; }
+            len = (size_t)ret;
+
+            /* 0 length frame would terminate the stream */
+            if (len > 0) err = sst_send_frame(stream, frame_offset, buf, len,
+                                              stream->enc_buf);
+        }
+        else
+        {
+            len = end - offset < buf_len ? end - offset : buf_len;
+            err = node_store_send_state(stream->node->store, offset, len,
+                                        sst_send_records, stream);
+            offset += len;
+        }
+    }
+
+    /* terminating frame */
+    if (!err) err = sst_send_uint64(stream->socket, 0);
+    if (!err) err = sst_send_uint64(stream->socket, 0);
+
+    free(buf);
+
+    stream->err      = err;
+    stream->duration = sst_time_now() - start;
+
+    return NULL;
+}
+
+/**
+ * joiner: receives frames of records and installs them in the store as they
+ * arrive */
+static void*
+sst_recv_stream(void* const arg)
+{
+    struct sst_stream* const stream = arg;
+    double const start = sst_time_now();
+
+    /* second half of the buffer is for encoded data */
+    void* const buf = malloc(2 * SST_CHUNK_SIZE);
+    if (!buf)
+    {
+        NODE_ERROR("Failed to allocate %d bytes for SST buffer.",
+                   2 * SST_CHUNK_SIZE);
+        stream->err = -ENOMEM;
+        return NULL;
+    }
+    void* const enc_buf = (char*)buf + SST_CHUNK_SIZE;
+
+    int err;
+    while (true)
+    {
+        uint64_t offset, len;
+
+        err = sst_recv_uint64(stream->socket, &offset);
+        if (!err) err = sst_recv_uint64(stream->socket, &len);
+        if (err || 0 == len) break;
+
+        if (len > SST_CHUNK_SIZE)
+        {
+            NODE_ERROR("SST frame is too long: %llu", (unsigned long long)len);
+            err = -EPROTO;
+            break;
+        }
+
+        uint64_t enc_len = len;
+        if (stream->codec->id != NODE_CODEC_NONE_ID)
+        {
+            err = sst_recv_uint64(stream->socket, &enc_len);
+            if (!err && enc_len > len)
+            {
+                NODE_ERROR("SST frame encoded length %llu exceeds its length "
+                           "%llu", (unsigned long long)enc_len,
+                           (unsigned long long)len);
+                err = -EPROTO;
+            }
+            if (err) break;
+        }
+
+        if (enc_len < len)
+        {
+            err = node_socket_recv_bytes(stream->socket, enc_buf, enc_len);
+            if (!err)
+            {
+                double const t = sst_time_now();
+                err = stream->codec->decode(enc_buf, enc_len, buf, len);
+                stream->codec_time += sst_time_now() - t;
+                if (err) NODE_ERROR("Failed to decode SST frame at %llu: "
+                                    "%d (%s)", (unsigned long long)offset,
+                                    err, strerror(-err));
+            }
+        }
+        else
+        {
+            err = node_socket_recv_bytes(stream->socket, buf, len);
+        }
+
+        if (err) break;
+
+        if (WSREP_SEQNO_UNDEFINED == stream->since)
+            err = node_store_install_records(stream->node->store, offset, buf,
+                                             len);
+        else
+            err = node_store_install_delta(stream->node->store, buf, len);
+        if (err) break;
+
+        stream->bytes   += len;
+        stream->encoded += enc_len;
+    }
+
+    free(buf);
+
+    stream->err      = err;
+    stream->duration = sst_time_now() - start;
+
+    return NULL;
+}
+
+/**
+ * runs routine for all streams in parallel: stream 0 in the calling thread,
+ * the rest in the dedicated threads
+ *
+ * @param[out] bytes records bytes transferred over all streams
+ * @return the first error encountered or 0 */
+static int
+sst_run_streams(struct sst_stream* const streams,
+                uint32_t           const num,
+                void* (*routine) (void*),
+                size_t*            const bytes)
+{
+    pthread_t threads[SST_MAX_STREAMS];
+    uint32_t i;
+
+    for (i = 1; i < num; i++)
+    {
+        int const ret = pthread_create(&threads[i], NULL, routine, &streams[i]);
+        if (ret)
+        {
+            NODE_FATAL("Failed to create SST stream thread: %d (%s)",
+                       ret, strerror(ret));
+            abort();
+        }
+    }
+
+    routine(&streams[0]);
+
+    int err = streams[0].err;
+    for (i = 1; i < num; i++)
+    {
+        pthread_join(threads[i], NULL);
+        if (!err) err = streams[i].err;
+    }
+
+    if (num > 1)
+    {
+        for (i = 0; i < num; i++)
+        {
+            double const d = streams[i].duration;
+            NODE_INFO("SST stream %u: %zu bytes in %.3f sec: %.1f MB/s",
+                      i, streams[i].bytes, d,
+                      (double)streams[i].bytes / (d > 0 ? d : 1e-9) / 1.0e6);
+        }
+    }
+
+    size_t encoded = 0;
+    double codec_time = 0;
+    *bytes = 0;
+    for (i = 0; i < num; i++)
+    {
+        *bytes     += streams[i].bytes;
+        encoded    += streams[i].encoded;
+        codec_time += streams[i].codec_time;
+    }
+
+    if (!err && streams[0].codec->id != NODE_CODEC_NONE_ID)
+    {
+        /* throughput is per thread, as codec time is summed over streams */
+        NODE_INFO("SST codec %s: %zu -> %zu bytes of records (ratio %.2f), "
+                  "%s %.1f MB/s", streams[0].codec->name, *bytes, encoded,
+                  (double)*bytes / (double)(encoded ? encoded : 1),
+                  routine == sst_send_stream ? "encoding" : "decoding",
+                  (double)*bytes / (codec_time > 0 ? codec_time : 1e-9)/1.0e6);
+    }
+
+    return err;
+}
+
+/**
+ * joiner: accepts num - 1 additional streams after stream 0 */
+static int
+sst_accept_streams(node_socket_t*     const listen,
+                   struct sst_stream* const streams,
+                   uint32_t           const num)
+{
+    uint32_t i;
+    for (i = 1; i < num; i++)
+    {
+        node_socket_t* const socket = node_socket_accept(listen);
+        if (!socket) return -ECONNABORTED;
+
+        uint32_t index = 0;
+        int const err = sst_recv_uint32(socket, &index);
+        if (err || index == 0 || index >= num || streams[index].socket)
+        {
+            NODE_ERROR("Bad SST stream index: %u", index);
+            node_socket_close(socket);
+            return err ? err : -EPROTO;
+        }
+
+        streams[index].socket = socket;
+    }
+
+    return 0;
+}
+
+/**
+ * joiner: receives state snapshot that follows a non-0 header_len on stream
+ * 0 and the records over all streams */
+static int
+sst_recv_state(struct node_ctx* const node,
+               node_socket_t*   const listen,
+               node_socket_t*   const socket,
+               uint64_t         const header_len)
+{
+    if (header_len > SST_MAX_HEADER_SIZE)
+    {
+        NODE_ERROR("State snapshot header is too long: %llu",
+                   (unsigned long long)header_len);
+        return -EPROTO;
+    }
+
+    void* const header = malloc(header_len);
+    if (!header)
+    {
+        NODE_ERROR("Failed to allocate %zu bytes for state snapshot header.",
+                   (size_t)header_len);
+        return -ENOMEM;
+    }
+
+    struct sst_stream streams[SST_MAX_STREAMS];
+    memset(streams, 0, sizeof(streams));
+
+    double const start = sst_time_now();
+    size_t   records_len = 0;
+    size_t   received    = 0;
+    uint64_t sent_len    = 0;
+    uint64_t since       = 0;
+    uint32_t num         = 0;
+    uint32_t codec_id    = 0;
+    const struct node_codec* codec = NULL;
+    uint32_t i;
+
+    int err = node_socket_recv_bytes(socket, header, header_len);
+    if (!err) err = sst_recv_uint64(socket, &since);
+    if (err) goto out;
+
+    if (WSREP_SEQNO_UNDEFINED != (wsrep_seqno_t)since)
+    {
+        NODE_INFO("Receiving delta of the state since seqno %lld",
+                  (long long)since);
+    }
+
+    /* REPLICATION: start installing the new state */
+    err = node_store_install_begin(node->store, header, header_len,
+                                   (wsrep_seqno_t)since, &records_len);
+    if (err) goto out;
+
+    err = sst_recv_uint64(socket, &sent_len);
+    if (!err && sent_len != records_len)
+    {
+        NODE_ERROR("Donor sends %llu bytes of records while the snapshot has "
+                   "%zu", (unsigned long long)sent_len, records_len);
+        err = -EPROTO;
+    }
+
+    if (!err) err = sst_recv_uint32(socket, &num);
+    if (!err && (num < 1 || num > SST_MAX_STREAMS))
+    {
+        NODE_ERROR("Bad number of SST streams: %u", num);
+        err = -EPROTO;
+    }
+
+    if (!err) err = sst_recv_uint32(socket, &codec_id);
+    if (!err && !(codec = node_codec_get(codec_id)))
+    {
+        NODE_ERROR("Unknown SST codec: %u", codec_id);
+        err = -EPROTO;
+    }
+
+    if (!err)
+    {
+        streams[0].socket = socket;
+        err = sst_accept_streams(listen, streams, num);
+    }
+
+    if (!err)
+    {
+        for (i = 0; i < num; i++)
+        {
+            streams[i].node  = node;
+            streams[i].codec = codec;
+            streams[i].since = (wsrep_seqno_t)since;
+            streams[i].index = i;
+        }
+
+        err = sst_run_streams(streams, num, sst_recv_stream, &received);
+    }
+
+    /* REPLICATION: install the newly received state or discard it */
+    err = node_store_install_end(node->store, err);
+
+    if (!err) sst_report_rate("Received", header_len + received, start);
+
+out:
+    for (i = 1; i < SST_MAX_STREAMS; i++)
+    {
+        node_socket_close(streams[i].socket);
+    }
+    free(header);
+    return err;
+}
+
 static pthread_mutex_t sst_joiner_mtx  = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  sst_joiner_cond = PTHREAD_COND_INITIALIZER;
 
@@ -130,36 +683,25 @@ sst_joiner_thread(void* ctx)
     node_socket_t* const connected = node_socket_accept(listen);
     if (!connected) goto end;
 
-    uint32_t state_len;
-    err = node_socket_recv_bytes(connected, &state_len, sizeof(state_len));
+    uint32_t index;
+    err = sst_recv_uint32(connected, &index);
+    if (!err && 0 != index)
+    {
+        NODE_ERROR("Expected SST stream 0, got %u", index);
+        err = -EPROTO;
+    }
     if (err) goto end;
 
-    state_len = ntohl(state_len);
-    if (state_len > 0)
-    {
-        /* REPLICATION: get the state of state_len size */
-        void* state = malloc(state_len);
-        if (state)
-        {
-            err = node_socket_recv_bytes(connected, state, state_len);
-            if (err)
-            {
-                free(state);
-                goto end;
-            }
+    uint64_t header_len;
+    err = sst_recv_uint64(connected, &header_len);
+    if (err) goto end;
 
-            /* REPLICATION: install the newly received state. */
-            err = node_store_init_state(node->store, state, state_len);
-            free(state);
-            if (err) goto end;
-        }
-        else
-        {
-            NODE_ERROR("Failed to allocate %zu bytes for state snapshot.",
-                       state_len);
-            err = -ENOMEM;
-            goto end;
-        }
+    if (header_len > 0)
+    {
+        /* REPLICATION: receive the state and install it in the store as it
+         *              arrives */
+        err = sst_recv_state(node, listen, connected, header_len);
+        if (err) goto end;
     }
     else
     {
@@ -205,7 +747,10 @@ node_sst_request_cb (void*   const app_ctx,
     /* REPLICATION: 1. prepare the node to receive SST */
     uint16_t const sst_port = (uint16_t)(opts->base_port + SST_PORT_OFFSET);
     size_t const sst_len = strlen(opts->base_host)
-        + 1 /* ':' */ + 5 /* max port len */ + 1 /* \0 */;
+        + 1 /* ':' */ + 5 /* max port len */
+        + 6 /* " gtid=" */ + WSREP_GTID_STR_LEN
+        + 9 /* " streams=" */ + 20 /* max long len */
+        + 7 /* " codec=" */ + strlen(opts->sst_codec) + 1 /* \0 */;
     sst_str = malloc(sst_len);
     if (!sst_str)
     {
@@ -213,8 +758,39 @@ node_sst_request_cb (void*   const app_ctx,
         goto end;
     }
 
-    /* write in request the address at which we listen */
+    /* write in request the address at which we listen and the parameters of
+     * the transfer, if not default */
     int ret = snprintf(sst_str, sst_len, "%s:%hu", opts->base_host, sst_port);
+    if (ret >= 0 && (size_t)ret < sst_len && opts->sst_streams > 1)
+    {
+        int const len = ret;
+        ret = snprintf(sst_str + len, sst_len - (size_t)len, " streams=%ld",
+                       opts->sst_streams);
+        if (ret >= 0) ret += len;
+    }
+    /* REPLICATION: if we have some state, donor may send only the records
+     *              that were modified after it */
+    wsrep_gtid_t gtid;
+    node_store_gtid(node->store, &gtid);
+    if (ret >= 0 && (size_t)ret < sst_len && gtid.seqno >= 0)
+    {
+        int const len = ret;
+        ret = snprintf(sst_str + len, sst_len - (size_t)len, " gtid=");
+        if (ret >= 0) ret += len;
+        if (ret >= 0 && (size_t)ret < sst_len)
+        {
+            int const gtid_len = wsrep_gtid_print(&gtid, sst_str + ret,
+                                                  sst_len - (size_t)ret);
+            ret = gtid_len >= 0 ? ret + gtid_len : gtid_len;
+        }
+    }
+    if (ret >= 0 && (size_t)ret < sst_len && strcmp(opts->sst_codec, "none"))
+    {
+        int const len = ret;
+        ret = snprintf(sst_str + len, sst_len - (size_t)len, " codec=%s",
+                       opts->sst_codec);
+        if (ret >= 0) ret += len;
+    }
     if (ret < 0 || (size_t)ret >= sst_len)
     {
         free(sst_str);
@@ -269,9 +845,115 @@ struct sst_donor_ctx
     wsrep_gtid_t     state;
     struct node_ctx* node;
     node_socket_t*   socket;
+    char*            request;  // SST request string
+    char*            addr;     // joiner address from the request
     wsrep_bool_t     bypass;
 };
 
+/**
+ * donor: sends the state header and then the records over the requested
+ *        number of streams */
+static int
+sst_send_state(const struct sst_donor_ctx* const ctx,
+               const void*                 const header,
+               size_t                      const header_len,
+               size_t                      const records_len,
+               size_t*                     const sent)
+{
+    struct sst_stream streams[SST_MAX_STREAMS];
+    memset(streams, 0, sizeof(streams));
+
+    uint32_t num = 1;
+    const char* const streams_str = sst_request_param(ctx->request, "streams");
+    if (streams_str)
+    {
+        long const n = strtol(streams_str, NULL, 10);
+        if (n > 1) num = n < SST_MAX_STREAMS ? (uint32_t)n : SST_MAX_STREAMS;
+    }
+
+    const struct node_codec* codec = node_codec_get(NODE_CODEC_NONE_ID);
+    const char* const codec_str = sst_request_param(ctx->request, "codec");
+    if (codec_str)
+    {
+        const struct node_codec* const c = node_codec_find(codec_str);
+        if (c) codec = c;
+        else   NODE_WARN("Unknown SST codec requested: '%.*s', sending "
+                         "uncompressed", (int)strcspn(codec_str, " "),
+                         codec_str);
+    }
+
+    wsrep_seqno_t since = WSREP_SEQNO_UNDEFINED;
+    const char* const gtid_str = sst_request_param(ctx->request, "gtid");
+    if (gtid_str)
+    {
+        wsrep_gtid_t gtid;
+        if (wsrep_gtid_scan(gtid_str, strcspn(gtid_str, " "), &gtid) > 0 &&
+            node_store_delta_possible(ctx->node->store, &gtid))
+        {
+            since = gtid.seqno;
+            NODE_INFO("Sending delta of the state since seqno %lld",
+                      (long long)since);
+        }
+    }
+
+    /* REPLICATION: open additional connections to joiner, if some fail,
+     *              send over those that succeeded */
+    uint32_t i;
+    streams[0].socket = ctx->socket;
+    for (i = 1; i < num; i++)
+    {
+        streams[i].socket = node_socket_connect(ctx->addr);
+        if (!streams[i].socket) break;
+    }
+    num = i;
+
+    uint32_t tail[6];
+    size_t   tail_len = 0;
+    tail_len += sst_put_uint64(tail + tail_len, (uint64_t)since);
+    tail_len += sst_put_uint64(tail + tail_len, records_len);
+    tail[tail_len++] = htonl(num);
+    tail[tail_len++] = htonl(codec->id);
+
+    struct iovec iov[2] =
+    {
+        { .iov_base = (void*)header, .iov_len = header_len                  },
+        { .iov_base = tail,          .iov_len = tail_len * sizeof(tail[0]) }
+    };
+    int err = node_socket_send_iov(ctx->socket, iov, 2);
+
+    for (i = 1; i < num && !err; i++)
+    {
+        err = sst_send_uint32(streams[i].socket, i);
+    }
+
+    if (!err)
+    {
+        /* shard records between the streams */
+        for (i = 0; i < num; i++)
+        {
+            size_t const begin = records_len / num * i;
+            size_t const end   = (i + 1 == num) ?
+                records_len : records_len / num * (i + 1);
+
+            streams[i].node   = ctx->node;
+            streams[i].codec  = codec;
+            streams[i].since  = since;
+            streams[i].index  = i;
+            streams[i].offset = begin;
+            streams[i].len    = end - begin;
+        }
+
+        err = sst_run_streams(streams, num, sst_send_stream, sent);
+    }
+
+    for (i = 1; i < num; i++)
+    {
+        node_socket_close(streams[i].socket);
+    }
+
+    return err;
+}
+
 /**
  * donates SST and signals provider that it is done. */
 static void*
@@ -280,8 +962,9 @@ sst_donor_thread(void* const args)
     struct sst_donor_ctx const ctx = *(struct sst_donor_ctx*)args;
 
     int err = 0;
-    const void* state;
-    size_t state_len;
+    const void* header = NULL;
+    size_t header_len  = 0;
+    size_t records_len = 0;
 
     if (ctx.bypass)
     {
@@ -289,41 +972,57 @@ sst_donor_thread(void* const args)
          *              just signal the joiner that snapshot is not needed and
          *              it can proceed to apply IST. We'll do it by sending 0
          *              for the size of snapshot */
-        state = NULL;
-        state_len = 0;
     }
     else
     {
         /* REPLICATION: if bypass is false, we need to send a full state snapshot
-         *              Get hold of the state, which is currently just GTID
-         *              NOTICE that while parent is waiting, the store is in a
-         *              quiescent state, provider blocking any modifications. */
-        err = node_store_acquire_state(ctx.node->store, &state, &state_len);
-        if (state_len > UINT32_MAX) err = -ERANGE;
+         *              Pin the view of the state, which will be streamed from
+         *              the store without copying it all.
+         *              NOTICE that this relies on the provider calling
+         *              sst_donate_cb() with commit order drained up to the
+         *              donated GTID and blocking any commits until the
+         *              callback returns, so while parent is waiting, the
+         *              records match the GTID which delta SST trusts. */
+        err = node_store_acquire_state(ctx.node->store, &header, &header_len,
+                                       &records_len);
     }
 
-    /* REPLICATION: after getting hold of the state we can allow parent callback
+    /* REPLICATION: after pinning the state we can allow parent callback
      *              to return and the node to resume its normal operation */
     sst_sync_with_parent("DONOR", &sst_donor_mtx, &sst_donor_cond);
 
+    double const start = sst_time_now();
+
     if (err >= 0)
     {
-        uint32_t tmp = htonl((uint32_t)state_len);
-        err = node_socket_send_bytes(ctx.socket, &tmp, sizeof(tmp));
+        err = sst_send_uint32(ctx.socket, 0); /* stream index */
     }
 
-    if (state_len != 0)
+    if (err >= 0)
     {
+        err = sst_send_uint64(ctx.socket, header_len);
+    }
+
+    if (header)
+    {
+        size_t sent = 0;
+
         if (err >= 0)
         {
-            assert(state);
-            err = node_socket_send_bytes(ctx.socket, state, state_len);
+            err = sst_send_state(&ctx, header, header_len, records_len, &sent);
         }
 
         node_store_release_state(ctx.node->store);
+
+        if (err >= 0)
+        {
+            sst_report_rate("Sent", header_len + sent, start);
+        }
     }
 
     node_socket_close(ctx.socket);
+    free(ctx.addr);
+    free(ctx.request);
 
     /* REPLICATION: signal provider the success of the operation */
     wsrep_t* const wsrep = node_wsrep_provider(ctx.node->wsrep);
@@ -360,10 +1059,20 @@ node_sst_donate_cb (void*               const app_ctx,
         return WSREP_CB_FAILURE;
     }
 
-    const char* addr = str_msg->ptr;
-    ctx.socket = node_socket_connect(addr);
+    /* request starts with the address, parameters may follow it */
+    ctx.request = strdup(str_msg->ptr);
+    ctx.addr    = strndup(str_msg->ptr, strcspn(str_msg->ptr, " "));
+    if (ctx.request && ctx.addr)
+    {
+        ctx.socket = node_socket_connect(ctx.addr);
+    }
 
-    if (!ctx.socket) return WSREP_CB_FAILURE;
+    if (!ctx.socket)
+    {
+        free(ctx.addr);
+        free(ctx.request);
+        return WSREP_CB_FAILURE;
+    }
 
     sst_create_and_sync("DONOR", &sst_donor_mtx, &sst_donor_cond,
                         sst_donor_thread, &ctx);
@@ -17,6 +17,7 @@
 #include "stats.h"
 
 #include "log.h"
+#include "worker.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -35,6 +36,12 @@ enum
     STATS_TOTAL_WS,
     STATS_CERT_FAILS,
     STATS_STORE_FAILS,
+    STATS_ARENA_GROWS,
+    STATS_KEYS_GROWS,
+    STATS_RV_ABORTS,
+    STATS_RETRY_IMM,
+    STATS_RETRY_BACKOFF,
+    STATS_BACKOFF,
     STATS_FC_PAUSED,
     STATS_MAX
 };
@@ -49,6 +56,12 @@ static const char* const stats_legend[STATS_MAX] =
     "total(W/s)",
     " cert.fail",
     " stor.fail",
+    " arena.grw",
+    "  keys.grw",
+    "  rv.abort",
+    " retry.imm",
+    " retry.bck",
+    "backoff(%)",
     " paused(%)"
 };
 
@@ -63,6 +76,12 @@ static const char* const galera_ids[STATS_MAX] =
     "",                       /**<  STATS_TOTAL_WS   */
     "local_cert_failures",    /**<  STATS_CERT_FAILS */
     "",                       /**<  STATS_STORE_FAILS */
+    "",                       /**<  STATS_ARENA_GROWS */
+    "",                       /**<  STATS_KEYS_GROWS */
+    "",                       /**<  STATS_RV_ABORTS  */
+    "",                       /**<  STATS_RETRY_IMM  */
+    "",                       /**<  STATS_RETRY_BACKOFF */
+    "",                       /**<  STATS_BACKOFF    */
     "flow_control_paused_ns"  /**<  STATS_FC_PAUSED  */
 };
 
@@ -83,9 +102,9 @@ stats_establish_mapping(wsrep_t* const wsrep)
 
     struct wsrep_stats_var* const stats = wsrep->stats_get(wsrep);
 
-    /* to compensate for STATS_TOTAL_* and STATS_STORE_FAILS having no
-     * counterparts */
-    int mapped = 3;
+    /* to compensate for STATS_TOTAL_*, STATS_STORE_FAILS, STATS_*_GROWS
+     * and retry stats having no counterparts */
+    int mapped = 9;
 
     i = 0;
     while (stats[i].name) /* stats array is terminated by Null name */
@@ -110,10 +129,26 @@ out:
     wsrep->stats_free(wsrep, stats);
 }
 
+/* store stats are followed by commit group size and latency histograms */
+#define STATS_GROUP_HIST STATS_MAX
+#define STATS_LATENCY    (STATS_GROUP_HIST + NODE_STORE_GROUP_HIST)
+#define STATS_ALL        (STATS_LATENCY + NODE_WORKER_LATENCY_BUCKETS)
+
 static void
 stats_get(node_store_t* const store, wsrep_t* const wsrep, long long stats[])
 {
+    node_store_group_stats(store, &stats[STATS_GROUP_HIST]);
+    node_worker_latency_stats(&stats[STATS_LATENCY]);
     stats[STATS_STORE_FAILS] = node_store_read_view_failures(store);
+    stats[STATS_ARENA_GROWS] = node_store_trx_arena_grows(store);
+    stats[STATS_KEYS_GROWS]  = node_store_trx_keys_grows(store);
+
+    struct node_worker_retry_stats retry;
+    node_worker_retry_stats(&retry);
+    stats[STATS_RV_ABORTS]     = retry.rv_aborts;
+    stats[STATS_RETRY_IMM]     = retry.immediate_retries;
+    stats[STATS_RETRY_BACKOFF] = retry.backoff_retries;
+    stats[STATS_BACKOFF]       = retry.backoff_time;
 
     struct wsrep_stats_var* const ret = wsrep->stats_get(wsrep);
     if (!ret)
@@ -140,6 +175,42 @@ stats_get(node_store_t* const store, wsrep_t* const wsrep, long long stats[])
     stats[STATS_TOTAL_WS  ] = stats[STATS_REPL_WS  ] + stats[STATS_RECV_WS  ];
 }
 
+/**
+ * prints latency percentiles from the difference of two histograms */
+static int
+stats_print_latency(char* const str, size_t const len,
+                    const long long bef[], const long long aft[])
+{
+    static double const pct[]   = { 50.0, 90.0, 99.0, 99.9, 100.0 };
+    static const char*  const pct_name[] = { "p50", "p90", "p99", "p99.9",
+                                             "max" };
+    int const pct_num = (int)(sizeof(pct)/sizeof(pct[0]));
+
+    long long total = 0;
+    int i;
+    for (i = 0; i < NODE_WORKER_LATENCY_BUCKETS; i++) total += aft[i] - bef[i];
+
+    if (0 == total) return 0;
+
+    int written = snprintf(str, len, "\n latency(us):");
+
+    long long count = 0;
+    int p = 0;
+    for (i = 0; i < NODE_WORKER_LATENCY_BUCKETS && p < pct_num; i++)
+    {
+        count += aft[i] - bef[i];
+        while (p < pct_num && (double)count >= pct[p] * (double)total / 100.0)
+        {
+            size_t const space_left = len - (size_t)written;
+            written += snprintf(&str[written], space_left, " %s:%lld",
+                                pct_name[p], node_worker_latency_value(i));
+            p++;
+        }
+    }
+
+    return written;
+}
+
 static void
 stats_print(long long bef[], long long aft[], double period)
 {
@@ -150,8 +221,9 @@ stats_print(long long bef[], long long aft[], double period)
         rate[i] = (double)(aft[i] - bef[i])/period;
     }
     rate[STATS_FC_PAUSED] /= 1.0e+07; // nanoseconds to % of seconds
+    rate[STATS_BACKOFF]   /= 1.0e+04; // microseconds to % of seconds
 
-    char   str[256];
+    char   str[1024];
     int    written = 0;
 
     /* first line write legend */
@@ -172,6 +244,22 @@ stats_print(long long bef[], long long aft[], double period)
         written += snprintf(&str[written], space_left, " %9lld", value);
     }
 
+    /* third line: how many commit groups of each size were flushed */
+    written += snprintf(&str[written], sizeof(str) - (size_t)written,
+                        "\n commit groups:");
+    for (i = 0; i < NODE_STORE_GROUP_HIST; i++)
+    {
+        size_t const space_left = sizeof(str) - (size_t)written;
+        long long const value   =
+            aft[STATS_GROUP_HIST + i] - bef[STATS_GROUP_HIST + i];
+        written += snprintf(&str[written], space_left, " %d%s:%lld", 1 << i,
+                            i < NODE_STORE_GROUP_HIST - 1 ? "" : "+", value);
+    }
+
+    /* fourth line: latency percentiles of transactions committed in period */
+    written += stats_print_latency(&str[written], sizeof(str) - (size_t)written,
+                                   &bef[STATS_LATENCY], &aft[STATS_LATENCY]);
+
     str[written] = '\0';
 
     /* use logging macro for timestamp */
@@ -187,8 +275,8 @@ node_stats_loop(const struct node_ctx* const node, int const period)
     wsrep_t* const wsrep = node_wsrep_provider(node->wsrep);
     stats_establish_mapping(wsrep);
 
-    long long stats1[STATS_MAX];
-    long long stats2[STATS_MAX];
+    long long stats1[STATS_ALL];
+    long long stats2[STATS_ALL];
 
     stats_get(node->store, wsrep, stats1);
 
@@ -20,12 +20,18 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>    // open()
 #include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>   // ptrdiff_t
+#include <stdatomic.h>
 #include <stdint.h>   // uintptr_t
+#include <stdio.h>    // snprintf(), rename()
 #include <stdlib.h>   // abort()
 #include <string.h>   // memset()
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat()
+#include <unistd.h>   // write(), fsync(), ftruncate()
 
 #define DECLARE_SERIALIZE_INT(INTTYPE)                                  \
     static inline size_t                                                \
@@ -60,6 +66,12 @@ record_t;
 #define STORE_RECORD_SIZE \
     (sizeof(((record_t*)(NULL))->version) + sizeof(((record_t*)(NULL))->value))
 
+/* delta SST entry: uint32 index | record */
+#define STORE_DELTA_ENTRY_SIZE (sizeof(uint32_t) + STORE_RECORD_SIZE)
+
+/* number of records filtered at once when reading delta */
+#define STORE_DELTA_BATCH 1024
+
 static inline size_t
 store_record_set(void*           const base,
                  size_t          const index,
@@ -80,12 +92,81 @@ store_record_get(const void*     const base,
     return STORE_RECORD_SIZE;
 }
 
+/**
+ * 64-bit hash of the record at index. Records digest is the sum of hashes of
+ * all records, so it does not depend on the order of modifications and can be
+ * updated in O(1) when a record changes. */
+static inline uint64_t
+store_record_hash(size_t const index, const record_t* const record)
+{
+    uint64_t h = (((uint64_t)index << 32) | record->value) ^
+        ((uint64_t)record->version * 0x9e3779b97f4a7c15ULL);
+
+    /* splitmix64 finalizer */
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+
+    return h;
+}
+
+static uint64_t
+store_records_digest(const void* const records, uint32_t const num)
+{
+    uint64_t ret = 0;
+    uint32_t i;
+
+    for (i = 0; i < num; i++)
+    {
+        record_t rec;
+        store_record_get(records, i, &rec);
+        ret += store_record_hash(i, &rec);
+    }
+
+    return ret;
+}
+
+#if defined(__GNUC__)
+/* prefetch record at index in records array for read (0) or write (1) */
+#define STORE_RECORD_PREFETCH(base, index, rw) \
+    __builtin_prefetch((const char*)(base) + (size_t)(index)*STORE_RECORD_SIZE,\
+                       rw)
+#else
+#define STORE_RECORD_PREFETCH(base, index, rw)
+#endif /* __GNUC__ */
+
+/* how many ops ahead to prefetch records when applying a transaction */
+#define STORE_PREFETCH_DISTANCE 8
+
 static inline bool
 store_record_equal(const record_t* const lhs, const record_t* const rhs)
 {
     return (lhs->version == rhs->version) && (lhs->value == rhs->value);
 }
 
+static inline void
+store_serialize_gtid(void* const buf, const wsrep_gtid_t* const gtid)
+{
+    char* ptr = buf;
+    memcpy(ptr, &gtid->uuid, sizeof(gtid->uuid));
+    ptr += sizeof(gtid->uuid);
+    store_serialize_int64(ptr, gtid->seqno);
+}
+
+static inline void
+store_deserialize_gtid(wsrep_gtid_t* const gtid, const void* const buf)
+{
+    const char* ptr = buf;
+    memcpy(&gtid->uuid, ptr, sizeof(gtid->uuid));
+    ptr += sizeof(gtid->uuid);
+    store_deserialize_int64(&gtid->seqno, ptr);
+}
+
+#define STORE_GTID_SIZE (sizeof(((wsrep_gtid_t*)(NULL))->uuid) + sizeof(int64_t))
+
+/* writeset header: read view GTID and records digest at that GTID */
+#define STORE_WS_HDR_SIZE (STORE_GTID_SIZE + sizeof(uint64_t))
+
 /* transaction context */
 struct store_trx_op
 {
@@ -112,47 +193,161 @@ struct store_trx_op
 struct store_trx_ctx
 {
     wsrep_gtid_t         rv_gtid;
+    uint64_t             rv_digest; /* records digest at rv_gtid */
     size_t               ops_num;
+    /* ops array is an arena owned by the trx pool slot: it is reset, not
+     * freed, when transaction ends and is reused by the next one */
     struct store_trx_op* ops;
+    size_t               ops_size;
+    /* Local transaction writeset is gathered in ws_buf and its keys in keys
+     * arena (single part keys, their parts and values allocated as one block).
+     * These are passed to provider without copying, so they must stay
+     * unchanged until node_store_release() */
+    char*                ws_buf;
+    size_t               ws_size;
+    size_t               ws_len;
+    wsrep_key_t*         keys;
+    wsrep_buf_t*         key_parts;
+    uint32_t*            key_vals;
+    size_t               keys_size;
+    bool                 local; /* slot is held until node_store_release() */
 };
 
-static inline bool
-store_trx_add_op(struct store_trx_ctx* const trx)
+struct store_trx_entry
 {
-    struct store_trx_op* const new_ops =
-        realloc(trx->ops, sizeof(struct store_trx_op)*(trx->ops_num + 1));
+    atomic_bool          used;
+    unsigned int         seed; /* rand_r() seed of the slot owner */
+    uint64_t             gen;  /* slot reuse generation, part of trx ID */
+    struct store_trx_ctx ctx;
+};
 
-    if (new_ops)
-    {
-        trx->ops = new_ops;
-#ifndef NDEBUG
-        memset(&trx->ops[trx->ops_num], 0, sizeof(*trx->ops));
-#endif
-        trx->ops_num++;
-    }
+typedef wsrep_uuid_t member_t;
 
-    return (NULL == new_ops);
-}
+/* size of the records chunk that is preserved in the pinned view */
+#define STORE_VIEW_CHUNK ((size_t)65536 * STORE_RECORD_SIZE)
 
-struct store_trx_entry
+/* number of recent records digests kept, must be a power of 2 */
+#define STORE_DIGESTS 4096
+
+struct store_digest
 {
-    bool                 used;
-    struct store_trx_ctx ctx;
+    wsrep_seqno_t seqno;
+    uint64_t      digest;
 };
 
-typedef wsrep_uuid_t member_t;
+/* trx pool entries are aligned to cache line size to avoid false sharing
+ * between workers */
+#define STORE_CACHE_LINE 64
+#define STORE_ALIGN(x) \
+    (((x) + STORE_CACHE_LINE - 1) & ~(size_t)(STORE_CACHE_LINE - 1))
+
+/* Pinned copy-on-write view of the records: chunks that were not read yet
+ * are preserved before modification, see store_view_preserve(). Protected by
+ * view_mtx of the store. */
+struct store_view
+{
+    atomic_bool  active;
+    char**       copies; // preserved chunk copies
+    size_t*      read;   // bytes read from each chunk
+    size_t       chunks;
+    int          err;
+    wsrep_gtid_t gtid;   // GTID of the pinned view
+};
+
+/* deserialized state snapshot */
+struct store_state
+{
+    wsrep_gtid_t gtid;
+    member_t*    members;
+    void*        records;
+    uint32_t     members_num;
+    uint32_t     records_num;
+    bool         read_view_support;
+};
+
+/* number of record lock stripes, must be a power of 2 */
+#define STORE_STRIPES 256
+
+/* transaction that has modified the records in commit order but has not yet
+ * advanced the GTID and was not written to the log */
+struct store_group_entry
+{
+    wsrep_gtid_t gtid;
+    wsrep_gtid_t rv_gtid;   // read view of a foreign transaction
+    uint64_t     rv_digest; // records digest at rv_gtid at the origin
+    uint64_t     digest;    // records digest after the commit
+    bool         verify;    // rv_digest should be verified
+    bool         failed;    // read view check failed, trx was skipped
+};
+
+/* commit group: consecutive transactions awaiting to be flushed together */
+struct store_group
+{
+    struct store_group_entry* entries;
+    size_t entries_num;
+    size_t entries_size;
+    char*  log;             // serialized log entries of the group
+    size_t log_len;
+    size_t log_size;
+    size_t ckpt_len;        // log length up to the pinned checkpoint GTID
+};
 
 struct node_store
 {
+    /* Records are protected by striped locks, so that master threads can read
+     * them concurrently with committing transactions. Since all modifications
+     * happen in commit order, commits don't need to serialize with each other
+     * in the store, and gtid_mtx protects only GTID, membership and the log.
+     * Commits don't take gtid_mtx either: they only queue themselves in the
+     * current commit group under group_mtx. Whoever needs the GTID to catch up
+     * takes gtid_mtx and flushes the whole group at once, see
+     * store_group_flush(). */
+    pthread_mutex_t stripes[STORE_STRIPES];
     wsrep_gtid_t    gtid;
     pthread_mutex_t gtid_mtx;
-    wsrep_trx_id_t  trx_id;
-    pthread_mutex_t trx_id_mtx;
-    char*           snapshot;
+    atomic_uint_fast64_t trx_id; // trx pool slot allocation cursor
+    char*           snapshot; // serialized state header of the pinned view
+    struct store_state install; // state being installed by state transfer
+    atomic_size_t   installed; // records bytes received in state transfer
+    bool            installing;
+    /* pinned views of the records for streaming SST and for writing
+     * a checkpoint in the background */
+    pthread_mutex_t   view_mtx;
+    struct store_view sst_view;
+    struct store_view ckpt_view;
     member_t*       members;
     void*           records;
+    uint64_t        records_digest; // modified only in commit order
+    /* records digests published at recent GTIDs, protected by gtid_mtx */
+    struct store_digest digests[STORE_DIGESTS];
+    char*           dir;      // directory for persistent files
+    pthread_mutex_t group_mtx;
+    struct store_group groups[2]; // current one and the one being flushed
+    int             group_cur;
+    /* flushed commit group sizes, log2 buckets, protected by gtid_mtx */
+    long long       group_hist[NODE_STORE_GROUP_HIST];
+    size_t          log_size; // log bytes written since the last checkpoint
+    bool            ckpt_due; // checkpoint at the next commit, group_mtx
+    int             log_fd;
+    /* checkpoint written in the background, see store_checkpoint_pin() */
+    pthread_t       ckpt_thread;
+    pthread_mutex_t ckpt_mtx;
+    pthread_cond_t  ckpt_cond;
+    char*           ckpt_hdr;     // serialized header of the checkpoint
+    size_t          ckpt_hdr_len;
+    size_t          ckpt_rec_len; // length of the records in the checkpoint
+    bool            ckpt_started; // checkpoint thread is running
+    bool            ckpt_busy;    // checkpoint is in progress, ckpt_mtx
+    bool            ckpt_pinned;  // view is pinned for the thread, ckpt_mtx
+    bool            ckpt_exit;    // ckpt_mtx
+    bool            ckpt_cancel;  // newer checkpoint was written, gtid_mtx
+    size_t          ckpt_log_off; // log offset past checkpoint GTID, gtid_mtx
     size_t          op_size;
+    size_t          entry_size; // trx pool entry stride, cache line multiple
     long            read_view_fails;
+    atomic_long     arena_grows; // number of trx op arena reallocations
+    atomic_long     keys_grows;  // number of trx key arena reallocations
+    size_t          ops_hint;    // expected number of ops in transaction
     uint32_t        members_num;
     uint32_t        records_num;
     uint32_t        entries_mask;
@@ -160,97 +355,12 @@ struct node_store
     /* trx pool piggybacked */
 };
 
-node_store_t*
-node_store_open(const struct node_options* const opts)
-{
-    /* make the size of trx pool the next highest power of 2 over the total
-     * number of workers */
-    uint32_t trx_pool_mask = (uint32_t)(opts->masters + opts->slaves);
-    if (trx_pool_mask > 0)
-    {
-        trx_pool_mask -= 1;
-        trx_pool_mask |= trx_pool_mask >> 1;
-        trx_pool_mask |= trx_pool_mask >> 2;
-        trx_pool_mask |= trx_pool_mask >> 4;
-        trx_pool_mask |= trx_pool_mask >> 8;
-        trx_pool_mask |= trx_pool_mask >> 16;
-    }
-    assert(((trx_pool_mask + 1) & trx_pool_mask) == 0); // 2^n - 1
-
-    size_t const desired_op_size = (size_t)(opts->ws_size/opts->operations);
-    size_t const op_size = (desired_op_size > STORE_OP_SIZE ?
-                            desired_op_size : STORE_OP_SIZE);
-
-    /* since the number of workers will never change, we can allocate trx pool
-     * together with the main store struc */
-    size_t const store_alloc_size = sizeof(struct node_store) +
-        /* op_size - additional buffer for op serialization per trx */
-        (sizeof(struct store_trx_entry) + op_size)*(trx_pool_mask + 1);
-
-    struct node_store* const ret = malloc(store_alloc_size);
-
-    if (ret)
-    {
-        memset(ret, 0, store_alloc_size);
-        ret->records = malloc((size_t)opts->records * STORE_RECORD_SIZE);
-
-        if (ret->records)
-        {
-            ret->gtid = WSREP_GTID_UNDEFINED;
-            pthread_mutex_init(&ret->gtid_mtx, NULL);
-            pthread_mutex_init(&ret->trx_id_mtx, NULL);
-            ret->op_size      = op_size;
-            ret->records_num  = (uint32_t)opts->records;
-            ret->entries_mask = trx_pool_mask;
-
-            uint32_t i;
-            for (i = 0; i < ret->records_num; i++)
-            {
-                /* keep state in serialized form for easy snapshotting */
-                struct record const record = { WSREP_SEQNO_UNDEFINED, i };
-                store_record_set(ret->records, i, &record);
-            }
-
-            return ret;
-        }
-        else
-        {
-            free(ret);
-        }
-    }
-
-    return NULL;
-}
-
-void
-node_store_close(struct node_store* const store)
-{
-    assert(store);
-    assert(store->records);
-    pthread_mutex_destroy(&store->gtid_mtx);
-    pthread_mutex_destroy(&store->trx_id_mtx);
-    free(store->records);
-    free(store->members);
-    free(store);
-}
-
-#define STORE_MUTEX_LOCK(mtx)                              \
-    {                                                      \
-        int err = pthread_mutex_lock(mtx);                 \
-        if (err)                                           \
-        {                                                  \
-            NODE_FATAL("Failed to lock " #mtx ": %d (%s)", \
-                       err, strerror(err));                \
-            abort();                                       \
-        }                                                  \
-    }
-
 static inline struct store_trx_entry*
 store_get_trx_entry(struct node_store* const store, wsrep_trx_id_t const trx_id)
 {
     return (struct store_trx_entry*)
-        ((char*)(store + 1) + (trx_id & store->entries_mask)*
-         (sizeof(struct store_trx_entry) + store->op_size));
+        ((char*)store + STORE_ALIGN(sizeof(struct node_store)) +
+         (trx_id & store->entries_mask)*store->entry_size);
 }
 
 static inline struct store_trx_ctx*
@@ -259,59 +369,67 @@ store_get_trx_ctx(struct node_store* const store, wsrep_trx_id_t const trx_id)
     return &(store_get_trx_entry(store, trx_id)->ctx);
 }
 
-static inline wsrep_trx_id_t
-store_new_trx_id(struct node_store* const store)
+/**
+ * makes sure trx ops arena can hold at least num ops
+ *
+ * @return true if failed to allocate memory */
+static inline bool
+store_trx_reserve_ops(struct node_store*    const store,
+                      struct store_trx_ctx* const trx,
+                      size_t                const num)
 {
-    wsrep_trx_id_t ret;
-    struct store_trx_entry* trx;
+    if (num <= trx->ops_size) return false;
 
-    STORE_MUTEX_LOCK(&store->trx_id_mtx);
+    size_t new_size = trx->ops_size ?
+        trx->ops_size * 2 : store->ops_hint + (0 == store->ops_hint);
+    if (new_size < num) new_size = num;
 
-    do
-    {
-        store->trx_id++;
-        trx = store_get_trx_entry(store, store->trx_id);
-    }
-    while (trx->used);
-    trx->used = true;
-    ret = store->trx_id;
+    struct store_trx_op* const new_ops =
+        realloc(trx->ops, sizeof(struct store_trx_op)*new_size);
 
-    pthread_mutex_unlock(&store->trx_id_mtx);
+    if (!new_ops) return true;
 
-    memset(&trx->ctx, 0, sizeof(trx->ctx));
+    trx->ops      = new_ops;
+    trx->ops_size = new_size;
+    atomic_fetch_add_explicit(&store->arena_grows, 1, memory_order_relaxed);
 
-    return ret;
+    return false;
 }
 
-static inline void
-store_free_trx_id(struct node_store* const store, wsrep_trx_id_t const trx_id)
+static inline bool
+store_trx_add_op(struct node_store* const store, struct store_trx_ctx* const trx)
 {
-    struct store_trx_entry* const trx = store_get_trx_entry(store, trx_id);
-    assert(trx->used);
-    free(trx->ctx.ops);
-
-    STORE_MUTEX_LOCK(&store->trx_id_mtx);
+    if (store_trx_reserve_ops(store, trx, trx->ops_num + 1)) return true;
 
-    trx->used = false;
+#ifndef NDEBUG
+    memset(&trx->ops[trx->ops_num], 0, sizeof(*trx->ops));
+#endif
+    trx->ops_num++;
 
-    pthread_mutex_unlock(&store->trx_id_mtx);
+    return false;
 }
 
 /**
  * deserializes membership from snapshot */
 static int
 store_new_members(const char* ptr, const char* const endptr,
+                  uint32_t const min_num,
                   uint32_t* const num, member_t** const memb)
 {
     ptr += store_deserialize_uint32(num, ptr);
 
-    if (*num < 2)
+    if (*num < min_num)
     {
         NODE_ERROR("Bogus number of members %u", *num);
         return -1;
     }
 
     int ret = (int)sizeof(*num);
+    if (!*num)
+    {
+        *memb = NULL;
+        return ret;
+    }
 
     size_t const msize = sizeof(member_t) * *num;
     if ((endptr - ptr) < (ptrdiff_t)msize)
@@ -334,9 +452,11 @@ store_new_members(const char* ptr, const char* const endptr,
 }
 
 /**
- * deserializes records from snapshot */
+ * deserializes records from snapshot, if header_only is true, only allocates
+ * records array to be filled later */
 static int
 store_new_records(const char* ptr, const char* const endptr,
+                  bool const header_only,
                   uint32_t* const num, void** const rec)
 {
     ptr += store_deserialize_uint32(num, ptr);
@@ -349,7 +469,7 @@ store_new_records(const char* ptr, const char* const endptr,
     }
 
     size_t const rsize = STORE_RECORD_SIZE * *num;
-    if ((endptr - ptr) < (ptrdiff_t)rsize)
+    if (!header_only && (endptr - ptr) < (ptrdiff_t)rsize)
     {
         NODE_ERROR("State snapshot does not contain all records: "
                    "%zu < %zu", endptr - ptr, rsize);
@@ -363,27 +483,38 @@ store_new_records(const char* ptr, const char* const endptr,
         return -ENOMEM;
     }
 
+    if (header_only) return ret;
+
     memcpy(*rec, ptr, rsize);
 
     return ret + (int)rsize;
 }
 
-int
-node_store_init_state(struct node_store*  const store,
-                      const void*         const state,
-                      size_t              const state_len)
+/**
+ * deserializes state snapshot
+ *
+ * @param[in]  min_members minimum acceptable number of members in the state
+ * @param[in]  header_only state contains only header, records array is
+ *                         allocated but not filled
+ * @param[out] st          deserialized state, members and records arrays must
+ *                         be freed by the caller
+ */
+static int
+store_parse_state(const void*         const state,
+                  size_t              const state_len,
+                  uint32_t            const min_members,
+                  bool                const header_only,
+                  struct store_state* const st)
 {
-    /* First, deserialize and prepare new state */
-    if (state_len <= sizeof(member_t)*2 /* at least two members */ +
+    if (state_len <= sizeof(member_t)*min_members +
         WSREP_UUID_STR_LEN + 1 /* : */ + 1 /* seqno */ + 1 /* \0 */)
     {
         NODE_ERROR("State snapshot too short: %zu", state_len);
         return -1;
     }
 
-    wsrep_gtid_t state_gtid;
     int ret;
-    ret = wsrep_gtid_scan(state, state_len, &state_gtid);
+    ret = wsrep_gtid_scan(state, state_len, &st->gtid);
     if (ret < 0)
     {
         char state_str[WSREP_GTID_STR_LEN + 1] = { 0, };
@@ -404,52 +535,1989 @@ node_store_init_state(struct node_store*  const store,
     const char* const endptr = ptr + state_len;
     ptr += ret;
 
-    uint32_t m_num;
-    member_t* new_members;
-    ret = store_new_members(ptr, endptr, &m_num, &new_members);
+    ret = store_new_members(ptr, endptr, min_members,
+                            &st->members_num, &st->members);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ptr += ret;
+
+    if ((endptr - ptr) < (ptrdiff_t)(1 + sizeof(uint32_t)))
+    {
+        NODE_ERROR("State snapshot does not contain the number of records");
+        free(st->members);
+        return -1;
+    }
+
+    st->read_view_support = ptr[0];
+    ptr += 1;
+
+    ret = store_new_records(ptr, endptr, header_only,
+                            &st->records_num, &st->records);
+    if (ret < 0)
+    {
+        free(st->members);
+        return ret;
+    }
+
+    return 0;
+}
+
+/**
+ * @return the size of the serialized state header: everything but records */
+static size_t
+store_header_size(const struct node_store* const store)
+{
+    return WSREP_GTID_STR_LEN + 1
+        + sizeof(uint32_t) + store->members_num * sizeof(member_t)
+        + 1 /* read view support */
+        + sizeof(uint32_t);
+}
+
+/**
+ * serializes state header. Records array is supposed to follow it.
+ *
+ * @param gtid GTID the records match, not necessarily the store GTID yet
+ *
+ * @return the length of the serialized header or negative error code
+ */
+static int
+store_serialize_header(const struct node_store* const store,
+                       const wsrep_gtid_t*      const gtid,
+                       char*                    const buf,
+                       size_t                   const buf_len)
+{
+    char* ptr = buf;
+    size_t const memb_len = store->members_num * sizeof(member_t);
+
+    /* state GTID */
+    int ret = wsrep_gtid_print(gtid, ptr, buf_len);
     if (ret < 0)
     {
+        NODE_ERROR("Failed to record GTID: %d (%s)", ret, strerror(-ret));
         return ret;
     }
+    assert((size_t)ret < buf_len);
+
+    ptr[ret] = '\0';
+    ret++;
     ptr += ret;
 
-    bool const read_view_support = ptr[0];
+    /* membership */
+    ptr += store_serialize_uint32(ptr, store->members_num);
+    ret += (int)sizeof(uint32_t);
+    assert((size_t)ret + memb_len < buf_len);
+    memcpy(ptr, store->members, memb_len);
+    ptr += memb_len;
+    ret += (int)memb_len;
+
+    /* read view support */
+    ptr[0] = store->read_view_support;
     ptr += 1;
+    ret += 1;
+
+    /* number of records */
+    store_serialize_uint32(ptr, store->records_num);
+    ret += (int)sizeof(uint32_t);
+    assert((size_t)ret <= buf_len);
+
+    return ret;
+}
+
+static uint32_t const store_fnv32_seed  = 2166136261;
+
+static inline uint32_t
+store_fnv32a(const void* buf, size_t const len, uint32_t seed)
+{
+    static uint32_t const fnv32_prime = 16777619;
+    const uint8_t* bp = (const uint8_t*)buf;
+    const uint8_t* const be = bp + len;
+
+    while (bp < be)
+    {
+        seed ^= *bp++;
+        seed *= fnv32_prime;
+    }
+
+    return seed;
+}
+
+/*
+ * Persistence.
+ *
+ * The state is kept in data directory as a checkpoint file, which contains
+ * the serialized state snapshot (exactly as it is sent in SST), and an append
+ * only log of transactions committed since that checkpoint. The log starts with
+ * the GTID of the checkpoint it continues and is followed by entries
+ *
+ *   seqno (int64) | ops_num (uint32) | ops_num x { idx, value } (uint32 each) |
+ *   checksum (uint32)
+ *
+ * Log entries are written at commit time, but are not synced to disk, so the
+ * store survives a process crash intact, while in case of OS crash it will
+ * lose some latest transactions. In both cases the recovered state will be
+ * consistent and its GTID will be reported to provider to fetch the rest in IST.
+ *
+ * A new checkpoint is written once the log becomes bigger than the state, so
+ * recovery never has to read more than twice the state size. The next commit
+ * only pins a copy-on-write view of the records at its GTID in commit order,
+ * and the checkpoint thread writes it from the view while commits go on, see
+ * store_checkpoint_pin(). Then the log is started anew from the checkpoint
+ * GTID with the entries that followed it. Until that, the log starts before
+ * the checkpoint, so recovery skips the log entries the checkpoint has.
+ */
+
+#define STORE_CKPT_NAME "store.ckpt"
+#define STORE_LOG_NAME  "store.log"
+/* the checkpoint written in the background, renamed to STORE_CKPT_NAME */
+#define STORE_CKPT_BG_NAME STORE_CKPT_NAME ".bg"
+
+#define STORE_LOG_HDR_SIZE   (sizeof(int64_t) + sizeof(uint32_t))
+#define STORE_LOG_OP_SIZE    (sizeof(uint32_t) + sizeof(uint32_t))
+#define STORE_LOG_ENTRY_SIZE(ops_num) \
+    (STORE_LOG_HDR_SIZE + (ops_num)*STORE_LOG_OP_SIZE + sizeof(uint32_t))
+
+static int
+store_file_path(const struct node_store* const store,
+                const char*              const name,
+                char*                    const buf,
+                size_t                   const buf_len)
+{
+    int const ret = snprintf(buf, buf_len, "%s/%s", store->dir, name);
+    if (ret < 0 || (size_t)ret >= buf_len)
+    {
+        NODE_ERROR("Path to '%s' in '%s' is too long", name, store->dir);
+        return -ENAMETOOLONG;
+    }
+    return 0;
+}
+
+static int
+store_write_all(int const fd, const void* const buf, size_t const len)
+{
+    const char* ptr = buf;
+    size_t left = len;
+
+    while (left > 0)
+    {
+        ssize_t const ret = write(fd, ptr, left);
+        if (ret < 0)
+        {
+            if (EINTR == errno) continue;
+            return -errno;
+        }
+        ptr  += ret;
+        left -= (size_t)ret;
+    }
+
+    return 0;
+}
+
+/**
+ * truncates transaction log and starts it anew from gtid */
+static int
+store_log_reset(struct node_store* const store, const wsrep_gtid_t* const gtid)
+{
+    char hdr[STORE_GTID_SIZE];
+    store_serialize_gtid(hdr, gtid);
+
+    int ret = 0;
+    if (ftruncate(store->log_fd, 0)) ret = -errno;
+    if (!ret) ret = store_write_all(store->log_fd, hdr, sizeof(hdr));
+    if (!ret && fdatasync(store->log_fd)) ret = -errno;
+
+    if (ret)
+    {
+        NODE_ERROR("Failed to reset transaction log: %d (%s)",
+                   -ret, strerror(-ret));
+    }
+
+    store->log_size = 0;
+
+    return ret;
+}
+
+/**
+ * starts a new log from gtid of the checkpoint that was just written and moves
+ * over the entries that follow it from offset off of the current log. On
+ * failure the current log stays: recovery skips the entries the checkpoint
+ * has. */
+static int
+store_log_compact(struct node_store*  const store,
+                  const wsrep_gtid_t* const gtid,
+                  size_t              const off)
+{
+    char tmp_path[4096];
+    char path[4096];
+    int ret;
+
+    if ((ret = store_file_path(store, STORE_LOG_NAME ".tmp",
+                               tmp_path, sizeof(tmp_path))) ||
+        (ret = store_file_path(store, STORE_LOG_NAME, path, sizeof(path))))
+    {
+        return ret;
+    }
+
+    int const fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (fd < 0)
+    {
+        ret = -errno;
+        NODE_ERROR("Failed to open '%s': %d (%s)", tmp_path, -ret,strerror(-ret));
+        return ret;
+    }
+
+    char buf[65536];
+    store_serialize_gtid(buf, gtid);
+    ret = store_write_all(fd, buf, STORE_GTID_SIZE);
+
+    size_t const end = STORE_GTID_SIZE + store->log_size;
+    size_t pos = off;
+    while (!ret && pos < end)
+    {
+        size_t const len = end - pos < sizeof(buf) ? end - pos : sizeof(buf);
+        ssize_t const n = pread(store->log_fd, buf, len, (off_t)pos);
+        if (n < 0 && EINTR == errno) continue;
+        if (n <= 0)
+        {
+            ret = n < 0 ? -errno : -EIO;
+            break;
+        }
+        ret = store_write_all(fd, buf, (size_t)n);
+        pos += (size_t)n;
+    }
+
+    if (!ret && fdatasync(fd)) ret = -errno;
+    if (!ret && rename(tmp_path, path)) ret = -errno;
+
+    if (ret)
+    {
+        NODE_ERROR("Failed to start transaction log from checkpoint: %d (%s)",
+                   -ret, strerror(-ret));
+        close(fd);
+        unlink(tmp_path);
+        return ret;
+    }
+
+    close(store->log_fd);
+    store->log_fd   = fd;
+    store->log_size = end - off;
+
+    return 0;
+}
+
+/**
+ * creates a new checkpoint file at tmp_path and writes state header to it
+ *
+ * @return file descriptor or negative error code */
+static int
+store_checkpoint_open(const char* const tmp_path,
+                      const char* const hdr,
+                      size_t      const hdr_len)
+{
+    int const fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        int const ret = -errno;
+        NODE_ERROR("Failed to open '%s': %d (%s)", tmp_path, -ret,strerror(-ret));
+        return ret;
+    }
+
+    int const ret = store_write_all(fd, hdr, hdr_len);
+    if (ret)
+    {
+        close(fd);
+        return ret;
+    }
+
+    return fd;
+}
+
+/**
+ * replaces the checkpoint with the one fully written at tmp_path
+ *
+ * @param err error writing the new checkpoint, if any, then it is discarded */
+static int
+store_checkpoint_rename(const struct node_store* const store,
+                        const char*              const tmp_path,
+                        int                            err)
+{
+    char path[4096];
+
+    if (!err) err = store_file_path(store, STORE_CKPT_NAME, path, sizeof(path));
+    if (!err && rename(tmp_path, path)) err = -errno;
+
+    if (err)
+    {
+        if (-ECANCELED != err)
+        {
+            NODE_ERROR("Failed to write checkpoint '%s': %d (%s)",
+                       tmp_path, -err, strerror(-err));
+        }
+        unlink(tmp_path);
+        return err;
+    }
+
+    /* make rename durable */
+    int const dir_fd = open(store->dir, O_RDONLY);
+    if (dir_fd >= 0)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    return 0;
+}
+
+/**
+ * writes current state to a new checkpoint file and truncates the log.
+ * Must be called with no concurrent modifications to the store: either in
+ * commit order or when no transactions are processed at all. */
+static int
+store_checkpoint(struct node_store* const store)
+{
+    char tmp_path[4096];
+    int ret;
+
+    if ((ret = store_file_path(store, STORE_CKPT_NAME ".tmp",
+                               tmp_path, sizeof(tmp_path))))
+    {
+        return ret;
+    }
+
+    size_t const hdr_size = store_header_size(store);
+    char* const hdr = malloc(hdr_size);
+    if (!hdr)
+    {
+        NODE_ERROR("Failed to allocate %zu bytes for checkpoint header",
+                   hdr_size);
+        return -ENOMEM;
+    }
+
+    ret = store_serialize_header(store, &store->gtid, hdr, hdr_size);
+    if (ret < 0) goto out;
+
+    int const fd = store_checkpoint_open(tmp_path, hdr, (size_t)ret);
+    if (fd < 0)
+    {
+        ret = fd;
+        goto out;
+    }
+
+    /* records are written separately to avoid copying the state */
+    ret = store_write_all(fd, store->records,
+                          store->records_num * STORE_RECORD_SIZE);
+    if (!ret && fsync(fd)) ret = -errno;
+    close(fd);
+
+    ret = store_checkpoint_rename(store, tmp_path, ret);
+    if (ret) goto out;
+
+    /* Only now it is safe to discard the log. If we crash before that, the
+     * log entries are skipped as the checkpoint already has them. */
+    ret = store_log_reset(store, &store->gtid);
+
+out:
+    free(hdr);
+    return ret;
+}
+
+/**
+ * serializes a record of committed transaction to the log buffer of the
+ * current commit group. Must be called in commit order under group_mtx.
+ *
+ * @param trx committed transaction context or NULL if the transaction was
+ *            skipped and only GTID needs to be recorded
+ */
+static void
+store_log_serialize(struct store_group*         const group,
+                    wsrep_seqno_t               const seqno,
+                    const struct store_trx_ctx* const trx)
+{
+    uint32_t const ops_num  = trx ? (uint32_t)trx->ops_num : 0;
+    size_t   const entry_len = STORE_LOG_ENTRY_SIZE(ops_num);
+
+    if (group->log_len + entry_len > group->log_size)
+    {
+        size_t size = group->log_size ? group->log_size : 4096;
+        while (size < group->log_len + entry_len) size *= 2;
+
+        char* const tmp = realloc(group->log, size);
+        if (!tmp)
+        {
+            NODE_FATAL("Failed to allocate %zu bytes for log entries", size);
+            abort();
+        }
+        group->log      = tmp;
+        group->log_size = size;
+    }
+
+    char* const entry = group->log + group->log_len;
+    char* ptr = entry;
+    ptr += store_serialize_int64(ptr, seqno);
+    ptr += store_serialize_uint32(ptr, ops_num);
+
+    uint32_t i;
+    for (i = 0; i < ops_num; i++)
+    {
+        ptr += store_serialize_uint32(ptr, trx->ops[i].idx_to);
+        ptr += store_serialize_uint32(ptr, trx->ops[i].new_value);
+    }
+
+    uint32_t const checksum = store_fnv32a(entry, (size_t)(ptr - entry),
+                                           store_fnv32_seed);
+    store_serialize_uint32(ptr, checksum);
+
+    group->log_len += entry_len;
+}
+
+/**
+ * appends log entries of a flushed commit group to the log. Must be called
+ * under gtid_mtx. */
+static void
+store_log_write(struct node_store*  const store,
+                struct store_group* const group)
+{
+    if (group->ckpt_len > 0)
+    {
+        /* the log will be restarted from here once the checkpoint pinned in
+         * this group is written */
+        store->ckpt_log_off = STORE_GTID_SIZE + store->log_size +
+            group->ckpt_len;
+        group->ckpt_len = 0;
+    }
+
+    int const err = store_write_all(store->log_fd, group->log, group->log_len);
+    if (err)
+    {
+        NODE_FATAL("Failed to write transaction log: %d (%s)",
+                   -err, strerror(-err));
+        abort();
+    }
+
+    store->log_size += group->log_len;
+}
+
+/**
+ * replays transaction log entries on top of the recovered checkpoint, skipping
+ * those that precede it
+ *
+ * @param from the seqno the log starts from, not above the checkpoint seqno
+ * @param last the seqno of the last valid log entry, from if there are none
+ *
+ * @return the length of the valid log prefix */
+static size_t
+store_log_replay(struct node_store* const store,
+                 const char*        const log,
+                 size_t             const log_len,
+                 wsrep_seqno_t      const from,
+                 wsrep_seqno_t*     const last)
+{
+    const char* ptr = log + STORE_GTID_SIZE;
+    const char* const endptr = log + log_len;
+    wsrep_seqno_t prev = from;
+    long replayed = 0;
+
+    while ((size_t)(endptr - ptr) >= STORE_LOG_ENTRY_SIZE(0))
+    {
+        int64_t  seqno;
+        uint32_t ops_num;
+        store_deserialize_int64(&seqno, ptr);
+        store_deserialize_uint32(&ops_num, ptr + sizeof(seqno));
+
+        size_t const entry_len = STORE_LOG_ENTRY_SIZE((size_t)ops_num);
+        if ((size_t)(endptr - ptr) < entry_len) break; /* torn write */
+
+        uint32_t checksum;
+        store_deserialize_uint32(&checksum, ptr + entry_len - sizeof(checksum));
+        if (checksum != store_fnv32a(ptr, entry_len - sizeof(checksum),
+                                     store_fnv32_seed)) break;
+
+        if (seqno != prev + 1)
+        {
+            NODE_ERROR("Unexpected seqno in transaction log: %lld, expected "
+                       "%lld", (long long)seqno, (long long)(prev + 1));
+            break;
+        }
+
+        if (seqno <= store->gtid.seqno)
+        {
+            /* the checkpoint already has it */
+            prev = seqno;
+            ptr += entry_len;
+            continue;
+        }
+
+        const char* op = ptr + STORE_LOG_HDR_SIZE;
+        uint32_t i;
+        for (i = 0; i < ops_num; i++)
+        {
+            record_t rec = { .version = seqno };
+            uint32_t idx;
+            op += store_deserialize_uint32(&idx, op);
+            op += store_deserialize_uint32(&rec.value, op);
+            if (idx >= store->records_num) break;
+            store_record_set(store->records, idx, &rec);
+        }
+        if (i < ops_num)
+        {
+            NODE_ERROR("Bogus record index in transaction log at seqno %lld",
+                       (long long)seqno);
+            break;
+        }
+
+        store->gtid.seqno = seqno;
+        prev = seqno;
+        replayed++;
+        ptr += entry_len;
+    }
+
+    NODE_INFO("Replayed %ld transactions from the log", replayed);
+
+    *last = prev;
+    return (size_t)(ptr - log);
+}
+
+/**
+ * maps a file into memory for reading
+ *
+ * @return 0 on success, 1 if file is absent or empty, negative error code */
+static int
+store_map_file(const char* const path, int const fd,
+               const char** const map, size_t* const map_len)
+{
+    struct stat st;
+    if (fstat(fd, &st))
+    {
+        int const err = errno;
+        NODE_ERROR("Failed to stat '%s': %d (%s)", path, err, strerror(err));
+        return -err;
+    }
+
+    if (0 == st.st_size) return 1;
+
+    void* const ret = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+                           fd, 0);
+    if (MAP_FAILED == ret)
+    {
+        int const err = errno;
+        NODE_ERROR("Failed to mmap '%s': %d (%s)", path, err, strerror(err));
+        return -err;
+    }
+
+    *map     = ret;
+    *map_len = (size_t)st.st_size;
+    return 0;
+}
+
+/**
+ * publishes records digest at the current GTID, must be called under gtid_mtx
+ * after records digest was updated */
+static inline void
+store_digest_publish(struct node_store* const store, uint64_t const digest)
+{
+    if (store->gtid.seqno < 0) return;
+
+    struct store_digest* const d =
+        &store->digests[store->gtid.seqno & (STORE_DIGESTS - 1)];
+    d->seqno  = store->gtid.seqno;
+    d->digest = digest;
+}
+
+/**
+ * forgets all published digests, e.g. when the store starts new history */
+static void
+store_digest_reset(struct node_store* const store)
+{
+    size_t i;
+    for (i = 0; i < STORE_DIGESTS; i++)
+    {
+        store->digests[i].seqno = WSREP_SEQNO_UNDEFINED;
+    }
+
+    store_digest_publish(store, store->records_digest);
+}
+
+/**
+ * looks up records digest published at seqno, must be called under gtid_mtx
+ *
+ * @return true if found */
+static inline bool
+store_digest_get(const struct node_store* const store,
+                 wsrep_seqno_t            const seqno,
+                 uint64_t*                const digest)
+{
+    if (seqno < 0) return false;
+
+    const struct store_digest* const d =
+        &store->digests[seqno & (STORE_DIGESTS - 1)];
+    if (d->seqno != seqno) return false;
+
+    *digest = d->digest;
+    return true;
+}
+
+/**
+ * restores the store state from the checkpoint and the log, if present, and
+ * opens the log for appending */
+static int
+store_recover(struct node_store* const store)
+{
+    char path[4096];
+    int ret;
+
+    /* a checkpoint being written in the background when the node crashed
+     * is incomplete and would just linger */
+    if (!store_file_path(store, STORE_CKPT_BG_NAME, path, sizeof(path)))
+        unlink(path);
+
+    ret = store_file_path(store, STORE_CKPT_NAME, path, sizeof(path));
+    if (ret) return ret;
+
+    const char* map;
+    size_t map_len;
+    bool have_ckpt = false;
+
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        ret = store_map_file(path, fd, &map, &map_len);
+        close(fd);
+        if (ret < 0) return ret;
+
+        if (0 == ret)
+        {
+            struct store_state st;
+            ret = store_parse_state(map, map_len, 0, false, &st);
+            munmap((void*)map, map_len);
+            if (ret)
+            {
+                NODE_ERROR("Failed to recover state from '%s'", path);
+                return ret;
+            }
+
+            if (st.records_num != store->records_num)
+            {
+                NODE_INFO("Recovered %u records instead of configured %u",
+                          st.records_num, store->records_num);
+            }
+
+            free(store->records);
+            store->records     = st.records;
+            store->records_num = st.records_num;
+            store->members     = st.members;
+            store->members_num = st.members_num;
+            store->gtid        = st.gtid;
+            store->read_view_support = st.read_view_support;
+            have_ckpt = true;
+        }
+    }
+    else if (ENOENT != errno)
+    {
+        ret = -errno;
+        NODE_ERROR("Failed to open '%s': %d (%s)", path, -ret, strerror(-ret));
+        return ret;
+    }
+
+    if ((ret = store_file_path(store, STORE_LOG_NAME, path, sizeof(path))))
+        return ret;
+
+    store->log_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (store->log_fd < 0)
+    {
+        ret = -errno;
+        NODE_ERROR("Failed to open '%s': %d (%s)", path, -ret, strerror(-ret));
+        return ret;
+    }
+
+    size_t valid_len = 0;
+    if (have_ckpt && 0 == (ret = store_map_file(path, store->log_fd,
+                                                &map, &map_len)))
+    {
+        wsrep_gtid_t log_gtid = WSREP_GTID_UNDEFINED;
+        if (map_len >= STORE_GTID_SIZE) store_deserialize_gtid(&log_gtid, map);
+
+        /* the log may start before the checkpoint if it was not restarted
+         * after the checkpoint was written */
+        if (0 == wsrep_uuid_compare(&log_gtid.uuid, &store->gtid.uuid) &&
+            log_gtid.seqno <= store->gtid.seqno)
+        {
+            wsrep_seqno_t last;
+            valid_len = store_log_replay(store, map, map_len, log_gtid.seqno,
+                                         &last);
+
+            /* the log can't be continued if it ends before the checkpoint */
+            if (last != store->gtid.seqno) valid_len = 0;
+        }
+
+        munmap((void*)map, map_len);
+
+        if (valid_len < map_len)
+        {
+            NODE_INFO("Discarding %zu bytes of transaction log",
+                      map_len - valid_len);
+        }
+    }
+    if (ret < 0) return ret;
+
+    if (valid_len > 0)
+    {
+        /* continue the log after the last valid entry */
+        if (ftruncate(store->log_fd, (off_t)valid_len))
+        {
+            ret = -errno;
+            NODE_ERROR("Failed to truncate '%s': %d (%s)",
+                       path, -ret, strerror(-ret));
+            return ret;
+        }
+        store->log_size = valid_len - STORE_GTID_SIZE;
+    }
+    else
+    {
+        /* log is unusable, start it anew */
+        ret = store_log_reset(store, &store->gtid);
+        if (ret) return ret;
+    }
+
+    store->records_digest =
+        store_records_digest(store->records, store->records_num);
+    store_digest_reset(store);
+
+    char gtid_str[WSREP_GTID_STR_LEN + 1] = { 0, };
+    wsrep_gtid_print(&store->gtid, gtid_str, sizeof(gtid_str) - 1);
+    NODE_INFO("Recovered store state %s: %u records", gtid_str,
+              store->records_num);
+
+    return 0;
+}
+
+#define STORE_MUTEX_LOCK(mtx)                              \
+    {                                                      \
+        int err = pthread_mutex_lock(mtx);                 \
+        if (err)                                           \
+        {                                                  \
+            NODE_FATAL("Failed to lock " #mtx ": %d (%s)", \
+                       err, strerror(err));                \
+            abort();                                       \
+        }                                                  \
+    }
+
+static void
+store_checksum_state(node_store_t* store, uint64_t const digest)
+{
+    uint32_t res = store_fnv32_seed;
+    uint32_t i;
+
+    for (i = 0; i < store->members_num; i++)
+    {
+        res = store_fnv32a(&store->members[i], sizeof(*store->members), res);
+    }
+
+    /* records contribute their incrementally maintained digest, so this does
+     * not need to scan them */
+    uint64_t d;
+    store_serialize_int64(&d, (int64_t)digest);
+    res = store_fnv32a(&d, sizeof(d), res);
+
+    res = store_fnv32a(&store->gtid.uuid, sizeof(store->gtid.uuid), res);
+
+    wsrep_seqno_t s;
+    store_serialize_int64(&s, store->gtid.seqno);
+    res = store_fnv32a(&s, sizeof(s), res);
+
+    NODE_INFO("\n\n\tSeqno: %lld; state hash: %#010x\n",
+              (long long)store->gtid.seqno, res);
+}
+
+/**
+ * advances store GTID to ws_gtid, must be called under gtid_mtx
+ *
+ * @param digest records digest at ws_gtid */
+static inline void
+store_update_gtid(node_store_t* const store, const wsrep_gtid_t* ws_gtid,
+                  uint64_t const digest)
+{
+    assert(0 == wsrep_uuid_compare(&store->gtid.uuid, &ws_gtid->uuid));
+
+    store->gtid.seqno++;
+
+    if (store->gtid.seqno != ws_gtid->seqno)
+    {
+        NODE_FATAL("Out of order commit: expected %lld, got %lld",
+                   store->gtid.seqno, ws_gtid->seqno);
+        abort();
+    }
+
+    store_digest_publish(store, digest);
+
+    static wsrep_seqno_t const period = 0x000fffff; /* ~1M */
+    if (0 == (store->gtid.seqno & period))
+    {
+        store_checksum_state(store, digest);
+    }
+}
+
+/**
+ * compares records digest at the read view of a foreign transaction to the
+ * local one at the same GTID, if it is still known. Must be called under
+ * gtid_mtx */
+static void
+store_verify_digest(const struct node_store*        const store,
+                    const struct store_group_entry* const e)
+{
+    uint64_t digest;
+
+    if (0 != wsrep_uuid_compare(&e->rv_gtid.uuid, &store->gtid.uuid) ||
+        !store_digest_get(store, e->rv_gtid.seqno, &digest) ||
+        0 == e->rv_digest /* not known to master */)
+        return;
+
+    if (digest != e->rv_digest)
+    {
+        NODE_FATAL("State divergence detected: records digest at seqno %lld "
+                   "is %#018llx locally, but %#018llx at the origin of "
+                   "writeset %lld",
+                   (long long)e->rv_gtid.seqno, (unsigned long long)digest,
+                   (unsigned long long)e->rv_digest,
+                   (long long)e->gtid.seqno);
+        abort();
+    }
+}
+
+/**
+ * adds an entry to the current commit group, must be called in commit order
+ * under group_mtx after the records were modified
+ *
+ * @param trx transaction context or NULL if only GTID needs to be advanced */
+static struct store_group_entry*
+store_group_add(struct node_store*          const store,
+                const wsrep_gtid_t*         const ws_gtid,
+                const struct store_trx_ctx* const trx)
+{
+    struct store_group* const group = &store->groups[store->group_cur];
+
+    if (group->entries_num == group->entries_size)
+    {
+        size_t const size = group->entries_size ? group->entries_size*2 : 64;
+        struct store_group_entry* const tmp =
+            realloc(group->entries, size * sizeof(*tmp));
+        if (!tmp)
+        {
+            NODE_FATAL("Failed to allocate %zu commit group entries", size);
+            abort();
+        }
+        group->entries      = tmp;
+        group->entries_size = size;
+    }
+
+    store_log_serialize(group, ws_gtid->seqno, trx);
+
+    struct store_group_entry* const e = &group->entries[group->entries_num++];
+    e->gtid   = *ws_gtid;
+    e->digest = store->records_digest;
+    e->verify = false;
+    e->failed = false;
+
+    return e;
+}
+
+/**
+ * writes the log entries of the commit group and advances the store GTID
+ * through all of its transactions. Must be called under gtid_mtx. */
+static void
+store_group_write(struct node_store* const store,
+                  struct store_group* const group)
+{
+    size_t const num = group->entries_num;
+
+    if (0 == num) return;
+
+    store_log_write(store, group);
+
+    size_t i;
+    for (i = 0; i < num; i++)
+    {
+        const struct store_group_entry* const e = &group->entries[i];
+
+        /* all earlier entries are flushed, so rv_gtid digest is published */
+        if (e->verify) store_verify_digest(store, e);
+
+        store_update_gtid(store, &e->gtid, e->digest);
+
+        if (e->failed) store->read_view_fails++;
+    }
+
+    int b = 0;
+    while (b < NODE_STORE_GROUP_HIST - 1 && (num >> (b + 1))) b++;
+    store->group_hist[b]++;
+
+    group->entries_num = 0;
+    group->log_len     = 0;
+}
+
+/**
+ * flushes the current commit group, must be called under gtid_mtx and
+ * group_mtx, so that the records match the store GTID after the call */
+static inline void
+store_group_flush_locked(struct node_store* const store)
+{
+    store_group_write(store, &store->groups[store->group_cur]);
+}
+
+/**
+ * Flushes the current commit group while new transactions keep committing to
+ * the other one: only the swap of the groups is done under group_mtx, so
+ * commits need not wait for the log write. Must be called under gtid_mtx,
+ * which also guarantees that the other group was left empty. */
+static void
+store_group_flush(struct node_store* const store)
+{
+    STORE_MUTEX_LOCK(&store->group_mtx);
+    struct store_group* const group = &store->groups[store->group_cur];
+    store->group_cur ^= 1;
+    pthread_mutex_unlock(&store->group_mtx);
+
+    store_group_write(store, group);
+
+    if (store->log_size > store->records_num * STORE_RECORD_SIZE)
+    {
+        /* commits may be modifying records right now, so the checkpoint is
+         * left to the next one, see store_checkpoint_pin() */
+        STORE_MUTEX_LOCK(&store->group_mtx);
+        store->ckpt_due = true;
+        pthread_mutex_unlock(&store->group_mtx);
+    }
+}
+
+/**
+ * the length of the records chunk c */
+static inline size_t
+store_view_chunk_len(const struct node_store* const store, size_t const c)
+{
+    size_t const total = store->records_num * STORE_RECORD_SIZE;
+    size_t const left  = total - c * STORE_VIEW_CHUNK;
+    return left < STORE_VIEW_CHUNK ? left : STORE_VIEW_CHUNK;
+}
+
+/**
+ * pins the view of the records at gtid: from now on commits preserve records
+ * for store_view_read(). Records must match gtid.
+ *
+ * @return 0 or negative error code */
+static int
+store_view_pin(struct node_store*  const store,
+               struct store_view*  const view,
+               const wsrep_gtid_t* const gtid)
+{
+    size_t const rec_len = store->records_num * STORE_RECORD_SIZE;
+    size_t const chunks  = (rec_len + STORE_VIEW_CHUNK - 1) / STORE_VIEW_CHUNK;
+
+    char**  const copies = calloc(chunks + 1, sizeof(*copies));
+    size_t* const read   = calloc(chunks + 1, sizeof(*read));
+    if (!copies || !read)
+    {
+        NODE_ERROR("Failed to allocate view of %zu record chunks", chunks);
+        free(copies);
+        free(read);
+        return -ENOMEM;
+    }
+
+    STORE_MUTEX_LOCK(&store->view_mtx);
+    view->copies = copies;
+    view->read   = read;
+    view->chunks = chunks;
+    view->err    = 0;
+    view->gtid   = *gtid;
+    atomic_store_explicit(&view->active, true, memory_order_release);
+    pthread_mutex_unlock(&store->view_mtx);
+
+    return 0;
+}
+
+/**
+ * releases the view pinned by store_view_pin() */
+static void
+store_view_unpin(struct node_store* const store,
+                 struct store_view* const view)
+{
+    STORE_MUTEX_LOCK(&store->view_mtx);
+    atomic_store_explicit(&view->active, false, memory_order_relaxed);
+    size_t c;
+    for (c = 0; c < view->chunks; c++)
+    {
+        free(view->copies[c]);
+    }
+    free(view->copies); view->copies = NULL;
+    free(view->read);   view->read   = NULL;
+    view->chunks = 0;
+    pthread_mutex_unlock(&store->view_mtx);
+}
+
+/**
+ * breaks the pinned view, so that reading it fails with err. Must be called
+ * before the records are replaced. */
+static void
+store_view_break(struct node_store* const store,
+                 struct store_view* const view,
+                 int                const err)
+{
+    STORE_MUTEX_LOCK(&store->view_mtx);
+    if (atomic_load_explicit(&view->active, memory_order_relaxed))
+    {
+        view->err = err;
+    }
+    pthread_mutex_unlock(&store->view_mtx);
+}
+
+/**
+ * preserves the chunk c of the view if it was not fully read yet, must be
+ * called under view_mtx */
+static void
+store_view_preserve_chunk(struct node_store* const store,
+                          struct store_view* const view,
+                          size_t             const c)
+{
+    if (!atomic_load_explicit(&view->active, memory_order_relaxed) ||
+        view->copies[c] || view->err)
+    {
+        return;
+    }
+
+    size_t const len = store_view_chunk_len(store, c);
+
+    if (view->read[c] < len)
+    {
+        view->copies[c] = malloc(len);
+        if (view->copies[c])
+        {
+            memcpy(view->copies[c],
+                   (char*)store->records + c * STORE_VIEW_CHUNK, len);
+        }
+        else
+        {
+            /* can't block commit, break the view instead */
+            NODE_ERROR("Failed to allocate %zu bytes to preserve records "
+                       "of the pinned view", len);
+            view->err = -ENOMEM;
+        }
+    }
+}
+
+/**
+ * preserves the chunk of the record at idx in the pinned views. Must be
+ * called before the record is modified. */
+static void
+store_view_preserve(struct node_store* const store, uint32_t const idx)
+{
+    size_t const c = (size_t)idx * STORE_RECORD_SIZE / STORE_VIEW_CHUNK;
+
+    STORE_MUTEX_LOCK(&store->view_mtx);
+    store_view_preserve_chunk(store, &store->sst_view,  c);
+    store_view_preserve_chunk(store, &store->ckpt_view, c);
+    pthread_mutex_unlock(&store->view_mtx);
+}
+
+/**
+ * copies len bytes of the records at offset from the pinned view to buf
+ *
+ * @return 0 or negative error code */
+static int
+store_view_read(struct node_store* const store,
+                struct store_view* const view,
+                size_t             const offset,
+                void*              const buf,
+                size_t             const len)
+{
+    int ret = 0;
+    char* dst = buf;
+    size_t pos = offset;
+    size_t const end = offset + len;
+
+    STORE_MUTEX_LOCK(&store->view_mtx);
+
+    if (!atomic_load_explicit(&view->active, memory_order_relaxed))
+    {
+        assert(0);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (view->err)
+    {
+        ret = view->err;
+        goto out;
+    }
+
+    if (end > store->records_num * STORE_RECORD_SIZE || end < offset)
+    {
+        ret = -ERANGE;
+        goto out;
+    }
+
+    while (pos < end)
+    {
+        size_t const c      = pos / STORE_VIEW_CHUNK;
+        size_t const in_off = pos - c * STORE_VIEW_CHUNK;
+        size_t const c_len  = store_view_chunk_len(store, c);
+        size_t const n      = (end - pos < c_len - in_off) ?
+            end - pos : c_len - in_off;
+
+        /* chunk that was not preserved has not been modified since pinning */
+        const char* const src = view->copies[c] ?
+            view->copies[c] + in_off : (const char*)store->records + pos;
+        memcpy(dst, src, n);
+
+        view->read[c] += n;
+        if (view->read[c] == c_len)
+        {
+            /* whole chunk was read, no need to preserve it any more */
+            free(view->copies[c]);
+            view->copies[c] = NULL;
+        }
+
+        dst += n;
+        pos += n;
+    }
+
+out:
+    pthread_mutex_unlock(&store->view_mtx);
+
+    return ret;
+}
+
+/**
+ * passes len bytes of the records at offset of the pinned view to send()
+ * in place, a piece per chunk. Preserved copies stay until the view is
+ * unpinned or the piece is accounted as read, so they are sent unlocked.
+ * Chunks that were not preserved are sent under view_mtx to keep commits
+ * from modifying them meanwhile.
+ *
+ * @return 0 or negative error code */
+static int
+store_view_send(struct node_store*   const store,
+                struct store_view*   const view,
+                size_t               const offset,
+                size_t               const len,
+                node_store_send_fn_t const send,
+                void*                const ctx)
+{
+    int ret = 0;
+    size_t pos = offset;
+    size_t const end = offset + len;
+
+    STORE_MUTEX_LOCK(&store->view_mtx);
+
+    if (!atomic_load_explicit(&view->active, memory_order_relaxed))
+    {
+        assert(0);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (end > store->records_num * STORE_RECORD_SIZE || end < offset)
+    {
+        ret = -ERANGE;
+        goto out;
+    }
+
+    while (pos < end)
+    {
+        /* the view may be broken while a preserved copy is being sent */
+        if (view->err)
+        {
+            ret = view->err;
+            break;
+        }
+
+        size_t const c      = pos / STORE_VIEW_CHUNK;
+        size_t const in_off = pos - c * STORE_VIEW_CHUNK;
+        size_t const c_len  = store_view_chunk_len(store, c);
+        size_t const n      = (end - pos < c_len - in_off) ?
+            end - pos : c_len - in_off;
+
+        const char* const copy = view->copies[c];
+        if (copy)
+        {
+            pthread_mutex_unlock(&store->view_mtx);
+            ret = send(ctx, pos, copy + in_off, n);
+            STORE_MUTEX_LOCK(&store->view_mtx);
+        }
+        else
+        {
+            ret = send(ctx, pos, (const char*)store->records + pos, n);
+        }
+
+        if (ret) break;
+
+        view->read[c] += n;
+        if (view->read[c] == c_len)
+        {
+            free(view->copies[c]);
+            view->copies[c] = NULL;
+        }
+
+        pos += n;
+    }
+
+out:
+    pthread_mutex_unlock(&store->view_mtx);
+
+    return ret;
+}
+
+/**
+ * pins the view of the records at ws_gtid for the checkpoint thread to write
+ * it as a new checkpoint. Must be called in commit order under group_mtx right
+ * after the transaction was added to the commit group: no other commit can be
+ * modifying records then, so they match ws_gtid, and the group log ends with
+ * ws_gtid. Membership changes only in commit order too, so the header can be
+ * serialized here. Does not touch the records, so it costs the same for any
+ * size of the store. */
+static void
+store_checkpoint_pin(struct node_store*  const store,
+                     const wsrep_gtid_t* const ws_gtid)
+{
+    store->ckpt_due = false;
+
+    STORE_MUTEX_LOCK(&store->ckpt_mtx);
+    bool const busy = store->ckpt_busy || !store->ckpt_started;
+    store->ckpt_busy = true;
+    pthread_mutex_unlock(&store->ckpt_mtx);
+
+    /* the next group flush will request it again if still due */
+    if (busy) return;
+
+    size_t const hdr_size = store_header_size(store);
+    int ret = -ENOMEM;
+
+    store->ckpt_hdr = malloc(hdr_size);
+    if (store->ckpt_hdr)
+    {
+        ret = store_serialize_header(store, ws_gtid, store->ckpt_hdr,
+                                     hdr_size);
+    }
+
+    if (ret > 0)
+    {
+        store->ckpt_hdr_len = (size_t)ret;
+        store->ckpt_rec_len = store->records_num * STORE_RECORD_SIZE;
+        ret = store_view_pin(store, &store->ckpt_view, ws_gtid);
+    }
+
+    if (ret)
+    {
+        /* failure is not fatal: the log just continues to grow */
+        NODE_ERROR("Failed to pin records for checkpoint: %d (%s)",
+                   -ret, strerror(-ret));
+        free(store->ckpt_hdr);
+        store->ckpt_hdr = NULL;
+        STORE_MUTEX_LOCK(&store->ckpt_mtx);
+        store->ckpt_busy = false;
+        pthread_mutex_unlock(&store->ckpt_mtx);
+        return;
+    }
+
+    struct store_group* const group = &store->groups[store->group_cur];
+    group->ckpt_len = group->log_len;
+
+    STORE_MUTEX_LOCK(&store->ckpt_mtx);
+    store->ckpt_pinned = true;
+    pthread_cond_signal(&store->ckpt_cond);
+    pthread_mutex_unlock(&store->ckpt_mtx);
+}
+
+/**
+ * makes the checkpoint in progress, if any, fail: a newer one is about to be
+ * written or the records are about to be replaced. Must be called under
+ * gtid_mtx. */
+static void
+store_checkpoint_cancel(struct node_store* const store)
+{
+    STORE_MUTEX_LOCK(&store->ckpt_mtx);
+    if (store->ckpt_busy)
+    {
+        store->ckpt_cancel = true;
+        store_view_break(store, &store->ckpt_view, -ECANCELED);
+    }
+    pthread_mutex_unlock(&store->ckpt_mtx);
+}
+
+/**
+ * writes the checkpoint pinned by store_checkpoint_pin() and restarts the log
+ * from it. Runs in the checkpoint thread concurrently with commits. */
+static void
+store_checkpoint_write(struct node_store* const store)
+{
+    wsrep_gtid_t const gtid    = store->ckpt_view.gtid;
+    size_t       const rec_len = store->ckpt_rec_len;
+
+    char tmp_path[4096];
+    int ret = store_file_path(store, STORE_CKPT_BG_NAME, tmp_path,
+                              sizeof(tmp_path));
+
+    char* const buf = ret ? NULL : malloc(STORE_VIEW_CHUNK);
+    if (!ret && !buf) ret = -ENOMEM;
+
+    int const fd = ret ? ret :
+        store_checkpoint_open(tmp_path, store->ckpt_hdr, store->ckpt_hdr_len);
+    if (fd < 0) ret = fd;
+
+    /* records are copied from the view chunk by chunk: a chunk that is read
+     * doesn't have to be preserved any more */
+    size_t off = 0;
+    while (!ret && off < rec_len)
+    {
+        size_t const len = rec_len - off < STORE_VIEW_CHUNK ?
+            rec_len - off : STORE_VIEW_CHUNK;
+        ret = store_view_read(store, &store->ckpt_view, off, buf, len);
+        if (!ret) ret = store_write_all(fd, buf, len);
+        off += len;
+    }
+
+    if (fd >= 0)
+    {
+        if (!ret && fsync(fd)) ret = -errno;
+        close(fd);
+    }
+
+    free(buf);
+    store_view_unpin(store, &store->ckpt_view);
+    free(store->ckpt_hdr);
+    store->ckpt_hdr = NULL;
+
+    STORE_MUTEX_LOCK(&store->gtid_mtx);
+
+    if (!ret && store->ckpt_cancel) ret = -ECANCELED;
+
+    /* the log must reach the checkpoint to be restarted from it */
+    if (!ret && store->gtid.seqno < gtid.seqno) store_group_flush(store);
+
+    if (fd >= 0) ret = store_checkpoint_rename(store, tmp_path, ret);
+
+    if (!ret)
+    {
+        assert(store->ckpt_log_off >= STORE_GTID_SIZE);
+        store_log_compact(store, &gtid, store->ckpt_log_off);
+    }
+
+    store->ckpt_cancel  = false;
+    store->ckpt_log_off = 0;
+
+    pthread_mutex_unlock(&store->gtid_mtx);
+}
+
+static void*
+store_checkpoint_thread(void* const arg)
+{
+    struct node_store* const store = arg;
+
+    STORE_MUTEX_LOCK(&store->ckpt_mtx);
+
+    while (true)
+    {
+        while (!store->ckpt_pinned && !store->ckpt_exit)
+            pthread_cond_wait(&store->ckpt_cond, &store->ckpt_mtx);
+
+        if (!store->ckpt_pinned) break;
+
+        store->ckpt_pinned = false;
+        pthread_mutex_unlock(&store->ckpt_mtx);
+
+        store_checkpoint_write(store);
+
+        STORE_MUTEX_LOCK(&store->ckpt_mtx);
+        store->ckpt_busy = false;
+    }
+
+    pthread_mutex_unlock(&store->ckpt_mtx);
+
+    return NULL;
+}
+
+node_store_t*
+node_store_open(const struct node_options* const opts)
+{
+    /* make the size of trx pool the next highest power of 2 over the total
+     * number of transactions that can be in flight: slaves apply whole
+     * batches before committing them */
+    uint32_t trx_pool_mask =
+        (uint32_t)(opts->masters * opts->pipeline +
+                   opts->slaves * opts->apply_batch);
+    if (trx_pool_mask > 0)
+    {
+        trx_pool_mask -= 1;
+        trx_pool_mask |= trx_pool_mask >> 1;
+        trx_pool_mask |= trx_pool_mask >> 2;
+        trx_pool_mask |= trx_pool_mask >> 4;
+        trx_pool_mask |= trx_pool_mask >> 8;
+        trx_pool_mask |= trx_pool_mask >> 16;
+    }
+    assert(((trx_pool_mask + 1) & trx_pool_mask) == 0); // 2^n - 1
+
+    size_t const desired_op_size = (size_t)(opts->ws_size/opts->operations);
+    size_t const op_size = (desired_op_size > STORE_OP_SIZE ?
+                            desired_op_size : STORE_OP_SIZE);
+
+    /* since the number of workers will never change, we can allocate trx pool
+     * together with the main store struc */
+    /* op_size - additional buffer for op serialization per trx */
+    size_t const entry_size =
+        STORE_ALIGN(sizeof(struct store_trx_entry) + op_size);
+    size_t const store_alloc_size = STORE_ALIGN(sizeof(struct node_store)) +
+        entry_size*(trx_pool_mask + 1);
+
+    struct node_store* ret = NULL;
+
+    if (0 == posix_memalign((void**)&ret, STORE_CACHE_LINE, store_alloc_size))
+    {
+        memset(ret, 0, store_alloc_size);
+        ret->log_fd  = -1;
+        ret->dir     = strdup(opts->data_dir);
+        ret->records = malloc((size_t)opts->records * STORE_RECORD_SIZE);
+
+        if (ret->dir && ret->records)
+        {
+            uint32_t i;
+            ret->gtid = WSREP_GTID_UNDEFINED;
+            pthread_mutex_init(&ret->gtid_mtx, NULL);
+            pthread_mutex_init(&ret->view_mtx, NULL);
+            pthread_mutex_init(&ret->group_mtx, NULL);
+            pthread_mutex_init(&ret->ckpt_mtx, NULL);
+            pthread_cond_init(&ret->ckpt_cond, NULL);
+            atomic_init(&ret->sst_view.active, false);
+            atomic_init(&ret->ckpt_view.active, false);
+            for (i = 0; i < STORE_STRIPES; i++)
+            {
+                pthread_mutex_init(&ret->stripes[i], NULL);
+            }
+            atomic_init(&ret->trx_id, 0);
+            ret->op_size      = op_size;
+            ret->entry_size   = entry_size;
+            ret->records_num  = (uint32_t)opts->records;
+            ret->entries_mask = trx_pool_mask;
+            ret->ops_hint     = (size_t)opts->operations;
+            atomic_init(&ret->arena_grows, 0);
+            atomic_init(&ret->keys_grows, 0);
+
+            for (i = 0; i <= trx_pool_mask; i++)
+            {
+                struct store_trx_entry* const e = store_get_trx_entry(ret, i);
+                atomic_init(&e->used, false);
+                e->seed = i;
+            }
+
+            for (i = 0; i < ret->records_num; i++)
+            {
+                /* keep state in serialized form for easy snapshotting */
+                struct record const record = { WSREP_SEQNO_UNDEFINED, i };
+                store_record_set(ret->records, i, &record);
+            }
+
+            if (0 == store_recover(ret))
+            {
+                int const err = pthread_create(&ret->ckpt_thread, NULL,
+                                               store_checkpoint_thread, ret);
+                if (!err)
+                {
+                    ret->ckpt_started = true;
+                    return ret;
+                }
+
+                NODE_ERROR("Failed to start checkpoint thread: %d (%s)",
+                           err, strerror(err));
+            }
+
+            node_store_close(ret);
+        }
+        else
+        {
+            free(ret->records);
+            free(ret->dir);
+            free(ret);
+        }
+    }
+
+    return NULL;
+}
+
+void
+node_store_close(struct node_store* const store)
+{
+    assert(store);
+    assert(store->records || 0 == store->records_num);
+
+    if (store->ckpt_started)
+    {
+        STORE_MUTEX_LOCK(&store->ckpt_mtx);
+        store->ckpt_exit = true;
+        pthread_cond_signal(&store->ckpt_cond);
+        pthread_mutex_unlock(&store->ckpt_mtx);
+        pthread_join(store->ckpt_thread, NULL);
+    }
+
+    if (store->log_fd >= 0)
+    {
+        /* clean shutdown: leave nothing to replay on the next start */
+        store_group_flush_locked(store);
+        if (store->log_size > 0) store_checkpoint(store);
+        close(store->log_fd);
+    }
+
+    int i;
+    for (i = 0; i < STORE_STRIPES; i++)
+    {
+        pthread_mutex_destroy(&store->stripes[i]);
+    }
+    pthread_mutex_destroy(&store->gtid_mtx);
+    pthread_mutex_destroy(&store->view_mtx);
+    pthread_mutex_destroy(&store->group_mtx);
+    pthread_cond_destroy(&store->ckpt_cond);
+    pthread_mutex_destroy(&store->ckpt_mtx);
+    uint32_t j;
+    for (j = 0; j <= store->entries_mask; j++)
+    {
+        struct store_trx_ctx* const trx = store_get_trx_ctx(store, j);
+        free(trx->ops);
+        free(trx->ws_buf);
+        free(trx->keys);
+    }
+    for (i = 0; i < 2; i++)
+    {
+        free(store->groups[i].entries);
+        free(store->groups[i].log);
+    }
+    free(store->dir);
+    free(store->records);
+    free(store->members);
+    free(store);
+}
+
+static inline pthread_mutex_t*
+store_stripe(struct node_store* const store, uint32_t const idx)
+{
+    return &store->stripes[idx & (STORE_STRIPES - 1)];
+}
+
+/**
+ * reads a record concurrently with commits */
+static inline void
+store_record_read(struct node_store* const store,
+                  uint32_t           const idx,
+                  record_t*          const record)
+{
+    pthread_mutex_t* const stripe = store_stripe(store, idx);
+    STORE_MUTEX_LOCK(stripe);
+    store_record_get(store->records, idx, record);
+    pthread_mutex_unlock(stripe);
+}
+
+/**
+ * modifies a record and updates records digest, must be called in commit
+ * order */
+static inline void
+store_record_write(struct node_store* const store,
+                   uint32_t           const idx,
+                   const record_t*    const record)
+{
+    if (atomic_load_explicit(&store->sst_view.active,  memory_order_acquire) ||
+        atomic_load_explicit(&store->ckpt_view.active, memory_order_acquire))
+    {
+        store_view_preserve(store, idx);
+    }
+
+    record_t old;
+    pthread_mutex_t* const stripe = store_stripe(store, idx);
+    STORE_MUTEX_LOCK(stripe);
+    store_record_get(store->records, idx, &old);
+    store_record_set(store->records, idx, record);
+    pthread_mutex_unlock(stripe);
+
+    store->records_digest +=
+        store_record_hash(idx, record) - store_record_hash(idx, &old);
+}
+
+/**
+ * locks all record stripes to replace records array */
+static void
+store_lock_records(struct node_store* const store)
+{
+    int i;
+    for (i = 0; i < STORE_STRIPES; i++)
+    {
+        STORE_MUTEX_LOCK(&store->stripes[i]);
+    }
+}
+
+static void
+store_unlock_records(struct node_store* const store)
+{
+    int i;
+    for (i = STORE_STRIPES - 1; i >= 0; i--)
+    {
+        pthread_mutex_unlock(&store->stripes[i]);
+    }
+}
+
+/* trx pool slot last used by this thread: workers tend to reuse the same
+ * slot which then stays in their cache */
+static _Thread_local wsrep_trx_id_t store_slot_hint = 0;
+
+static inline bool
+store_claim_slot(struct store_trx_entry* const trx)
+{
+    bool expected = false;
+
+    /* acquire pairs with release in store_free_trx_id() so that we see
+     * all the previous owner did to the slot */
+    return (!atomic_load_explicit(&trx->used, memory_order_relaxed) &&
+            atomic_compare_exchange_strong_explicit(&trx->used, &expected, true,
+                                                    memory_order_acquire,
+                                                    memory_order_relaxed));
+}
+
+/**
+ * Allocates a new trx ID and claims the corresponding trx pool slot.
+ *
+ * Lock-free: first the slot last used by this thread is tried, then the pool
+ * is probed from an atomic cursor, claiming the slot by CAS on its used flag.
+ * Since the pool has at least as many slots as all workers can hold at once
+ * (one per pipelined master transaction, up to --apply-batch per slave), a
+ * free slot is always found within one wrap of the pool. Not finding it is
+ * a bug, so it is fatal rather than spinning forever.
+ *
+ * Trx ID is composed of the slot index and the slot generation, so it is
+ * unique regardless of which thread claims the slot. */
+static inline wsrep_trx_id_t
+store_new_trx_id(struct node_store* const store)
+{
+    wsrep_trx_id_t slot = store_slot_hint & store->entries_mask;
+    struct store_trx_entry* trx = store_get_trx_entry(store, slot);
+    wsrep_trx_id_t probes = 0;
+
+    while (!store_claim_slot(trx))
+    {
+        if (++probes > store->entries_mask + 1)
+        {
+            /* pool sizing does not match the number of trxs in flight */
+            NODE_FATAL("No free trx pool slot in %llu probes",
+                       (unsigned long long)(probes - 1));
+            abort();
+        }
+
+        slot = atomic_fetch_add_explicit(&store->trx_id, 1,
+                                         memory_order_relaxed)
+            & store->entries_mask;
+        trx = store_get_trx_entry(store, slot);
+    }
+
+    store_slot_hint = slot;
+    trx->gen++;
+
+    trx->ctx.rv_gtid = WSREP_GTID_UNDEFINED;
+    assert(0 == trx->ctx.ops_num);
+
+    /* gen starts with 1, so trx ID is never 0 */
+    return trx->gen*(store->entries_mask + 1) + slot;
+}
+
+static inline void
+store_free_trx_id(struct node_store* const store, wsrep_trx_id_t const trx_id)
+{
+    struct store_trx_entry* const trx = store_get_trx_entry(store, trx_id);
+    assert(atomic_load_explicit(&trx->used, memory_order_relaxed));
+    /* keep the arenas for the next trx */
+    trx->ctx.ops_num  = 0;
+    trx->ctx.ws_len   = 0;
+    trx->ctx.local    = false;
+
+    atomic_store_explicit(&trx->used, false, memory_order_release);
+}
+
+/**
+ * Ends transaction in the store. Local transaction slot stays allocated until
+ * node_store_release() since provider may still reference its writeset. */
+static inline void
+store_end_trx(struct node_store* const store, wsrep_trx_id_t const trx_id)
+{
+    if (!store_get_trx_ctx(store, trx_id)->local)
+    {
+        store_free_trx_id(store, trx_id);
+    }
+}
+
+/**
+ * Allocates writeset buffer for local transaction slot, sized for the
+ * configured number of operations. */
+static int
+store_trx_local_init(struct node_store* const store,
+                     struct store_trx_ctx* const trx)
+{
+    trx->local = true;
+
+    if (trx->ws_buf) return 0;
+
+    size_t const ws_size = STORE_WS_HDR_SIZE + store->ops_hint*store->op_size;
+
+    trx->ws_buf = malloc(ws_size);
+    if (!trx->ws_buf) return -ENOMEM;
+
+    trx->ws_size = ws_size;
+
+    return 0;
+}
+
+/**
+ * Makes sure key arena can hold at least num keys. Must not be called after
+ * keys were passed to provider. */
+static int
+store_trx_reserve_keys(struct node_store* const store,
+                       struct store_trx_ctx* const trx,
+                       size_t             const num)
+{
+    if (num <= trx->keys_size) return 0;
+
+    size_t const elem_size =
+        sizeof(*trx->keys) + sizeof(*trx->key_parts) + sizeof(*trx->key_vals);
+    void* const arena = realloc(trx->keys, num * elem_size);
+    if (!arena) return -ENOMEM;
+
+    trx->keys      = arena;
+    trx->key_parts = (wsrep_buf_t*)(trx->keys + num);
+    trx->key_vals  = (uint32_t*)(trx->key_parts + num);
+    trx->keys_size = num;
+    atomic_fetch_add_explicit(&store->keys_grows, 1, memory_order_relaxed);
+
+    return 0;
+}
+
+static int
+store_cmp_uint32(const void* const a, const void* const b)
+{
+    uint32_t const x = *(const uint32_t*)a;
+    uint32_t const y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Sorts and removes duplicates from vals array, also skipping values found in
+ * sorted excl array.
+ *
+ * @return the number of remaining values */
+static size_t
+store_unique_uint32(uint32_t* const vals, size_t const num,
+                    const uint32_t* const excl, size_t const excl_num)
+{
+    qsort(vals, num, sizeof(*vals), store_cmp_uint32);
+
+    size_t ret = 0;
+    size_t i;
+    for (i = 0; i < num; i++)
+    {
+        if (ret > 0 && vals[ret - 1] == vals[i]) continue;
+        if (excl_num > 0 &&
+            bsearch(&vals[i], excl, excl_num, sizeof(*excl), store_cmp_uint32))
+            continue;
+
+        vals[ret++] = vals[i];
+    }
+
+    return ret;
+}
+
+/**
+ * Reserves len bytes in the stable writeset buffer.
+ *
+ * @return pointer to the reserved space or NULL if the buffer is exhausted,
+ *         then the scratch buffer should be used and copied by provider */
+static inline void*
+store_trx_ws_reserve(struct store_trx_ctx* const trx, size_t const len)
+{
+    if (trx->ws_len + len > trx->ws_size) return NULL;
+
+    void* const ret = trx->ws_buf + trx->ws_len;
+    trx->ws_len += len;
+
+    return ret;
+}
+
+int
+node_store_install_begin(struct node_store* const store,
+                         const void*        const header,
+                         size_t             const header_len,
+                         wsrep_seqno_t      const since,
+                         size_t*            const records_len)
+{
+    assert(!store->installing);
+
+    /* First, deserialize the header and allocate records for the new state */
+    struct store_state* const st = &store->install;
+    int ret = store_parse_state(header, header_len, 2 /*at least two members*/,
+                                true, st);
+    if (ret) return ret;
+
+    size_t const len = st->records_num * STORE_RECORD_SIZE;
+    atomic_store(&store->installed, 0);
+
+    if (WSREP_SEQNO_UNDEFINED != since)
+    {
+        /* Delta: only records modified after since will be installed, the rest
+         * must be the same as ours */
+        STORE_MUTEX_LOCK(&store->gtid_mtx);
+
+        if (wsrep_uuid_compare(&st->gtid.uuid, &store->gtid.uuid) ||
+            since < 0 || since > store->gtid.seqno ||
+            st->records_num != store->records_num)
+        {
+            NODE_ERROR("Can't install delta since seqno %lld: my seqno %lld, "
+                       "%u records, snapshot has %u records",
+                       (long long)since, (long long)store->gtid.seqno,
+                       store->records_num, st->records_num);
+            ret = -EPROTO;
+        }
+        else
+        {
+            memcpy(st->records, store->records, len);
+            atomic_store(&store->installed, len);
+        }
+
+        pthread_mutex_unlock(&store->gtid_mtx);
+
+        if (ret)
+        {
+            free(st->members);
+            free(st->records);
+            return ret;
+        }
+    }
+
+    store->installing = true;
+    *records_len      = len;
+
+    return 0;
+}
+
+int
+node_store_install_records(struct node_store* const store,
+                           size_t             const offset,
+                           const void*        const buf,
+                           size_t             const len)
+{
+    assert(store->installing);
+
+    struct store_state* const st = &store->install;
+
+    if (offset + len > st->records_num * STORE_RECORD_SIZE || offset + len <
+        offset)
+    {
+        NODE_ERROR("Records at %zu-%zu are beyond the end of snapshot: %zu",
+                   offset, offset + len, st->records_num * STORE_RECORD_SIZE);
+        return -ERANGE;
+    }
+
+    memcpy((char*)st->records + offset, buf, len);
+    atomic_fetch_add(&store->installed, len);
+
+    return 0;
+}
+
+int
+node_store_install_delta(struct node_store* const store,
+                         const void*        const buf,
+                         size_t             const len)
+{
+    assert(store->installing);
+
+    struct store_state* const st = &store->install;
+    const char* ptr = buf;
+    const char* const end = ptr + len;
+
+    if (len % STORE_DELTA_ENTRY_SIZE)
+    {
+        NODE_ERROR("Bad delta length: %zu", len);
+        return -EPROTO;
+    }
+
+    while (ptr < end)
+    {
+        uint32_t idx;
+        record_t rec;
+        ptr += store_deserialize_uint32(&idx, ptr);
+        ptr += store_record_get(ptr, 0, &rec);
+
+        if (idx >= st->records_num)
+        {
+            NODE_ERROR("Delta record %u is beyond the end of snapshot: %u",
+                       idx, st->records_num);
+            return -ERANGE;
+        }
+
+        store_record_set(st->records, idx, &rec);
+    }
+
+    return 0;
+}
+
+int
+node_store_install_end(struct node_store* const store, int const error)
+{
+    assert(store->installing);
+
+    struct store_state st = store->install;
+    store->installing = false;
+
+    size_t const installed = atomic_load(&store->installed);
+    int ret = error;
+    if (!ret && installed != st.records_num * STORE_RECORD_SIZE)
+    {
+        NODE_ERROR("Incomplete snapshot: received %zu bytes of records out of "
+                   "%zu", installed, st.records_num * STORE_RECORD_SIZE);
+        ret = -1;
+    }
 
-    uint32_t r_num;
-    void* new_records;
-    ret = store_new_records(ptr, endptr, &r_num, &new_records);
-    if (ret < 0)
+    if (ret)
     {
-        free(new_members);
+        free(st.members);
+        free(st.records);
         return ret;
     }
-    ptr += ret;
+
+    /* full scan of the new records outside of the critical section */
+    uint64_t const digest = store_records_digest(st.records, st.records_num);
 
     STORE_MUTEX_LOCK(&store->gtid_mtx);
 
     /* just a sanity check */
-    if (0 == wsrep_uuid_compare(&state_gtid.uuid, &store->gtid.uuid) &&
-        state_gtid.seqno < store->gtid.seqno)
+    if (0 == wsrep_uuid_compare(&st.gtid.uuid, &store->gtid.uuid) &&
+        st.gtid.seqno < store->gtid.seqno)
     {
         NODE_ERROR("Received snapshot that is in the past: my seqno %lld,"
                    " received seqno: %lld",
-                   (long long)store->gtid.seqno, (long long)state_gtid.seqno);
-        free(new_members);
-        free(new_records);
+                   (long long)store->gtid.seqno, (long long)st.gtid.seqno);
+        free(st.members);
+        free(st.records);
         ret = -1;
     }
     else
     {
+        /* checkpoint in progress must not read the records being replaced */
+        store_checkpoint_cancel(store);
+
         free(store->members);
-        store->members_num = m_num;
-        store->members     = new_members;
+        store->members_num = st.members_num;
+        store->members     = st.members;
+        store_lock_records(store);
         free(store->records);
-        store->records_num = r_num;
-        store->records     = new_records;
-        store->gtid        = state_gtid;
-        store->read_view_support = read_view_support;
-        ret = 0;
+        store->records_num = st.records_num;
+        store->records     = st.records;
+        store_unlock_records(store);
+        store->records_digest = digest;
+        store->gtid        = st.gtid;
+        store->read_view_support = st.read_view_support;
+        store_digest_reset(store);
+
+        /* new state is not in the log, persist it right away */
+        ret = store_checkpoint(store);
     }
 
     pthread_mutex_unlock(&store->gtid_mtx);
@@ -459,74 +2527,53 @@ node_store_init_state(struct node_store*  const store,
 
 int
 node_store_acquire_state(node_store_t* const store,
-                         const void**  const state,
-                         size_t*       const state_len)
+                         const void**  const header,
+                         size_t*       const header_len,
+                         size_t*       const records_len)
 {
     int ret = 0;
 
+    /* Holding the mutexes does not stop a commit that has already modified
+     * the records and waits for group_mtx. So the records match GTID only
+     * because the provider calls sst_donate_cb() with commit order drained
+     * up to the donated GTID and lets no transaction enter it until the
+     * callback returns, and the callback returns only after the view is
+     * pinned here. */
     STORE_MUTEX_LOCK(&store->gtid_mtx);
+    STORE_MUTEX_LOCK(&store->group_mtx);
+    store_group_flush_locked(store);
 
     if (!store->snapshot)
     {
-        size_t const memb_len = store->members_num * sizeof(member_t);
-        size_t const rec_len  = store->records_num * STORE_RECORD_SIZE;
-        size_t const buf_len  = WSREP_GTID_STR_LEN + 1
-            + sizeof(uint32_t) + memb_len
-            + 1 /* read view support */
-            + sizeof(uint32_t) + rec_len;
+        size_t const hdr_len = store_header_size(store);
 
-        store->snapshot = malloc(buf_len);
+        store->snapshot = malloc(hdr_len);
 
         if (store->snapshot)
         {
-            char* ptr = store->snapshot;
-
-            /* state GTID */
-            ret = wsrep_gtid_print(&store->gtid, ptr, buf_len);
-            if (ret > 0)
-            {
-                NODE_INFO("");
-                assert((size_t)ret < buf_len);
-
-                ptr[ret] = '\0';
-                ret++;
-                ptr += ret;
-                assert((size_t)ret < buf_len);
-
-                /* membership */
-                ptr += store_serialize_uint32(ptr, store->members_num);
-                ret += (int)sizeof(uint32_t);
-                assert((size_t)ret + memb_len < buf_len);
-                memcpy(ptr, store->members, memb_len);
-                ptr += memb_len;
-                ret += (int)memb_len;
-                assert((size_t)ret + sizeof(uint32_t) <= buf_len);
-
-                /* read view support */
-                ptr[0] = store->read_view_support;
-                ptr += 1;
-                ret += 1;
-
-                /* records */
-                ptr += store_serialize_uint32(ptr, store->records_num);
-                ret += (int)sizeof(uint32_t);
-                assert((size_t)ret + rec_len < buf_len);
-                memcpy(ptr, store->records, rec_len);
-                ret += (int)rec_len;
-                assert((size_t)ret <= buf_len);
-            }
-            else
-            {
-                NODE_ERROR("Failed to record GTID: %d (%s)", ret,strerror(-ret));
-                free(store->snapshot);
-                store->snapshot = 0;
-            }
+            ret = store_serialize_header(store, &store->gtid, store->snapshot,
+                                         hdr_len);
         }
         else
         {
-            NODE_ERROR("Failed to allocate snapshot buffer of size %zu",buf_len);
+            NODE_ERROR("Failed to allocate snapshot header of size %zu",
+                       hdr_len);
             ret = -ENOMEM;
         }
+
+        if (ret > 0)
+        {
+            *header      = store->snapshot;
+            *header_len  = (size_t)ret;
+            *records_len = store->records_num * STORE_RECORD_SIZE;
+            ret = store_view_pin(store, &store->sst_view, &store->gtid);
+        }
+
+        if (ret)
+        {
+            free(store->snapshot);
+            store->snapshot = NULL;
+        }
     }
     else
     {
@@ -534,19 +2581,89 @@ node_store_acquire_state(node_store_t* const store,
         ret = -EAGAIN;
     }
 
+    pthread_mutex_unlock(&store->group_mtx);
     pthread_mutex_unlock(&store->gtid_mtx);
 
-    if (ret > 0)
+    if (0 == ret)
     {
-        NODE_INFO("\n\nPrepared snapshot of %u records\n\n", store->records_num);
-        *state     = store->snapshot;
-        *state_len = (size_t)ret;
-        ret        = 0;
+        NODE_INFO("\n\nPinned snapshot of %u records\n\n", store->records_num);
     }
 
     return ret;
 }
 
+int
+node_store_send_state(node_store_t*        const store,
+                      size_t               const offset,
+                      size_t               const len,
+                      node_store_send_fn_t const send,
+                      void*                const ctx)
+{
+    return store_view_send(store, &store->sst_view, offset, len, send, ctx);
+}
+
+bool
+node_store_delta_possible(node_store_t*       const store,
+                          const wsrep_gtid_t* const gtid)
+{
+    /* view GTID does not change while the view is pinned */
+    const struct store_view* const view = &store->sst_view;
+    return atomic_load_explicit(&view->active, memory_order_relaxed) &&
+        0 == wsrep_uuid_compare(&gtid->uuid, &view->gtid.uuid) &&
+        gtid->seqno >= 0 && gtid->seqno <= view->gtid.seqno;
+}
+
+long
+node_store_read_delta(node_store_t* const store,
+                      wsrep_seqno_t const seqno,
+                      size_t*       const offset,
+                      size_t        const end,
+                      void*         const buf,
+                      size_t        const buf_len)
+{
+    /* records are read from the view in batches and filtered by version */
+    char batch[STORE_DELTA_BATCH * STORE_RECORD_SIZE];
+    char* const out = buf;
+    char* dst = out;
+
+    /* the record belongs to the range where its first byte is */
+    size_t idx = (*offset + STORE_RECORD_SIZE - 1) / STORE_RECORD_SIZE;
+    size_t const end_idx = (end + STORE_RECORD_SIZE - 1) / STORE_RECORD_SIZE;
+
+    if (buf_len < STORE_DELTA_BATCH * STORE_DELTA_ENTRY_SIZE) return -EINVAL;
+
+    while (idx < end_idx &&
+           buf_len - (size_t)(dst - out) >=
+           STORE_DELTA_BATCH * STORE_DELTA_ENTRY_SIZE)
+    {
+        size_t const num = end_idx - idx < STORE_DELTA_BATCH ?
+            end_idx - idx : STORE_DELTA_BATCH;
+
+        int const ret = store_view_read(store, &store->sst_view,
+                                        idx * STORE_RECORD_SIZE,
+                                        batch, num * STORE_RECORD_SIZE);
+        if (ret) return ret;
+
+        size_t i;
+        for (i = 0; i < num; i++)
+        {
+            record_t rec;
+            store_record_get(batch, i, &rec);
+            if (rec.version > seqno)
+            {
+                dst += store_serialize_uint32(dst, (uint32_t)(idx + i));
+                dst += store_record_set(dst, 0, &rec);
+            }
+        }
+
+        idx += num;
+    }
+
+    *offset = idx < end_idx ? idx * STORE_RECORD_SIZE : end;
+
+    return (long)(dst - out);
+}
+
 void
 node_store_release_state(node_store_t* const store)
 {
@@ -556,6 +2673,8 @@ node_store_release_state(node_store_t* const store)
     free(store->snapshot);
     store->snapshot = 0;
 
+    store_view_unpin(store, &store->sst_view);
+
     pthread_mutex_unlock(&store->gtid_mtx);
 }
 
@@ -568,6 +2687,9 @@ node_store_update_membership(struct node_store*       const store,
         assert(v->memb_num > 0);
 
     STORE_MUTEX_LOCK(&store->gtid_mtx);
+    /* view is ordered after all pending commits and is checkpointed below */
+    STORE_MUTEX_LOCK(&store->group_mtx);
+    store_group_flush_locked(store);
 
     bool const continuation = v->state_id.seqno == store->gtid.seqno + 1 &&
         0 == wsrep_uuid_compare(&v->state_id.uuid, &store->gtid.uuid);
@@ -610,14 +2732,28 @@ node_store_update_membership(struct node_store*       const store,
 
     free(store->members);
 
+    bool const new_history =
+        0 != wsrep_uuid_compare(&v->state_id.uuid, &store->gtid.uuid);
+
     store->members     = new_members;
     store->members_num = (uint32_t)v->memb_num;
     store->gtid        = v->state_id;
     store->read_view_support = (v->capabilities & WSREP_CAP_SNAPSHOT);
 
+    if (new_history)
+        store_digest_reset(store);
+    else
+        store_digest_publish(store, store->records_digest);
+
+    /* membership is a part of the state and view GTID may start new history,
+     * so it is not recorded in the log but in a checkpoint. */
+    store_checkpoint_cancel(store);
+    int const ret = store_checkpoint(store);
+
+    pthread_mutex_unlock(&store->group_mtx);
     pthread_mutex_unlock(&store->gtid_mtx);
 
-    return 0;
+    return ret;
 }
 
 void
@@ -628,6 +2764,7 @@ node_store_gtid(struct node_store* const store,
 
     STORE_MUTEX_LOCK(&store->gtid_mtx);
 
+    store_group_flush(store);
     *gtid = store->gtid;
 
     pthread_mutex_unlock(&store->gtid_mtx);
@@ -658,26 +2795,6 @@ store_deserialize_op(struct store_trx_op* const op, const void* const buf)
     store_deserialize_uint32(&op->size, ptr);
 }
 
-static inline void
-store_serialize_gtid(void* const buf, const wsrep_gtid_t* const gtid)
-{
-    char* ptr = buf;
-    memcpy(ptr, &gtid->uuid, sizeof(gtid->uuid));
-    ptr += sizeof(gtid->uuid);
-    store_serialize_int64(ptr, gtid->seqno);
-}
-
-static inline void
-store_deserialize_gtid(wsrep_gtid_t* const gtid, const void* const buf)
-{
-    const char* ptr = buf;
-    memcpy(&gtid->uuid, ptr, sizeof(gtid->uuid));
-    ptr += sizeof(gtid->uuid);
-    store_deserialize_int64(&gtid->seqno, ptr);
-}
-
-#define STORE_GTID_SIZE (sizeof(((wsrep_gtid_t*)(NULL))->uuid) + sizeof(int64_t))
-
 int
 node_store_execute(node_store_t*      const store,
                    wsrep_t*           const wsrep,
@@ -691,25 +2808,30 @@ node_store_execute(node_store_t*      const store,
         ws_handle->trx_id = store_new_trx_id(store);
     }
 
-    struct store_trx_ctx* trx = store_get_trx_ctx(store, ws_handle->trx_id);
-    if (store_trx_add_op(trx)) return -ENOMEM;
+    struct store_trx_entry* const entry =
+        store_get_trx_entry(store, ws_handle->trx_id);
+    struct store_trx_ctx* const trx = &entry->ctx;
+    if (0 == trx->ops_num && store_trx_local_init(store, trx)) return -ENOMEM;
+    if (store_trx_add_op(store, trx)) return -ENOMEM;
     struct store_trx_op* const op = &trx->ops[trx->ops_num - 1];
 
-    STORE_MUTEX_LOCK(&store->gtid_mtx);
-
     if (1 == trx->ops_num)
     {
-        /* First operation, save ID of the read view of the transaction */
+        /* First operation, save ID of the read view of the transaction.
+         * Commits modify records before advancing GTID, so any record that
+         * is newer than this will have version above rv_gtid.seqno */
+        STORE_MUTEX_LOCK(&store->gtid_mtx);
         trx->rv_gtid = store->gtid;
+        if (!store_digest_get(store, trx->rv_gtid.seqno, &trx->rv_digest))
+            trx->rv_digest = 0;
+        pthread_mutex_unlock(&store->gtid_mtx);
     }
 
     /* Transaction op: copy value from one random record to another... */
-    op->idx_from = (uint32_t)rand() % store->records_num;
-    op->idx_to   = (uint32_t)rand() % store->records_num;
-    store_record_get(store->records, op->idx_from, &op->rec_from);
-    store_record_get(store->records, op->idx_to,   &op->rec_to);
-
-    pthread_mutex_unlock(&store->gtid_mtx);
+    op->idx_from = (uint32_t)rand_r(&entry->seed) % store->records_num;
+    op->idx_to   = (uint32_t)rand_r(&entry->seed) % store->records_num;
+    store_record_read(store, op->idx_from, &op->rec_from);
+    store_record_read(store, op->idx_to,   &op->rec_to);
 
     wsrep_status_t ret = WSREP_TRX_FAIL;
 
@@ -747,12 +2869,17 @@ node_store_execute(node_store_t*      const store,
             }
         }
 
-        /* Record read view in the writeset for debugging purposes */
-        assert(store->op_size > STORE_GTID_SIZE);
-        store_serialize_gtid(trx + 1, &trx->rv_gtid);
-        wsrep_buf_t ws = { .ptr = trx + 1, .len = STORE_GTID_SIZE };
+        /* Record read view in the writeset for debugging purposes, together
+         * with the records digest at it, so that slaves could verify that
+         * their state at that GTID is the same */
+        assert(store->op_size > STORE_WS_HDR_SIZE);
+        void* const buf = store_trx_ws_reserve(trx, STORE_WS_HDR_SIZE);
+        char* const ptr = buf ? buf : (void*)(trx + 1);
+        store_serialize_gtid(ptr, &trx->rv_gtid);
+        store_serialize_int64(ptr + STORE_GTID_SIZE, (int64_t)trx->rv_digest);
+        wsrep_buf_t ws = { .ptr = ptr, .len = STORE_WS_HDR_SIZE };
         ret = wsrep->append_data(wsrep, ws_handle, &ws, 1, WSREP_DATA_ORDERED,
-                                 true);
+                                 NULL == buf /* copy only scratch buffer */);
         if (ret)
         {
             NODE_ERROR("wsrep::append_data(rv_gtid) failed: %d", ret);
@@ -760,58 +2887,107 @@ node_store_execute(node_store_t*      const store,
         }
     }
 
-    /* REPLICATION: append keys touched by the operation
+    /* REPLICATION: keys touched by the operation are appended all at once
+     *              in node_store_prepare() */
+
+    /* REPLICATION: append transaction operation to the "writeset"
+     *              It is gathered in the trx writeset buffer which persists
+     *              until node_store_release(), so provider does not need to
+     *              copy it. Should the buffer be exhausted, the scratch buffer
+     *              allocated together with trx context is used and copied. */
+    assert(store->op_size >= STORE_OP_SIZE);
+    assert(store->op_size == (uint32_t)store->op_size);
+    op->size = (uint32_t)store->op_size;
+    void* const buf = store_trx_ws_reserve(trx, store->op_size);
+    void* const ptr = buf ? buf : trx + 1;
+    store_serialize_op(ptr, op);
+    wsrep_buf_t ws = { .ptr = ptr, .len = store->op_size };
+    ret = wsrep->append_data(wsrep, ws_handle, &ws, 1, WSREP_DATA_ORDERED,
+                             NULL == buf /* copy only scratch buffer */);
+
+    if (!ret) return 0;
+
+    NODE_ERROR("wsrep::append_data(op) failed: %d", ret);
+
+error:
+    /* provider may still reference what was appended before, trx resources
+     * will be freed in node_store_release() */
+    return ret;
+}
+
+int
+node_store_prepare(node_store_t*      const store,
+                   wsrep_t*           const wsrep,
+                   wsrep_ws_handle_t* const ws_handle)
+{
+    assert(store);
+    assert(ws_handle->trx_id);
+
+    struct store_trx_ctx* const trx =
+        store_get_trx_ctx(store, ws_handle->trx_id);
+    assert(trx->local);
+
+    int ret = store_trx_reserve_keys(store, trx, 2*trx->ops_num);
+    if (ret) return ret;
+
+    /* REPLICATION: append keys touched by the transaction
      *
      * NOTE: depending on data access granularity some applications may require
      *       multipart keys, e.g. <schema>:<table>:<row> in a SQL database.
      *       Single part keys match hashtables and key-value stores.
-     *       Below we have two different single-part keys which reference two
-     *       different records. */
-    uint32_t    key_val;
-    wsrep_buf_t key_part = { .ptr = &key_val, .len = sizeof(key_val) };
-    wsrep_key_t ws_key   = { .key_parts = &key_part, .key_parts_num = 1 };
-
-    /* REPLICATION: Key 1 - the key of the source, unchanged record */
-    store_serialize_uint32(&key_val, op->idx_from);
-    ret = wsrep->append_key(wsrep, ws_handle,
-                            &ws_key,
-                            1,   /* single key */
-                            WSREP_KEY_REFERENCE,
-                            true /* provider shall make a copy of the key */);
-    if (ret)
+     *       Here each operation references two different records: the source,
+     *       unchanged one and the one we want to update. Keys are deduplicated
+     *       and the record that is updated needs no REFERENCE key, so all keys
+     *       of the same type are appended in a single call.
+     *       Keys are stored in the trx key arena which persists until
+     *       node_store_release(), so provider does not need to copy them. */
+    uint32_t* const vals = trx->key_vals;
+    size_t i;
+
+    for (i = 0; i < trx->ops_num; i++)
     {
-        NODE_ERROR("wsrep::append_key(REFERENCE) failed: %d", ret);
-        goto error;
+        vals[i]                = trx->ops[i].idx_to;
+        vals[trx->ops_num + i] = trx->ops[i].idx_from;
+    }
+
+    size_t const upd_num = store_unique_uint32(vals, trx->ops_num, NULL, 0);
+    size_t const ref_num = store_unique_uint32(vals + trx->ops_num,
+                                               trx->ops_num, vals, upd_num);
+    if (upd_num < trx->ops_num)
+    {
+        memmove(vals + upd_num, vals + trx->ops_num, ref_num * sizeof(*vals));
     }
 
-    /* REPLICATION: Key 2 - the key of the record we want to update */
-    store_serialize_uint32(&key_val, op->idx_to);
-    ret = wsrep->append_key(wsrep, ws_handle,
-                            &ws_key,
-                            1,   /* single key */
+    for (i = 0; i < upd_num + ref_num; i++)
+    {
+        store_serialize_uint32(&vals[i], vals[i]);
+        trx->key_parts[i].ptr = &vals[i];
+        trx->key_parts[i].len = sizeof(vals[i]);
+        trx->keys[i].key_parts     = &trx->key_parts[i];
+        trx->keys[i].key_parts_num = 1;
+    }
+
+    /* REPLICATION: keys of the records we want to update */
+    ret = wsrep->append_key(wsrep, ws_handle, trx->keys, upd_num,
                             WSREP_KEY_UPDATE,
-                            true /* provider shall make a copy of the key */);
+                            false /* keys persist until release */);
     if (ret)
     {
         NODE_ERROR("wsrep::append_key(UPDATE) failed: %d", ret);
-        goto error;
+        return ret;
     }
 
-    /* REPLICATION: append transaction operation to the "writeset"
-     *              (WS buffer was allocated together with trx context above) */
-    assert(store->op_size >= STORE_OP_SIZE);
-    assert(store->op_size == (uint32_t)store->op_size);
-    op->size = (uint32_t)store->op_size;
-    store_serialize_op(trx + 1, op);
-    wsrep_buf_t ws = { .ptr = trx + 1, .len = store->op_size };
-    ret = wsrep->append_data(wsrep, ws_handle, &ws, 1, WSREP_DATA_ORDERED, true);
-
-    if (!ret) return 0;
-
-    NODE_ERROR("wsrep::append_data(op) failed: %d", ret);
-
-error:
-    store_free_trx_id(store, ws_handle->trx_id);
+    /* REPLICATION: keys of the source, unchanged records */
+    if (ref_num > 0)
+    {
+        ret = wsrep->append_key(wsrep, ws_handle, trx->keys + upd_num, ref_num,
+                                WSREP_KEY_REFERENCE,
+                                false /* keys persist until release */);
+        if (ret)
+        {
+            NODE_ERROR("wsrep::append_key(REFERENCE) failed: %d", ret);
+        }
+    }
 
     return ret;
 }
@@ -832,103 +3008,63 @@ node_store_apply(node_store_t*      const store,
     size_t left     = ws->len;
 
     /* at least one operation should be there */
-    assert(left >= STORE_GTID_SIZE + STORE_OP_SIZE);
+    assert(left >= STORE_WS_HDR_SIZE + STORE_OP_SIZE);
 
-    if (left >= STORE_GTID_SIZE)
+    if (left >= STORE_WS_HDR_SIZE)
     {
+        int64_t digest;
         store_deserialize_gtid(&trx->rv_gtid, ptr);
-        left -= STORE_GTID_SIZE;
-        ptr  += STORE_GTID_SIZE;
+        store_deserialize_int64(&digest, ptr + STORE_GTID_SIZE);
+        trx->rv_digest = (uint64_t)digest;
+        left -= STORE_WS_HDR_SIZE;
+        ptr  += STORE_WS_HDR_SIZE;
     }
 
-    while (left >= STORE_OP_SIZE)
+    /* all ops in the writeset are serialized with the same size, so the op
+     * array can be sized once from the size of the first op */
+    uint32_t op_size = 0;
+    if (left >= STORE_OP_SIZE)
     {
-        if (store_trx_add_op(trx))
-        {
-            store_free_trx_id(store,*trx_id); /* "rollback": release resources */
-            return -ENOMEM;
-        }
-        struct store_trx_op* const op = &trx->ops[trx->ops_num - 1];
-
-        store_deserialize_op(op, ptr);
-        assert(op->idx_to <= store->records_num);
-
-        left -= op->size;
-        ptr  += op->size;
+        store_deserialize_uint32(&op_size, ptr + STORE_OP_SIZE -
+                                 sizeof(((struct store_trx_op*)NULL)->size));
     }
 
-    if (left != 0)
+    if (op_size < STORE_OP_SIZE || left % op_size != 0)
     {
         NODE_FATAL("Failed to process last (%d/%zu) bytes of the writeset.",
                    (int)left, ws->len);
         abort();
     }
 
-    return 0;
-}
-
-static uint32_t const store_fnv32_seed  = 2166136261;
-
-static inline uint32_t
-store_fnv32a(const void* buf, size_t const len, uint32_t seed)
-{
-    static uint32_t const fnv32_prime = 16777619;
-    const uint8_t* bp = (const uint8_t*)buf;
-    const uint8_t* const be = bp + len;
-
-    while (bp < be)
+    size_t const ops_num = left / op_size;
+    if (store_trx_reserve_ops(store, trx, ops_num))
     {
-        seed ^= *bp++;
-        seed *= fnv32_prime;
+        store_free_trx_id(store,*trx_id); /* "rollback": release resources */
+        return -ENOMEM;
     }
 
-    return seed;
-}
-
-
-static void
-store_checksum_state(node_store_t* store)
-{
-    uint32_t res = store_fnv32_seed;
-    uint32_t i;
-
-    for (i = 0; i < store->members_num; i++)
+    /* decode all ops at once, record prefetching is left to the commit loop
+     * which knows how far ahead of the current op to go */
+    size_t i;
+    for (i = 0; i < ops_num; i++, ptr += op_size)
     {
-        res = store_fnv32a(&store->members[i], sizeof(*store->members), res);
-    }
-
-    res = store_fnv32a(store->records, store->records_num * STORE_RECORD_SIZE,
-                       res);
-
-    res = store_fnv32a(&store->gtid.uuid, sizeof(store->gtid.uuid), res);
-
-    wsrep_seqno_t s;
-    store_serialize_int64(&s, store->gtid.seqno);
-    res = store_fnv32a(&s, sizeof(s), res);
-
-    NODE_INFO("\n\n\tSeqno: %lld; state hash: %#010x\n",
-              (long long)store->gtid.seqno, res);
-}
-
-static inline void
-store_update_gtid(node_store_t* const store, const wsrep_gtid_t* ws_gtid)
-{
-    assert(0 == wsrep_uuid_compare(&store->gtid.uuid, &ws_gtid->uuid));
+        struct store_trx_op* const op = &trx->ops[i];
 
-    store->gtid.seqno++;
+        store_deserialize_op(op, ptr);
 
-    if (store->gtid.seqno != ws_gtid->seqno)
-    {
-        NODE_FATAL("Out of order commit: expected %lld, got %lld",
-                   store->gtid.seqno, ws_gtid->seqno);
-        abort();
+        if (op->size != op_size ||
+            op->idx_from >= store->records_num ||
+            op->idx_to   >= store->records_num)
+        {
+            NODE_FATAL("Malformed operation %zu of the writeset: size %u, "
+                       "records %u -> %u",
+                       i, op->size, op->idx_from, op->idx_to);
+            abort();
+        }
     }
+    trx->ops_num = ops_num;
 
-    static wsrep_seqno_t const period = 0x000fffff; /* ~1M */
-    if (0 == (store->gtid.seqno & period))
-    {
-        store_checksum_state(store);
-    }
+    return 0;
 }
 
 void
@@ -948,9 +3084,10 @@ node_store_commit(node_store_t*       const store,
     1;
 #endif /* NDEBUG */
 
-    STORE_MUTEX_LOCK(&store->gtid_mtx);
-
-    store_update_gtid(store, ws_gtid);
+    /* REPLICATION: this is called in commit order, so no other transaction
+     *              modifies the records concurrently and they can be read
+     *              without locking. */
+    bool committed = false;
 
     /* First loop is to check if we can commit all operations if provider
      * does not support read view or for debugging puposes */
@@ -978,11 +3115,9 @@ node_store_commit(node_store_t*       const store,
                     assert(op->rec_to.value == to.value);
                 if (store->read_view_support) abort();
 
-                store->read_view_fails++;
-
                 NODE_INFO("Read view changed at commit time, rollback trx");
 
-                goto error;
+                goto update_gtid;
             }
         }
     }
@@ -992,16 +3127,43 @@ node_store_commit(node_store_t*       const store,
     {
         struct store_trx_op* const op = &trx->ops[i];
 
+        if (i + STORE_PREFETCH_DISTANCE < trx->ops_num)
+        {
+            STORE_RECORD_PREFETCH(store->records,
+                                  trx->ops[i + STORE_PREFETCH_DISTANCE].idx_to,
+                                  1);
+        }
+
         record_t const new_record =
             { .version = ws_gtid->seqno, .value = op->new_value };
 
-        store_record_set(store->records, op->idx_to, &new_record);
+        store_record_write(store, op->idx_to, &new_record);
     }
 
-error:
-    pthread_mutex_unlock(&store->gtid_mtx);
+    committed = true;
 
-    store_free_trx_id(store, trx_id);
+update_gtid:
+    /* GTID must be advanced only after the records were modified, see
+     * node_store_execute(). It is advanced later for the whole commit group
+     * in node_store_flush(). */
+    STORE_MUTEX_LOCK(&store->group_mtx);
+
+    struct store_group_entry* const e =
+        store_group_add(store, ws_gtid, committed ? trx : NULL);
+
+    if (!trx->local)
+    {
+        e->verify    = true;
+        e->rv_gtid   = trx->rv_gtid;
+        e->rv_digest = trx->rv_digest;
+    }
+    e->failed = !committed;
+
+    if (store->ckpt_due) store_checkpoint_pin(store, ws_gtid);
+
+    pthread_mutex_unlock(&store->group_mtx);
+
+    store_end_trx(store, trx_id);
 }
 
 void
@@ -1011,6 +3173,19 @@ node_store_rollback(node_store_t*  const store,
     assert(store);
     assert(trx_id);
 
+    store_end_trx(store, trx_id);
+}
+
+void
+node_store_release(node_store_t*  const store,
+                   wsrep_trx_id_t const trx_id)
+{
+    assert(store);
+
+    if (0 == trx_id) return; /* transaction never started in the store */
+
+    assert(store_get_trx_ctx(store, trx_id)->local);
+
     store_free_trx_id(store, trx_id);
 }
 
@@ -1020,9 +3195,40 @@ node_store_update_gtid(node_store_t*       const store,
 {
     assert(store);
 
+    STORE_MUTEX_LOCK(&store->group_mtx);
+
+    store_group_add(store, ws_gtid, NULL);
+
+    if (store->ckpt_due) store_checkpoint_pin(store, ws_gtid);
+
+    pthread_mutex_unlock(&store->group_mtx);
+}
+
+void
+node_store_flush(node_store_t*       const store,
+                 const wsrep_gtid_t* const ws_gtid)
+{
+    assert(store);
+
+    STORE_MUTEX_LOCK(&store->gtid_mtx);
+
+    /* the first one to get here flushes the group for all the others */
+    if (store->gtid.seqno < ws_gtid->seqno) store_group_flush(store);
+
+    assert(store->gtid.seqno >= ws_gtid->seqno);
+
+    pthread_mutex_unlock(&store->gtid_mtx);
+}
+
+void
+node_store_group_stats(node_store_t* const store,
+                       long long           hist[NODE_STORE_GROUP_HIST])
+{
+    assert(store);
+
     STORE_MUTEX_LOCK(&store->gtid_mtx);
 
-    store_update_gtid(store, ws_gtid);
+    memcpy(hist, store->group_hist, sizeof(store->group_hist));
 
     pthread_mutex_unlock(&store->gtid_mtx);
 }
@@ -1036,9 +3242,41 @@ node_store_read_view_failures(node_store_t* const store)
 
     STORE_MUTEX_LOCK(&store->gtid_mtx);
 
-    ret = store->read_view_fails;;
+    ret = store->read_view_fails;
 
     pthread_mutex_unlock(&store->gtid_mtx);
 
     return ret;
 }
+
+long
+node_store_trx_arena_grows(node_store_t* const store)
+{
+    assert(store);
+
+    return atomic_load_explicit(&store->arena_grows, memory_order_relaxed);
+}
+
+long
+node_store_trx_keys_grows(node_store_t* const store)
+{
+    assert(store);
+
+    return atomic_load_explicit(&store->keys_grows, memory_order_relaxed);
+}
+
+int
+node_store_digest(node_store_t*  const store,
+                  wsrep_seqno_t  const seqno,
+                  uint64_t*      const digest)
+{
+    assert(store);
+
+    STORE_MUTEX_LOCK(&store->gtid_mtx);
+
+    bool const found = store_digest_get(store, seqno, digest);
+
+    pthread_mutex_unlock(&store->gtid_mtx);
+
+    return found ? 0 : -ENOENT;
+}
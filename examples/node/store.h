@@ -27,8 +27,12 @@
 
 typedef struct node_store node_store_t;
 
+/* number of log2 buckets in commit group size histogram: 1, 2-3, ..., 128+ */
+#define NODE_STORE_GROUP_HIST 8
+
 /**
- * open a store and optionally assocoate a file with it */
+ * open a store persisted in opts->data_dir, recovering its last committed
+ * state if there is one there */
 extern node_store_t*
 node_store_open(const struct node_options* opts);
 
@@ -38,20 +42,100 @@ extern void
 node_store_close(node_store_t* store);
 
 /**
- * initialize store with a state */
+ * Begin installing a state received in state transfer.
+ *
+ * @param[in]  header      serialized state header
+ * @param[in]  since       WSREP_SEQNO_UNDEFINED for the full state, otherwise
+ *                         the state is a delta on top of the current one and
+ *                         only records modified after since will be installed
+ *                         with node_store_install_delta()
+ * @param[out] records_len size of serialized records that must be installed
+ *                         with node_store_install_records() next
+ */
+extern int
+node_store_install_begin(node_store_t* store,
+                         const void* header, size_t header_len,
+                         wsrep_seqno_t since, size_t* records_len);
+
+/**
+ * install len bytes of serialized records at offset in the new state. Can be
+ * called concurrently for disjoint parts of the records. */
+extern int
+node_store_install_records(node_store_t* store, size_t offset,
+                           const void* buf, size_t len);
+
+/**
+ * install len bytes of delta entries produced by node_store_read_delta(). Can
+ * be called concurrently for entries read from disjoint ranges. */
+extern int
+node_store_install_delta(node_store_t* store, const void* buf, size_t len);
+
+/**
+ * Finish state installation: if error is 0 and all records were installed,
+ * replace the store state with the new one, otherwise discard it.
+ *
+ * @return 0 or a negative error code
+ */
 extern int
-node_store_init_state(node_store_t* store, const void* state, size_t state_len);
+node_store_install_end(node_store_t* store, int error);
 
 /**
- * Return a pointer to state snapshot that is guaranteed to be unchanged
- * until node_store_release_state() is called.
+ * Pin a view of the current state for streaming it in state transfer. The view
+ * stays unchanged until node_store_release_state() is called, while the store
+ * continues to accept commits: records that were not read yet are preserved
+ * before being modified.
  *
- * @param[out] state     pointer to state snapshot
- * @param[out] state_len soze of state snapshot
+ * Serialized state consists of the header followed by records_len bytes of
+ * records, which are sent with node_store_send_state().
+ *
+ * @param[out] header      pointer to serialized state header
+ * @param[out] header_len  size of state header
+ * @param[out] records_len size of serialized records
  */
 extern int
 node_store_acquire_state(node_store_t* store,
-                         const void** state, size_t* state_len);
+                         const void** header, size_t* header_len,
+                         size_t* records_len);
+
+/**
+ * Callback that sends len bytes of serialized records at offset from buf.
+ * buf is only valid until the callback returns.
+ *
+ * @return 0 or a negative error code
+ */
+typedef int (*node_store_send_fn_t)(void* ctx, size_t offset,
+                                    const void* buf, size_t len);
+
+/**
+ * Pass len bytes of serialized records starting at offset of the pinned view
+ * to send() without copying them, in one or more pieces. Commits that modify
+ * the records being sent may wait until send() returns. Each part of the
+ * records should be sent only once.
+ *
+ * @return 0 or a negative error code
+ */
+extern int
+node_store_send_state(node_store_t* store, size_t offset, size_t len,
+                      node_store_send_fn_t send, void* ctx);
+
+/**
+ * @return true if the pinned view can be sent as a delta on top of the state
+ *         at gtid: it must be from the same history and not ahead of the view
+ */
+extern bool
+node_store_delta_possible(node_store_t* store, const wsrep_gtid_t* gtid);
+
+/**
+ * Read records of the pinned view that were modified after seqno as
+ * (index, record) entries for node_store_install_delta(). Records that start
+ * in the bytes [*offset, end) of serialized records are examined until buf is
+ * filled and *offset is advanced past them.
+ *
+ * @return the number of bytes written to buf or a negative error code
+ */
+extern long
+node_store_read_delta(node_store_t* store, wsrep_seqno_t seqno,
+                      size_t* offset, size_t end, void* buf, size_t buf_len);
 
 /**
  * release state */
@@ -72,8 +156,10 @@ node_store_gtid(node_store_t* store, wsrep_gtid_t* gtid);
  * execute and prepare local transaction in store and return its key and write
  * set.
  *
- * This operation allocates resources that must be freed with either
- * node_store_commit() or node_store_rollback()
+ * Keys and write set are passed to provider without copying, so the resources
+ * allocated by this operation must be freed with node_store_release() after
+ * wsrep::release() was called for the transaction, regardless of whether it
+ * was committed or rolled back.
  *
  * @param[in]  wsrep     provider handle
  * @param[out] ws_handle reference to the resulting write set in the provider
@@ -83,6 +169,15 @@ node_store_execute(node_store_t*      store,
                    wsrep_t*           wsrep,
                    wsrep_ws_handle_t* ws_handle);
 
+/**
+ * append keys of the local transaction executed with node_store_execute() to
+ * its write set. Must be called after the last node_store_execute() before
+ * certification. */
+extern int
+node_store_prepare(node_store_t*      store,
+                   wsrep_t*           wsrep,
+                   wsrep_ws_handle_t* ws_handle);
+
 /**
  * apply and prepare foreign write set received from replication
  *
@@ -98,7 +193,12 @@ node_store_apply(node_store_t*      store,
                  const wsrep_buf_t* ws);
 
 /**
- * commit prepared transaction identified by trx_id */
+ * commit prepared transaction identified by trx_id
+ *
+ * Must be called in commit order: concurrent commits are not serialized in
+ * the store. Records are modified right away, but the store GTID is advanced
+ * and the transaction is logged only by node_store_flush(), which should be
+ * called after leaving commit order. */
 extern void
 node_store_commit(node_store_t*       store,
                   wsrep_trx_id_t      trx_id,
@@ -111,15 +211,66 @@ node_store_rollback(node_store_t*  store,
                     wsrep_trx_id_t trx_id);
 
 /**
- * update storage GTID for transactions that had to be skipped/rolled back */
+ * release resources of the local transaction identified by trx_id, must be
+ * called after wsrep::release() */
+extern void
+node_store_release(node_store_t*  store,
+                   wsrep_trx_id_t trx_id);
+
+/**
+ * update storage GTID for transactions that had to be skipped/rolled back
+ *
+ * Like node_store_commit() must be called in commit order and followed by
+ * node_store_flush(). */
 extern void
 node_store_update_gtid(node_store_t*       store,
                        const wsrep_gtid_t* ws_gtid);
 
+/**
+ * Make sure that the store GTID has reached ws_gtid and that it is logged.
+ *
+ * Transactions that left commit order while another thread was flushing
+ * are accumulated in a commit group, and the first of them to get here
+ * flushes the whole group with a single log write. The rest find their GTID
+ * already flushed. */
+extern void
+node_store_flush(node_store_t*       store,
+                 const wsrep_gtid_t* ws_gtid);
+
+/**
+ * get the histogram of flushed commit group sizes: hist[i] is the number of
+ * groups of [2^i, 2^(i+1)) transactions, the last bucket is open-ended */
+extern void
+node_store_group_stats(node_store_t* store,
+                       long long     hist[NODE_STORE_GROUP_HIST]);
+
 /**
  * @return the number of store read view snapshot check failures at commit time.
  *         (should be zero if provider implements assign_read_view() call) */
 extern long
 node_store_read_view_failures(node_store_t* store);
 
+/**
+ * get the digest of the store records at seqno of the current history.
+ *
+ * Records digest is updated incrementally and published at every GTID, so it
+ * can be compared between nodes at any recent seqno without scanning records.
+ *
+ * @param[out] digest records digest
+ * @return 0 on success, -ENOENT if seqno is not among the recent ones */
+extern int
+node_store_digest(node_store_t* store, wsrep_seqno_t seqno, uint64_t* digest);
+
+/**
+ * @return the number of times transaction operation arenas had to grow.
+ *         (should stop increasing once all trx pool slots are warmed up) */
+extern long
+node_store_trx_arena_grows(node_store_t* store);
+
+/**
+ * @return the number of times transaction key arenas had to grow.
+ *         (should stop increasing once all trx pool slots are warmed up) */
+extern long
+node_store_trx_keys_grows(node_store_t* store);
+
 #endif /* NODE_STORE_H */
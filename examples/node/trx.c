@@ -22,36 +22,96 @@
 #include <stdbool.h>
 
 wsrep_status_t
-node_trx_execute(node_store_t*   const store,
-                 wsrep_t*        const wsrep,
-                 wsrep_conn_id_t const conn_id,
-                 int                   ops_num)
+node_trx_prepare(node_store_t*      const store,
+                 wsrep_t*           const wsrep,
+                 wsrep_conn_id_t    const conn_id,
+                 int                      ops_num,
+                 wsrep_ws_handle_t* const ws_handle)
 {
-    wsrep_status_t cert = WSREP_OK; // for cleanup
-
-    static unsigned int const ws_flags =
-        WSREP_FLAG_TRX_START | WSREP_FLAG_TRX_END; // atomic trx
-    wsrep_trx_meta_t ws_meta;
-    wsrep_status_t ret = WSREP_OK;
+    (void)conn_id;
+    int ret = 0;
 
     /* prepare simple transaction and obtain a writeset handle for it */
-    wsrep_ws_handle_t ws_handle = { 0, NULL };
+    ws_handle->trx_id = 0;
+    ws_handle->opaque = NULL;
     while (ops_num--)
     {
-        if (0 != (ret = node_store_execute(store, wsrep, &ws_handle)))
+        if (0 != (ret = node_store_execute(store, wsrep, ws_handle)))
         {
 #if 0
             NODE_INFO("master [%d]: node_store_execute() returned %d",
                       conn_id, ret);
 #endif
-            ret = WSREP_TRX_FAIL;
-            goto cleanup;
+            break;
         }
     }
 
+    /* append all transaction keys at once */
+    if (0 == ret) ret = node_store_prepare(store, wsrep, ws_handle);
+
+    if (ret)
+    {
+        /* REPLICATION: release provider resources associated with the trx */
+        wsrep->release(wsrep, ws_handle);
+
+        /* provider does not reference trx keys and writeset any more */
+        node_store_release(store, ws_handle->trx_id);
+
+        return WSREP_TRX_FAIL;
+    }
+
+    return WSREP_OK;
+}
+
+/* makes sure that the caller is notified of ordering exactly once */
+struct trx_seq
+{
+    const wsrep_seq_cb_t* cb;
+    bool                  called;
+};
+
+static void
+trx_seq_fn(void* const ctx)
+{
+    struct trx_seq* const seq = ctx;
+    if (!seq->called)
+    {
+        seq->called = true;
+        seq->cb->fn(seq->cb->ctx);
+    }
+}
+
+wsrep_status_t
+node_trx_replicate(node_store_t*         const store,
+                   wsrep_t*              const wsrep,
+                   wsrep_certify_fn_v1   const certify_v1,
+                   wsrep_conn_id_t       const conn_id,
+                   wsrep_ws_handle_t*    const ws_handle,
+                   const wsrep_seq_cb_t* const seq_cb)
+{
+    wsrep_status_t cert = WSREP_OK; // for cleanup
+
+    static unsigned int const ws_flags =
+        WSREP_FLAG_TRX_START | WSREP_FLAG_TRX_END; // atomic trx
+    wsrep_trx_meta_t ws_meta;
+    wsrep_status_t ret = WSREP_OK;
+
+    struct trx_seq seq = { seq_cb, false };
+    wsrep_seq_cb_t const trx_seq_cb = { &seq, trx_seq_fn };
+
     /* REPLICATION: (replicate and) certify the writeset (pointed to by
-     *              ws_handle) with the cluster */
-    cert = wsrep->certify(wsrep, conn_id, &ws_handle, ws_flags, &ws_meta);
+     *              ws_handle) with the cluster. If provider supports it,
+     *              it lets us know when the writeset ordering is guaranteed,
+     *              so that the next transaction can be replicated while this
+     *              one is still being certified. */
+    if (certify_v1 && seq_cb)
+        cert = certify_v1(wsrep, conn_id, ws_handle, ws_flags, &ws_meta,
+                          &trx_seq_cb);
+    else
+        cert = wsrep->certify(wsrep, conn_id, ws_handle, ws_flags, &ws_meta);
+
+    /* certify() has returned, so ordering is decided (or has failed) anyway */
+    if (seq_cb) trx_seq_fn(&seq);
 
     if (WSREP_BF_ABORT == cert)
     {
@@ -59,13 +119,13 @@ node_trx_execute(node_store_t*   const store,
          *              conflict. It must rollback immediately: it blocks
          *              transaction that was ordered earlier and will never
          *              be able to enter commit order. */
-        node_store_rollback(store, ws_handle.trx_id);
+        node_store_rollback(store, ws_handle->trx_id);
     }
 
     /* REPLICATION: writeset was totally ordered, need to enter commit order */
     if (ws_meta.gtid.seqno > 0)
     {
-        ret = wsrep->commit_order_enter(wsrep, &ws_handle, &ws_meta);
+        ret = wsrep->commit_order_enter(wsrep, ws_handle, &ws_meta);
         if (ret)
         {
             NODE_ERROR("master [%d]: wsrep::commit_order_enter(%lld) failed: "
@@ -76,17 +136,21 @@ node_trx_execute(node_store_t*   const store,
         /* REPLICATION: inside commit monitor
          * Note: we commit transaction only if certification succeded */
         if (WSREP_OK == cert)
-            node_store_commit(store, ws_handle.trx_id, &ws_meta.gtid);
+            node_store_commit(store, ws_handle->trx_id, &ws_meta.gtid);
         else
             node_store_update_gtid(store, &ws_meta.gtid);
 
-        ret = wsrep->commit_order_leave(wsrep, &ws_handle, &ws_meta, NULL);
+        ret = wsrep->commit_order_leave(wsrep, ws_handle, &ws_meta, NULL);
         if (ret)
         {
             NODE_ERROR("master [%d]: wsrep::commit_order_leave(%lld) failed: "
                        "%d", (long long)(ws_meta.gtid.seqno), ret);
             goto cleanup;
         }
+
+        /* outside commit monitor: advance GTID together with whatever other
+         * transactions committed meanwhile */
+        node_store_flush(store, &ws_meta.gtid);
     }
     else
     {
@@ -97,16 +161,38 @@ cleanup:
     /* REPLICATION: if wsrep->certify() returned anything else but WSREP_OK
      *              transaction must roll back. BF aborted trx already did it. */
     if (cert && WSREP_BF_ABORT != cert)
-        node_store_rollback(store, ws_handle.trx_id);
+        node_store_rollback(store, ws_handle->trx_id);
 
     /* NOTE: this application follows the approach that resources must be freed
      *       at the same level where they were allocated, so it is assumed that
      *       ws_key and ws were deallocated in either commit or rollback calls.*/
 
     /* REPLICATION: release provider resources associated with the trx */
-    wsrep->release(wsrep, &ws_handle);
+    wsrep->release(wsrep, ws_handle);
+
+    /* provider does not reference trx keys and writeset any more */
+    node_store_release(store, ws_handle->trx_id);
 
-    return ret ? ret : cert;
+    if (ret) return ret;
+
+    /* for the caller BF abort is just another conflict: trx rolled back and
+     * can be retried */
+    return WSREP_BF_ABORT == cert ? WSREP_TRX_FAIL : cert;
+}
+
+wsrep_status_t
+node_trx_execute(node_store_t*   const store,
+                 wsrep_t*        const wsrep,
+                 wsrep_conn_id_t const conn_id,
+                 int             const ops_num)
+{
+    wsrep_ws_handle_t ws_handle;
+
+    wsrep_status_t const ret =
+        node_trx_prepare(store, wsrep, conn_id, ops_num, &ws_handle);
+    if (ret) return ret;
+
+    return node_trx_replicate(store, wsrep, NULL, conn_id, &ws_handle, NULL);
 }
 
 wsrep_status_t
@@ -151,5 +237,80 @@ node_trx_apply(node_store_t*            const store,
 
     ret = wsrep->commit_order_leave(wsrep, ws_handle, ws_meta, &err_buf);
 
+    node_store_flush(store, &ws_meta->gtid);
+
     return ret;
 }
+
+wsrep_status_t
+node_trx_apply_batch(node_store_t*            const store,
+                     wsrep_t*                 const wsrep,
+                     const wsrep_ws_handle_t* const ws_handles,
+                     const wsrep_trx_meta_t*  const ws_meta,
+                     const uint32_t*          const ws_flags,
+                     const wsrep_buf_t*       const ws,
+                     size_t                   const count)
+{
+    assert(count > 0);
+    assert(count <= NODE_APPLY_BATCH_MAX);
+
+    wsrep_trx_id_t trx_ids[NODE_APPLY_BATCH_MAX];
+    wsrep_buf_t err_buf = { NULL, 0 };
+    wsrep_status_t ret;
+    size_t applied;
+    size_t i;
+
+    for (applied = 0; applied < count; applied++)
+    {
+        /* no business being here if event was not ordered */
+        assert(ws_meta[applied].gtid.seqno > 0);
+
+        /* ws failed certification and should be skipped */
+        if (ws_flags[applied] & WSREP_FLAG_ROLLBACK) continue;
+
+        if (node_store_apply(store, &trx_ids[applied], &ws[applied])) break;
+    }
+
+    if (applied > 0)
+    {
+        /* REPLICATION: the whole batch is committed in one commit order
+         *              critical section: entered with the first writeset and
+         *              left with the last one */
+        ret = wsrep->commit_order_enter(wsrep, &ws_handles[0], &ws_meta[0]);
+        if (ret)
+        {
+            for (i = 0; i < applied; i++)
+            {
+                if (!(ws_flags[i] & WSREP_FLAG_ROLLBACK))
+                    node_store_rollback(store, trx_ids[i]);
+            }
+            return ret;
+        }
+
+        for (i = 0; i < applied; i++)
+        {
+            if (ws_flags[i] & WSREP_FLAG_ROLLBACK)
+                node_store_update_gtid(store, &ws_meta[i].gtid);
+            else
+                node_store_commit(store, trx_ids[i], &ws_meta[i].gtid);
+        }
+
+        ret = wsrep->commit_order_leave(wsrep, &ws_handles[applied - 1],
+                                        &ws_meta[applied - 1], &err_buf);
+
+        node_store_flush(store, &ws_meta[applied - 1].gtid);
+
+        if (ret) return ret;
+    }
+
+    /* applying failed: the rest is committed one by one, so that the error
+     * is reported with the writeset it belongs to */
+    for (i = applied; i < count; i++)
+    {
+        ret = node_trx_apply(store, wsrep, &ws_handles[i], &ws_meta[i],
+                             ws_flags[i] & WSREP_FLAG_ROLLBACK ? NULL : &ws[i]);
+        if (ret) return ret;
+    }
+
+    return WSREP_OK;
+}
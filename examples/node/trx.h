@@ -25,6 +25,38 @@
 
 #include "../../wsrep_api.h"
 
+/**
+ * executes local transaction and prepares its writeset for replication.
+ * On failure the transaction is released.
+ *
+ * @return WSREP_TRX_FAIL if the transaction must be restarted, usually because
+ *         its read view changed, as opposed to certification failure of
+ *         node_trx_replicate()
+ */
+extern wsrep_status_t
+node_trx_prepare(node_store_t*      store,
+                 wsrep_t*           wsrep,
+                 wsrep_conn_id_t    conn_id,
+                 int                ops_num,
+                 wsrep_ws_handle_t* ws_handle);
+
+/**
+ * replicates, certifies and commits (or rolls back) transaction prepared with
+ * node_trx_prepare() and releases it
+ *
+ * @param certify_v1 certify() extension supporting seq_cb or NULL
+ * @param seq_cb     if not NULL, called exactly once as soon as the writeset
+ *                   ordering is guaranteed (or it failed to be ordered), so
+ *                   the next transaction of the connection can be replicated
+ */
+extern wsrep_status_t
+node_trx_replicate(node_store_t*         store,
+                   wsrep_t*              wsrep,
+                   wsrep_certify_fn_v1   certify_v1,
+                   wsrep_conn_id_t       conn_id,
+                   wsrep_ws_handle_t*    ws_handle,
+                   const wsrep_seq_cb_t* seq_cb);
+
 /**
  * executes and replicates local transaction
  */
@@ -47,4 +79,22 @@ node_trx_apply(node_store_t*            store,
                const wsrep_trx_meta_t*  ws_meta,
                const wsrep_buf_t*       ws);
 
+/**
+ * applies and commits a batch of slave write sets with consecutive seqnos in
+ * a single commit order critical section
+ *
+ * @param ws_flags write set flags, those with WSREP_FLAG_ROLLBACK failed
+ *                 certification and only update store GTID
+ * @param count    number of write sets in the batch, at most
+ *                 NODE_APPLY_BATCH_MAX
+ */
+extern wsrep_status_t
+node_trx_apply_batch(node_store_t*            store,
+                     wsrep_t*                 wsrep,
+                     const wsrep_ws_handle_t* ws_handles,
+                     const wsrep_trx_meta_t*  ws_meta,
+                     const uint32_t*          ws_flags,
+                     const wsrep_buf_t*       ws,
+                     size_t                   count);
+
 #endif /* NODE_TRX_H */
@@ -22,9 +22,14 @@
 #include "wsrep.h"
 
 #include <assert.h>
+#include <math.h>    // log()
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdlib.h>  // calloc()
 #include <string.h>  // strerror()
+#include <time.h>    // time(), clock_gettime()
+#include <unistd.h>  // usleep()
 
 struct node_worker
 {
@@ -34,6 +39,208 @@ struct node_worker
     bool             exit;
 };
 
+/*
+ * Retry policy for failed local transactions. A transaction that failed in
+ * execution because its read view changed can be restarted right away: the
+ * conflicting transaction has already committed. Certification failure means
+ * a conflict with a concurrent transaction that may be still in flight, so
+ * the retry is delayed with exponential backoff and jitter to desynchronize
+ * masters that contend for the same records. Read view conflicts that keep
+ * repeating fall back to backoff too.
+ */
+#define WORKER_BACKOFF_MIN 100   // microseconds
+#define WORKER_BACKOFF_MAX 10000 // microseconds
+#define WORKER_RV_RETRIES  8     // immediate retries before backing off
+
+struct worker_backoff
+{
+    useconds_t   delay;      // the next backoff delay, 0 before the first one
+    int          rv_retries; // consecutive immediate retries
+    unsigned int seed;
+};
+
+/* retry counters of all masters, see node_worker_retry_stats() */
+static atomic_llong worker_rv_aborts;
+static atomic_llong worker_cert_aborts;
+static atomic_llong worker_immediate_retries;
+static atomic_llong worker_backoff_retries;
+static atomic_llong worker_backoff_time;
+
+static void
+worker_backoff_init(struct worker_backoff* const b, unsigned int const seed)
+{
+    b->delay      = 0;
+    b->rv_retries = 0;
+    b->seed       = seed ^ (unsigned int)time(NULL);
+}
+
+static inline void
+worker_backoff_reset(struct worker_backoff* const b)
+{
+    b->delay      = 0;
+    b->rv_retries = 0;
+}
+
+/**
+ * waits (or not) before the failed transaction is retried
+ *
+ * @param read_view true if transaction failed because its read view changed,
+ *                  false if it failed certification */
+static void
+worker_backoff_retry(struct worker_backoff* const b, bool const read_view)
+{
+    atomic_fetch_add_explicit(read_view ? &worker_rv_aborts :
+                              &worker_cert_aborts, 1, memory_order_relaxed);
+
+    if (read_view && b->rv_retries < WORKER_RV_RETRIES)
+    {
+        b->rv_retries++;
+        atomic_fetch_add_explicit(&worker_immediate_retries, 1,
+                                  memory_order_relaxed);
+        return;
+    }
+
+    b->delay = b->delay ? b->delay * 2 : WORKER_BACKOFF_MIN;
+    if (b->delay > WORKER_BACKOFF_MAX) b->delay = WORKER_BACKOFF_MAX;
+
+    /* sleep somewhere in [delay/2, delay] */
+    useconds_t const half  = b->delay / 2;
+    useconds_t const sleep = half +
+        (useconds_t)rand_r(&b->seed) % (b->delay - half + 1);
+
+    atomic_fetch_add_explicit(&worker_backoff_retries, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&worker_backoff_time, sleep,
+                              memory_order_relaxed);
+    usleep(sleep);
+}
+
+void
+node_worker_retry_stats(struct node_worker_retry_stats* const stats)
+{
+    stats->rv_aborts   = atomic_load_explicit(&worker_rv_aborts,
+                                              memory_order_relaxed);
+    stats->cert_aborts = atomic_load_explicit(&worker_cert_aborts,
+                                              memory_order_relaxed);
+    stats->immediate_retries =
+        atomic_load_explicit(&worker_immediate_retries, memory_order_relaxed);
+    stats->backoff_retries =
+        atomic_load_explicit(&worker_backoff_retries, memory_order_relaxed);
+    stats->backoff_time = atomic_load_explicit(&worker_backoff_time,
+                                               memory_order_relaxed);
+}
+
+static inline uint64_t
+worker_time_now(void) // microseconds
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000 + (uint64_t)t.tv_nsec / 1000;
+}
+
+/*
+ * Open-loop load generation: if the rate is limited, each master starts
+ * transactions at the times of a Poisson process, independently of how long
+ * the previous ones take. A master that falls behind the schedule starts
+ * the next transaction right away until it catches up, and the latency is
+ * measured from the scheduled start rather than from the actual one, so
+ * that stalls are not hidden by the master not sending anything during them
+ * ("coordinated omission").
+ */
+struct worker_pacer
+{
+    double       interval; // mean interval between starts, 0 if not limited
+    uint64_t     next;     // the next scheduled start
+    unsigned int seed;
+};
+
+static void
+worker_pacer_init(struct worker_pacer*       const p,
+                  const struct node_options* const opts,
+                  unsigned int               const seed)
+{
+    if (opts->rate > 0)
+        p->interval = 1.0e+06 * (double)opts->masters / (double)opts->rate;
+    else
+        p->interval = (double)opts->delay; // already in microseconds
+
+    p->next = worker_time_now();
+    p->seed = seed ^ (unsigned int)time(NULL);
+}
+
+/**
+ * waits until the next scheduled transaction start
+ *
+ * @return the scheduled start time */
+static uint64_t
+worker_pacer_wait(struct worker_pacer* const p)
+{
+    uint64_t const now = worker_time_now();
+
+    if (p->interval <= 0) return now; // closed loop: start right away
+
+    uint64_t const start = p->next;
+    if (now < start) usleep((useconds_t)(start - now));
+
+    /* exponentially distributed interval to the next start, u is in (0, 1] */
+    double const u = ((double)rand_r(&p->seed) + 1.0) / ((double)RAND_MAX + 1.0);
+    p->next += (uint64_t)(-log(u) * p->interval);
+
+    return start;
+}
+
+/*
+ * Latency histogram of all masters: 8 linear sub-buckets per power of 2,
+ * so the value of a bucket is accurate to 12.5%. Values in microseconds.
+ */
+#define WORKER_LAT_SUB_BITS 3
+#define WORKER_LAT_SUB      (1 << WORKER_LAT_SUB_BITS)
+
+static atomic_llong worker_latency[NODE_WORKER_LATENCY_BUCKETS];
+
+static inline int
+worker_latency_bucket(uint64_t const v)
+{
+    if (v < 2 * WORKER_LAT_SUB) return (int)v;
+
+    int const msb   = 63 - __builtin_clzll(v);
+    int const shift = msb - WORKER_LAT_SUB_BITS;
+    int const ret   = (shift + 1) * WORKER_LAT_SUB +
+        (int)(v >> shift) - WORKER_LAT_SUB;
+
+    return ret < NODE_WORKER_LATENCY_BUCKETS ?
+        ret : NODE_WORKER_LATENCY_BUCKETS - 1;
+}
+
+static inline void
+worker_latency_record(uint64_t const start)
+{
+    uint64_t const now = worker_time_now();
+    int const b = worker_latency_bucket(now > start ? now - start : 0);
+    atomic_fetch_add_explicit(&worker_latency[b], 1, memory_order_relaxed);
+}
+
+void
+node_worker_latency_stats(long long hist[NODE_WORKER_LATENCY_BUCKETS])
+{
+    int i;
+    for (i = 0; i < NODE_WORKER_LATENCY_BUCKETS; i++)
+    {
+        hist[i] = atomic_load_explicit(&worker_latency[i],
+                                       memory_order_relaxed);
+    }
+}
+
+long long
+node_worker_latency_value(int const bucket)
+{
+    if (bucket < 2 * WORKER_LAT_SUB) return bucket;
+
+    int const shift = bucket / WORKER_LAT_SUB - 1;
+    long long const base = WORKER_LAT_SUB + bucket % WORKER_LAT_SUB;
+
+    return ((base + 1) << shift) - 1;
+}
+
 enum wsrep_cb_status
 node_worker_apply_cb(void*                    const recv_ctx,
                      const wsrep_ws_handle_t* const ws_handle,
@@ -58,14 +265,47 @@ node_worker_apply_cb(void*                    const recv_ctx,
     return WSREP_OK == ret ? WSREP_CB_SUCCESS : WSREP_CB_FAILURE;
 }
 
+/* REPLICATION: a callback to apply and commit a batch of consecutive slave
+ *              writesets at once */
+static enum wsrep_cb_status
+worker_apply_batch_cb(void*                    const recv_ctx,
+                      const wsrep_ws_handle_t* const ws_handles,
+                      const uint32_t*          const ws_flags,
+                      const wsrep_buf_t*       const ws,
+                      const wsrep_trx_meta_t*  const ws_meta,
+                      size_t                   const count,
+                      wsrep_bool_t*            const exit_loop)
+{
+    assert(recv_ctx);
+
+    struct node_worker* const worker = recv_ctx;
+
+    wsrep_status_t const ret = node_trx_apply_batch(
+        worker->node->store,
+        node_wsrep_provider(worker->node->wsrep),
+        ws_handles,
+        ws_meta,
+        ws_flags,
+        ws,
+        count);
+
+    *exit_loop = worker->exit;
+
+    return WSREP_OK == ret ? WSREP_CB_SUCCESS : WSREP_CB_FAILURE;
+}
 
 static void*
 worker_slave(void* recv_ctx)
 {
     struct node_worker* const worker = recv_ctx;
     wsrep_t* const wsrep = node_wsrep_provider(worker->node->wsrep);
+    wsrep_recv_batch_fn_v1 const recv_batch_v1 =
+        node_wsrep_recv_batch_v1(worker->node->wsrep);
+    size_t const apply_batch = (size_t)worker->node->opts->apply_batch;
 
-    wsrep_status_t const ret = wsrep->recv(wsrep, worker);
+    wsrep_status_t const ret = recv_batch_v1 && apply_batch > 1 ?
+        recv_batch_v1(wsrep, worker, worker_apply_batch_cb, apply_batch) :
+        wsrep->recv(wsrep, worker);
 
     if (WSREP_OK != ret)
     {
@@ -75,6 +315,279 @@ worker_slave(void* recv_ctx)
     return NULL;
 }
 
+/*
+ * Pipelined master: the master thread executes transactions and hands them
+ * over to the lanes that replicate them, keeping up to opts->pipeline
+ * transactions in flight. To preserve the order of transactions of the
+ * connection, the next transaction is handed over only after the previous one
+ * is ordered (seq_cb of node_trx_replicate()), not when it is committed.
+ */
+struct worker_pipeline;
+
+struct worker_lane
+{
+    struct worker_pipeline* pipeline;
+    pthread_t               thread_id;
+    wsrep_ws_handle_t       ws_handle;
+    struct worker_backoff   backoff;
+    uint64_t                start;  // scheduled start of the transaction
+    uint64_t                ticket; // ordering ticket of the transaction
+    bool                    busy;   // has a transaction to replicate
+    bool                    failed; // transaction failed certification
+};
+
+struct worker_pipeline
+{
+    struct node_worker* worker;
+    pthread_mutex_t     mtx;
+    pthread_cond_t      cond;      // for both master and lanes
+    uint64_t            submitted; // the last ticket handed over to lanes
+    uint64_t            ordered;   // the last ticket that was ordered
+    wsrep_status_t      ret;       // the first error returned to lanes
+    size_t              idle;      // number of lanes free for the master
+    size_t              failed;    // number of lanes with a failed trx
+    size_t              size;      // number of lanes
+    bool                exit;
+    struct worker_lane  lanes[1];  // lane context array
+};
+
+static void
+worker_lane_ordered(void* const ctx)
+{
+    struct worker_lane*     const lane     = ctx;
+    struct worker_pipeline* const pipeline = lane->pipeline;
+
+    pthread_mutex_lock(&pipeline->mtx);
+    assert(pipeline->ordered + 1 == lane->ticket);
+    pipeline->ordered = lane->ticket;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mtx);
+}
+
+static void*
+worker_lane(void* const arg)
+{
+    struct worker_lane*     const lane     = arg;
+    struct worker_pipeline* const pipeline = lane->pipeline;
+    struct node_ctx*        const node     = pipeline->worker->node;
+    wsrep_t*                const wsrep    = node_wsrep_provider(node->wsrep);
+    wsrep_certify_fn_v1     const certify_v1 =
+        node_wsrep_certify_v1(node->wsrep);
+    wsrep_seq_cb_t          const seq_cb   = { lane, worker_lane_ordered };
+
+    pthread_mutex_lock(&pipeline->mtx);
+
+    while (true)
+    {
+        while (!lane->busy && !pipeline->exit)
+            pthread_cond_wait(&pipeline->cond, &pipeline->mtx);
+
+        if (!lane->busy) break;
+
+        pthread_mutex_unlock(&pipeline->mtx);
+
+        wsrep_status_t const ret = node_trx_replicate(node->store, wsrep,
+                                                      certify_v1,
+                                                      pipeline->worker->id,
+                                                      &lane->ws_handle,
+                                                      &seq_cb);
+        /* certification failed, trx rolled back: back off before the master
+         * gets this lane to restart the transaction */
+        if (WSREP_TRX_FAIL == ret) worker_backoff_retry(&lane->backoff, false);
+        else if (WSREP_OK == ret)
+        {
+            worker_backoff_reset(&lane->backoff);
+            worker_latency_record(lane->start);
+        }
+
+        pthread_mutex_lock(&pipeline->mtx);
+
+        if (WSREP_OK != ret && WSREP_TRX_FAIL != ret &&
+            WSREP_OK == pipeline->ret)
+        {
+            pipeline->ret = ret;
+        }
+        lane->busy = false;
+        /* failed transaction is restarted by the master with the same
+         * scheduled start, so that its latency includes all the attempts */
+        if (WSREP_TRX_FAIL == ret && !pipeline->exit)
+        {
+            lane->failed = true;
+            pipeline->failed++;
+        }
+        else
+        {
+            pipeline->idle++;
+        }
+        pthread_cond_broadcast(&pipeline->cond);
+    }
+
+    pthread_mutex_unlock(&pipeline->mtx);
+
+    return NULL;
+}
+
+static struct worker_pipeline*
+worker_pipeline_start(struct node_worker* const worker, size_t const size)
+{
+    size_t const alloc_size = sizeof(struct worker_pipeline) +
+        sizeof(struct worker_lane) * (size - 1);
+
+    struct worker_pipeline* const ret = calloc(1, alloc_size);
+    if (!ret)
+    {
+        NODE_ERROR("Failed to allocate %zu bytes for master pipeline",
+                   alloc_size);
+        return NULL;
+    }
+
+    ret->worker = worker;
+    pthread_mutex_init(&ret->mtx, NULL);
+    pthread_cond_init(&ret->cond, NULL);
+
+    size_t i;
+    for (i = 0; i < size; i++)
+    {
+        struct worker_lane* const lane = &ret->lanes[i];
+        lane->pipeline = ret;
+        worker_backoff_init(&lane->backoff,
+                            (unsigned int)(worker->id * size + i));
+
+        int const err = pthread_create(&lane->thread_id, NULL, worker_lane,
+                                       lane);
+        if (err)
+        {
+            NODE_ERROR("Failed to start master [%zu] lane %zu: %d (%s)",
+                       worker->id, i, err, strerror(err));
+            break; // continue with what has started
+        }
+    }
+
+    ret->size = i;
+    ret->idle = i;
+
+    return ret;
+}
+
+static void
+worker_pipeline_stop(struct worker_pipeline* const pipeline)
+{
+    pthread_mutex_lock(&pipeline->mtx);
+    pipeline->exit = true;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mtx);
+
+    size_t i;
+    for (i = 0; i < pipeline->size; i++)
+    {
+        pthread_join(pipeline->lanes[i].thread_id, NULL);
+    }
+
+    pthread_cond_destroy(&pipeline->cond);
+    pthread_mutex_destroy(&pipeline->mtx);
+    free(pipeline);
+}
+
+/**
+ * executes transactions and hands them over to pipeline lanes until one of
+ * them returns an error that is not a certification failure
+ *
+ * @return that error */
+static wsrep_status_t
+worker_pipeline_run(struct worker_pipeline* const pipeline)
+{
+    struct node_worker* const worker = pipeline->worker;
+    struct node_ctx*    const node   = worker->node;
+    wsrep_t*            const wsrep  = node_wsrep_provider(node->wsrep);
+
+    wsrep_status_t ret;
+
+    struct worker_backoff backoff;
+    worker_backoff_init(&backoff, (unsigned int)worker->id);
+
+    struct worker_pacer pacer;
+    worker_pacer_init(&pacer, node->opts, (unsigned int)worker->id);
+    uint64_t start    = 0;
+    bool     retrying = false;
+
+    pthread_mutex_lock(&pipeline->mtx);
+
+    while (WSREP_OK == (ret = pipeline->ret) && pipeline->size > 0)
+    {
+        /* wait for a free lane */
+        if (0 == pipeline->idle && (retrying || 0 == pipeline->failed))
+        {
+            pthread_cond_wait(&pipeline->cond, &pipeline->mtx);
+            continue;
+        }
+
+        /* take over the transaction that failed certification */
+        if (!retrying && pipeline->failed > 0)
+        {
+            size_t i;
+            for (i = 0; !pipeline->lanes[i].failed; i++)
+                assert(i < pipeline->size);
+
+            struct worker_lane* const lane = &pipeline->lanes[i];
+            lane->failed = false;
+            pipeline->failed--;
+            pipeline->idle++;
+            start    = lane->start;
+            retrying = true;
+        }
+
+        pthread_mutex_unlock(&pipeline->mtx);
+
+        /* transaction restart keeps its scheduled start */
+        if (!retrying) start = worker_pacer_wait(&pacer);
+
+        wsrep_ws_handle_t ws_handle;
+        ret = node_trx_prepare(node->store, wsrep, worker->id,
+                               (int)node->opts->operations, &ws_handle);
+        if (WSREP_OK != ret) worker_backoff_retry(&backoff, true);
+        else                 worker_backoff_reset(&backoff);
+        retrying = (WSREP_OK != ret);
+
+        pthread_mutex_lock(&pipeline->mtx);
+
+        if (WSREP_OK != ret) continue;
+
+        /* REPLICATION: previous transaction must be ordered before the next
+         *              one is replicated */
+        while (pipeline->ordered != pipeline->submitted)
+            pthread_cond_wait(&pipeline->cond, &pipeline->mtx);
+
+        size_t i;
+        for (i = 0; pipeline->lanes[i].busy || pipeline->lanes[i].failed; i++)
+            assert(i < pipeline->size);
+
+        struct worker_lane* const lane = &pipeline->lanes[i];
+        lane->ws_handle = ws_handle;
+        lane->start     = start;
+        lane->ticket    = ++pipeline->submitted;
+        lane->busy      = true;
+        pipeline->idle--;
+        pthread_cond_broadcast(&pipeline->cond);
+    }
+
+    /* wait for transactions in flight */
+    while (pipeline->idle + pipeline->failed < pipeline->size)
+        pthread_cond_wait(&pipeline->cond, &pipeline->mtx);
+
+    /* failed transactions are abandoned with the rest of the run */
+    size_t i;
+    for (i = 0; i < pipeline->size; i++) pipeline->lanes[i].failed = false;
+    pipeline->idle  += pipeline->failed;
+    pipeline->failed = 0;
+
+    if (0 == pipeline->size) ret = WSREP_FATAL;
+    pipeline->ret = WSREP_OK;
+
+    pthread_mutex_unlock(&pipeline->mtx);
+
+    return ret;
+}
+
 static void*
 worker_master(void* send_ctx)
 {
@@ -86,6 +599,29 @@ worker_master(void* send_ctx)
 
     wsrep_status_t ret;
 
+    struct worker_backoff backoff;
+    worker_backoff_init(&backoff, (unsigned int)worker->id);
+
+    struct worker_pacer pacer;
+    worker_pacer_init(&pacer, node->opts, (unsigned int)worker->id);
+    uint64_t start    = 0;
+    bool     retrying = false;
+
+    struct worker_pipeline* pipeline = NULL;
+    if (node->opts->pipeline > 1)
+    {
+        pipeline = worker_pipeline_start(worker, (size_t)node->opts->pipeline);
+        if (!pipeline) return NULL;
+
+        if (0 == worker->id)
+        {
+            NODE_INFO("Keeping up to %zu transactions in flight per master%s",
+                      pipeline->size, node_wsrep_certify_v1(node->wsrep) ? "" :
+                      " (provider does not support " WSREP_CERTIFY_V1
+                      ", transactions are ordered at the end of certification)");
+        }
+    }
+
     do
     {
         /* REPLICATION: we should not perform any local writes until the node
@@ -99,20 +635,46 @@ worker_master(void* send_ctx)
 
         /* REPLICATION: the node is now synced */
 
+        if (pipeline)
+        {
+            ret = worker_pipeline_run(pipeline);
+            continue;
+        }
+
         do
         {
-            ret = node_trx_execute(node->store,
-                                   wsrep,
-                                   worker->id,
-                                   (int)node->opts->operations);
+            wsrep_ws_handle_t ws_handle;
+
+            /* transaction restart keeps its scheduled start */
+            if (!retrying) start = worker_pacer_wait(&pacer);
+            retrying = true;
+
+            ret = node_trx_prepare(node->store, wsrep, worker->id,
+                                   (int)node->opts->operations, &ws_handle);
+            if (WSREP_TRX_FAIL == ret) // read view changed, trx rolled back
+            {
+                worker_backoff_retry(&backoff, true);
+                continue;
+            }
+
+            ret = node_trx_replicate(node->store, wsrep, NULL, worker->id,
+                                     &ws_handle, NULL);
+            if (WSREP_TRX_FAIL == ret) // certification failed, trx rolled back
+            {
+                worker_backoff_retry(&backoff, false);
+                continue;
+            }
+
+            worker_backoff_reset(&backoff);
+            if (WSREP_OK == ret) worker_latency_record(start);
+            retrying = false;
         }
-        while(WSREP_OK           == ret // success
-              || (WSREP_TRX_FAIL == ret // certification failed, trx rolled back
-                  && (usleep(10000),true)) // retry after short sleep
-            );
+        while(WSREP_OK == ret || WSREP_TRX_FAIL == ret);
     }
     while (WSREP_CONN_FAIL == ret); // provider in bad state (e.g. non-Primary)
 
+    if (pipeline) worker_pipeline_stop(pipeline);
+
     return NULL;
 }
 
@@ -63,4 +63,32 @@ node_worker_start(struct node_ctx*   ctx,
 extern void
 node_worker_stop(struct node_worker_pool* pool);
 
+/* cumulative local transaction retry counters of all master workers */
+struct node_worker_retry_stats
+{
+    long long rv_aborts;         // read view changed during execution
+    long long cert_aborts;       // certification failed
+    long long immediate_retries; // retried right away
+    long long backoff_retries;   // retried after backoff
+    long long backoff_time;      // total time spent in backoff, microseconds
+};
+
+extern void
+node_worker_retry_stats(struct node_worker_retry_stats* stats);
+
+/* number of buckets in the transaction latency histogram */
+#define NODE_WORKER_LATENCY_BUCKETS 304
+
+/**
+ * get cumulative histogram of local transaction latencies of all master
+ * workers: from the scheduled start of a transaction to its commit, including
+ * restarts */
+extern void
+node_worker_latency_stats(long long hist[NODE_WORKER_LATENCY_BUCKETS]);
+
+/**
+ * @return the upper bound of latency histogram bucket in microseconds */
+extern long long
+node_worker_latency_value(int bucket);
+
 #endif /* NODE_WORKER_H */
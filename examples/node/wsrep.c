@@ -29,6 +29,8 @@
 struct node_wsrep
 {
     wsrep_t* instance; // wsrep provider instance
+    wsrep_certify_fn_v1 certify_v1; // NULL if not supported by provider
+    wsrep_recv_batch_fn_v1 recv_batch_v1; // NULL if not supported by provider
 
     struct wsrep_view
     {
@@ -56,7 +58,9 @@ struct node_wsrep
 
 static struct node_wsrep s_wsrep =
 {
-    .instance = NULL,
+    .instance   = NULL,
+    .certify_v1 = NULL,
+    .recv_batch_v1 = NULL,
     .view =
     {
         .mtx          = PTHREAD_MUTEX_INITIALIZER,
@@ -329,6 +333,15 @@ node_wsrep_init(const struct node_options* const opts,
         return NULL;
     }
 
+    /* REPLICATION: certify() extension with a callback on ordering, optional */
+    void* const certify_v1 = wsrep_dlsym(s_wsrep.instance, WSREP_CERTIFY_V1);
+    *(void**)(&s_wsrep.certify_v1) = certify_v1;
+
+    /* REPLICATION: recv() extension delivering writesets in batches, optional */
+    void* const recv_batch_v1 =
+        wsrep_dlsym(s_wsrep.instance, WSREP_RECV_BATCH_V1);
+    *(void**)(&s_wsrep.recv_batch_v1) = recv_batch_v1;
+
     char base_addr[256];
     snprintf(base_addr, sizeof(base_addr) - 1, "%s:%ld",
              opts->base_host, opts->base_port);
@@ -477,3 +490,15 @@ node_wsrep_provider(struct node_wsrep* wsrep)
 {
     return wsrep->instance;
 }
+
+wsrep_certify_fn_v1
+node_wsrep_certify_v1(struct node_wsrep* wsrep)
+{
+    return wsrep->certify_v1;
+}
+
+wsrep_recv_batch_fn_v1
+node_wsrep_recv_batch_v1(struct node_wsrep* wsrep)
+{
+    return wsrep->recv_batch_v1;
+}
@@ -89,4 +89,16 @@ node_wsrep_connected_gtid(node_wsrep_t* wsrep, wsrep_gtid_t* gtid);
 extern wsrep_t*
 node_wsrep_provider(node_wsrep_t* wsrep);
 
+/**
+ * @return certify() call that notifies the caller when the writeset ordering
+ *         is guaranteed, or NULL if the provider does not support it */
+extern wsrep_certify_fn_v1
+node_wsrep_certify_v1(node_wsrep_t* wsrep);
+
+/**
+ * @return recv() call that delivers writesets to the applier in batches,
+ *         or NULL if the provider does not support it */
+extern wsrep_recv_batch_fn_v1
+node_wsrep_recv_batch_v1(node_wsrep_t* wsrep);
+
 #endif /* NODE_WSREP_H */
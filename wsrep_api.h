@@ -68,6 +68,13 @@ extern "C" {
 /*! Empty backend spec */
 #define WSREP_NONE "none"
 
+/*! Backend spec prefix to profile calls to the backend that follows it */
+#define WSREP_PROFILE_PREFIX "profile:"
+
+/*! Backend spec prefix to inject faults into calls to the backend that
+ *  follows it */
+#define WSREP_INJECT_PREFIX "inject:"
+
 
 /*!
  * @brief log severity levels, passed as first argument to log handler
@@ -1357,7 +1364,11 @@ struct wsrep_st {
  * @brief Loads wsrep library
  *
  * @param spec   path to wsrep library. If NULL or WSREP_NONE initializes dummy
- *               pass-through implementation.
+ *               pass-through implementation. If prefixed with
+ *               WSREP_PROFILE_PREFIX, loads the rest of the spec and wraps it
+ *               to record latency histograms of every call and callback.
+ *               If prefixed with WSREP_INJECT_PREFIX, wraps it to inject
+ *               delays and failures into the calls. See wsrep_interpose.c.
  * @param hptr   wsrep handle
  * @param log_cb callback to handle loader messages. Otherwise writes to stderr.
  *
@@ -1373,6 +1384,21 @@ int wsrep_load(const char* spec, wsrep_t** hptr, wsrep_log_cb_t log_cb);
  */
 void wsrep_unload(wsrep_t* hptr);
 
+/*!
+ * @brief Looks up an optional extension (like WSREP_CERTIFY_V1) exported by
+ * the provider.
+ *
+ * Same as dlsym() on hptr->dlh, but also finds extensions implemented by the
+ * built-in dummy provider and the interposer, which are not loaded from a
+ * library.
+ *
+ * @param hptr   wsrep handle
+ * @param symbol extension symbol name
+ *
+ * @return extension address or NULL if provider does not support it
+ */
+void* wsrep_dlsym(const wsrep_t* hptr, const char* symbol);
+
 /*!
  * A callback struct to pass on calls which may be required to
  * maintain sequential consistency enforced by the caller. The
@@ -1435,6 +1461,61 @@ typedef wsrep_status_t (*wsrep_certify_fn_v1)(wsrep_t* wsrep,
                                               const wsrep_seq_cb_t* seq_cb);
 #define WSREP_CERTIFY_V1 "wsrep_certify_v1"
 
+/*!
+ * @brief batched apply callback
+ *
+ * Same as wsrep_apply_cb_t, but delivers a number of writesets with
+ * consecutive seqnos at once. Writesets that failed certification have
+ * WSREP_FLAG_ROLLBACK set in their flags and only need to advance the GTID.
+ *
+ * The batch can be committed in a single commit order critical section:
+ * entered with the handle and meta of the first writeset and left with the
+ * handle and meta of the last one. Entering and leaving commit order for
+ * every writeset in turn is allowed as well.
+ *
+ * @param recv_ctx   receiver context pointer provided by the application
+ * @param ws_handles internal provider writeset handles
+ * @param flags      WSREP_FLAG_... flags of the writesets
+ * @param data       data buffers containing the writesets
+ * @param meta       transaction meta data of the writesets
+ * @param count      number of writesets in the batch, at least 1
+ * @param exit_loop  set to true to exit receive loop
+ *
+ * @return error code:
+ * @retval 0 - success
+ * @retval non-0 - application-specific error code
+ */
+typedef enum wsrep_cb_status (*wsrep_apply_batch_cb_t) (
+    void*                    recv_ctx,
+    const wsrep_ws_handle_t* ws_handles,
+    const uint32_t*          flags,
+    const wsrep_buf_t*       data,
+    const wsrep_trx_meta_t*  meta,
+    size_t                   count,
+    wsrep_bool_t*            exit_loop
+);
+
+/*!
+ * @brief Receives and processes replication events in batches.
+ *
+ * This is an extension to the original recv() call. All events other than
+ * writesets are delivered the same way, but writesets are passed to
+ * apply_batch_cb instead of apply_cb, up to max_batch at a time. Provider
+ * does not wait for a batch to fill: it is made of the writesets that are
+ * ready to be applied, so under low load batches consist of one writeset.
+ *
+ * @param wsrep          provider handle
+ * @param recv_ctx       receiver context
+ * @param apply_batch_cb callback to apply writeset batches
+ * @param max_batch      maximum number of writesets in a batch
+ */
+typedef wsrep_status_t (*wsrep_recv_batch_fn_v1)(
+    wsrep_t*               wsrep,
+    void*                  recv_ctx,
+    wsrep_apply_batch_cb_t apply_batch_cb,
+    size_t                 max_batch);
+#define WSREP_RECV_BATCH_V1 "wsrep_recv_batch_v1"
+
 #ifdef __cplusplus
 }
 #endif
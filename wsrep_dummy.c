@@ -14,19 +14,69 @@
    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
-/*! @file Dummy wsrep API implementation. */
+/*! @file Dummy wsrep API implementation.
+ *
+ * By default all calls are no-ops. With "dummy.mode=loopback" in provider
+ * options the dummy turns into a single node in-process provider: it orders
+ * writesets, certifies them against each other using appended keys, enforces
+ * commit order and delivers views and preordered writesets to recv() callers.
+ * This allows to exercise the application side of the API without a network
+ * and a real provider.
+ *
+ * With "dummy.mode=cluster" provider instances in the same process which
+ * connect to the same cluster name form a simulated cluster: they share
+ * a sequencer and a certification index, and each member receives writesets
+ * of the others (examples/cluster.c runs such a cluster). Every member is
+ * connected to the sequencer by a simulated link with latency, jitter and
+ * bandwidth set by its own options:
+ *
+ *   dummy.latency   - one way link latency, microseconds (RTT is twice that)
+ *   dummy.jitter    - maximum random deviation of latency, microseconds
+ *   dummy.bandwidth - link bandwidth, bytes per second, 0 - unlimited
+ *   dummy.seed      - seed of the jitter generator, for repeatable runs
+ *   dummy.fc_limit  - receive queue length which pauses replication in the
+ *                     whole cluster until it drops to a half, 0 - unlimited
+ *
+ * Links are simulated in loopback mode as well. State transfers are not
+ * supported: a member can join only with the state of the cluster or, if
+ * no writesets were ordered yet, with an undefined state.
+ *
+ * In both modes the dummy implements WSREP_RECV_BATCH_V1 extension (found
+ * with wsrep_dlsym()), delivering runs of writesets with consecutive seqnos
+ * which have arrived by the time of delivery as one batch. */
 
 #include "wsrep_api.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 
+/*! Number of certification index slots, must be a power of 2 */
+#define DUMMY_CERT_SLOTS     (1 << 18)
+/*! Number of commit order condition variables, must be a power of 2 */
+#define DUMMY_ORDER_SLOTS    64
+/*! Causal read timeout (seconds) used when sync_wait() is passed -1 */
+#define DUMMY_CAUSAL_TIMEOUT 30
+/*! Default receive queue length that triggers flow control */
+#define DUMMY_FC_LIMIT       16
+
+#define DUMMY_CAPS (WSREP_CAP_MULTI_MASTER | WSREP_CAP_CERTIFICATION | \
+                    WSREP_CAP_CAUSAL_READS | WSREP_CAP_PREORDERED    | \
+                    WSREP_CAP_SNAPSHOT)
+
+/*! Loopback or cluster member state, see dummy_loopback_create() */
+typedef struct dummy_loopback dummy_loopback_t;
+
 /*! Dummy backend context. */
 typedef struct wsrep_dummy
 {
     wsrep_log_cb_t log_fn;
     char* options;
+    bool trace;
+    dummy_loopback_t* lb; /*!< NULL unless in loopback or cluster mode */
 } wsrep_dummy_t;
 
 /* Get pointer to wsrep_dummy context from wsrep_t pointer */
@@ -35,11 +85,1032 @@ typedef struct wsrep_dummy
 /* Trace function usage a-la DBUG */
 #define WSREP_DBUG_ENTER(_w) do {                                       \
         if (WSREP_DUMMY(_w)) {                                          \
-            if (WSREP_DUMMY(_w)->log_fn)                                \
+            if (WSREP_DUMMY(_w)->log_fn && WSREP_DUMMY(_w)->trace)      \
                 WSREP_DUMMY(_w)->log_fn(WSREP_LOG_DEBUG, __FUNCTION__); \
         }                                                               \
     } while (0)
 
+static void dummy_log(wsrep_t* w, wsrep_log_level_t level,
+                      const char* fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void dummy_log(wsrep_t* w, wsrep_log_level_t level,
+                      const char* fmt, ...)
+{
+    if (!WSREP_DUMMY(w)->log_fn) return;
+
+    char msg[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    WSREP_DUMMY(w)->log_fn(level, msg);
+}
+
+/*!
+ * Finds value of the option key in "key1 = value1; key2 = value2" string.
+ *
+ * @return pointer to the value, its length is stored in len, or NULL if
+ *         there is no such key
+ */
+static const char* dummy_option_find(const char* opts, const char* key,
+                                     size_t* len)
+{
+    size_t const key_len = strlen(key);
+
+    while (opts && *opts)
+    {
+        while (*opts == ' ' || *opts == ';') opts++;
+
+        const char* const end = opts + strcspn(opts, ";");
+        const char* const eq  = memchr(opts, '=', (size_t)(end - opts));
+
+        if (eq)
+        {
+            const char* k_end = eq;
+            while (k_end > opts && k_end[-1] == ' ') k_end--;
+
+            if ((size_t)(k_end - opts) == key_len &&
+                !strncmp(opts, key, key_len))
+            {
+                const char* val     = eq + 1;
+                const char* val_end = end;
+                while (val < val_end && *val == ' ') val++;
+                while (val_end > val && val_end[-1] == ' ') val_end--;
+
+                *len = (size_t)(val_end - val);
+                return val;
+            }
+        }
+
+        opts = end;
+    }
+
+    return NULL;
+}
+
+/*! @return non-negative integer value of the option key or def if the key
+ *          is not found or its value is not a non-negative integer */
+static int64_t dummy_option_int(const char* opts, const char* key,
+                                int64_t def)
+{
+    size_t len;
+    const char* const val = dummy_option_find(opts, key, &len);
+    if (!val || len == 0) return def;
+
+    int64_t ret = 0;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        if (val[i] < '0' || val[i] > '9') return def;
+        ret = ret * 10 + (val[i] - '0');
+    }
+
+    return ret;
+}
+
+/*
+ * Loopback and cluster modes
+ */
+
+/*! Reference counted data buffer, shared by the events of all members */
+struct dummy_buf
+{
+    int    refs;
+    size_t len;
+    char   data[];
+};
+
+static void dummy_buf_release(struct dummy_buf* buf)
+{
+    if (buf && 0 == __atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL))
+        free(buf);
+}
+
+/*! Appends data to the buffer of the given capacity, allocating it if NULL */
+static int dummy_buf_append(struct dummy_buf** buf, size_t* size,
+                            const wsrep_buf_t* data, size_t count)
+{
+    size_t len = *buf ? (*buf)->len : 0;
+    size_t i;
+    for (i = 0; i < count; i++) len += data[i].len;
+
+    if (!*buf || len > *size)
+    {
+        size_t new_size = *size ? *size : 256;
+        while (new_size < len) new_size *= 2;
+
+        struct dummy_buf* const tmp =
+            realloc(*buf, sizeof(struct dummy_buf) + new_size);
+        if (!tmp) return -ENOMEM;
+
+        if (!*buf)
+        {
+            tmp->refs = 1;
+            tmp->len  = 0;
+        }
+        *buf  = tmp;
+        *size = new_size;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        memcpy((*buf)->data + (*buf)->len, data[i].ptr, data[i].len);
+        (*buf)->len += data[i].len;
+    }
+
+    return 0;
+}
+
+/*! Certification key: hash of the key parts and key type */
+struct dummy_key
+{
+    uint64_t         hash;
+    wsrep_key_type_t type;
+};
+
+/*! Provider transaction context stored in ws_handle->opaque */
+struct dummy_trx
+{
+    wsrep_seqno_t     last_seen; /*!< last seqno committed before trx start */
+    wsrep_seqno_t     seqno;     /*!< WSREP_SEQNO_UNDEFINED until ordered */
+    bool              local;     /*!< allocated for a local transaction */
+    bool              entered;   /*!< commit order was entered */
+    bool              left;      /*!< commit order was left */
+    wsrep_seqno_t     batch;     /*!< first seqno of the delivered batch */
+    struct dummy_key* keys;
+    size_t            keys_num;
+    size_t            keys_size;
+    size_t            data_len;
+    struct dummy_buf* data;      /*!< copy of the data in cluster mode */
+    size_t            data_size;
+};
+
+typedef enum dummy_event_type
+{
+    DUMMY_EVENT_VIEW,
+    DUMMY_EVENT_SYNCED,
+    DUMMY_EVENT_WRITESET
+} dummy_event_type_t;
+
+/*! An event queued for delivery by recv() */
+struct dummy_event
+{
+    struct dummy_event* next;
+    dummy_event_type_t  type;
+    /*! primary views and writesets occupy this position in commit order,
+     *  other events are delivered after it was committed */
+    wsrep_seqno_t       seqno;
+    uint64_t            deliver_at; /*!< arrival time over simulated link */
+    wsrep_view_info_t*  view;
+    struct dummy_trx    trx;   /*!< writeset commit order state */
+    wsrep_trx_meta_t    meta;
+    uint32_t            flags;
+    struct dummy_buf*   data;  /*!< reference held by the event */
+};
+
+/*! Preordered writeset being collected, stored in po_handle->opaque */
+struct dummy_po
+{
+    struct dummy_buf* data;
+    size_t            size;
+};
+
+/*! Simulated link between a member and the sequencer */
+struct dummy_link
+{
+    uint64_t latency;   /*!< ns */
+    uint64_t jitter;    /*!< ns */
+    uint64_t bandwidth; /*!< bytes per second, 0 - unlimited */
+    uint64_t up_busy;   /*!< time until which the link is busy sending */
+    uint64_t down_busy; /*!< time until which the link is busy receiving */
+    uint64_t seed;      /*!< jitter generator state */
+};
+
+/*! Group of members sharing the sequencer and certification index.
+ *  Loopback mode uses a private group, cluster mode - a named one. */
+struct dummy_group
+{
+    pthread_mutex_t     mtx;
+    pthread_cond_t      fc_cond;    /*!< flow control released */
+    struct dummy_group* next;       /*!< in the list of named groups */
+    char*               name;       /*!< NULL for a private group */
+    int                 refs;       /*!< protected by dummy_groups_mtx */
+
+    wsrep_uuid_t        uuid;
+    wsrep_seqno_t       last;       /*!< sequencer: last assigned seqno */
+    wsrep_seqno_t       view_no;
+    bool                history;    /*!< writesets were ordered */
+
+    dummy_loopback_t**  members;    /*!< connected members */
+    int                 members_num;
+
+    int                 fc_members; /*!< members with long receive queues */
+    uint64_t            fc_since;
+    uint64_t            fc_paused;  /*!< ns */
+
+    /* certification index: seqnos of the last writes by key hash slot.
+     * Collisions can only cause false conflicts, never miss a real one. */
+    wsrep_seqno_t*      cert_write; /*!< UPDATE and EXCLUSIVE keys */
+    wsrep_seqno_t*      cert_excl;  /*!< EXCLUSIVE keys */
+};
+
+static pthread_mutex_t     dummy_groups_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct dummy_group* dummy_groups     = NULL;
+
+struct dummy_loopback
+{
+    pthread_mutex_t mtx;
+    pthread_cond_t  recv_cond;  /*!< event queued or connection closed */
+    pthread_cond_t  sync_cond;  /*!< committed advanced with sync waiters */
+    pthread_cond_t  order_cond[DUMMY_ORDER_SLOTS]; /*!< by seqno */
+    int             sync_waiters;
+
+    /* init arguments */
+    void*                  app_ctx;
+    char*                  node_name;
+    char*                  node_incoming;
+    int                    proto_ver;
+    wsrep_connected_cb_t   connected_cb;
+    wsrep_view_cb_t        view_cb;
+    wsrep_apply_cb_t       apply_cb;
+    wsrep_synced_cb_t      synced_cb;
+
+    bool                cluster;    /*!< cluster mode */
+    struct dummy_group* group;      /*!< NULL until connect in cluster mode */
+    struct dummy_link   link;       /*!< protected by group->mtx */
+    int64_t             fc_limit;
+
+    wsrep_uuid_t    node_id;
+    wsrep_uuid_t    group_id;   /*!< history of this member */
+    wsrep_seqno_t   last;       /*!< last seqno for this member, group->mtx */
+    wsrep_seqno_t   committed;  /*!< last seqno that left commit order */
+    wsrep_seqno_t   entered;    /*!< seqno in commit order, 0 if none */
+    bool            connected;  /*!< protected by both mutexes */
+    bool            joined;     /*!< primary view was delivered */
+
+    struct dummy_event*  head;
+    struct dummy_event** tail;
+    int64_t              queue_len;
+    bool                 fc_on;  /*!< queue_len exceeded fc_limit */
+
+    int64_t         replicated;
+    int64_t         replicated_bytes;
+    int64_t         received;
+    int64_t         received_bytes;
+    int64_t         cert_failures;
+};
+
+#define DUMMY_LB(_w) (WSREP_DUMMY(_w)->lb)
+
+static inline uint64_t dummy_mix64(uint64_t x)
+{
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/*! Generates random (version 4) UUID */
+static void dummy_uuid_generate(wsrep_uuid_t* uuid)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    uint64_t const t = (uint64_t)ts.tv_sec * 1000000000ULL +
+        (uint64_t)ts.tv_nsec;
+    uint64_t const s = ((uint64_t)getpid() << 32) ^ (uint64_t)(uintptr_t)uuid;
+    uint64_t const h[2] = { dummy_mix64(t ^ dummy_mix64(s)),
+                            dummy_mix64(s ^ dummy_mix64(t)) };
+    memcpy(uuid->data, h, sizeof(uuid->data));
+
+    uuid->data[6] = (uint8_t)((uuid->data[6] & 0x0f) | 0x40);
+    uuid->data[8] = (uint8_t)((uuid->data[8] & 0x3f) | 0x80);
+}
+
+/*! @return monotonic time in nanoseconds */
+static uint64_t dummy_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static struct timespec dummy_timespec(uint64_t ns)
+{
+    struct timespec const ts = { (time_t)(ns / 1000000000ULL),
+                                 (long)(ns % 1000000000ULL) };
+    return ts;
+}
+
+static void dummy_sleep_until(uint64_t t)
+{
+    struct timespec const ts = dummy_timespec(t);
+    while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+}
+
+/*!
+ * Sends size bytes over the link in one direction starting at now: the
+ * message waits for the link to transmit the preceding ones and then
+ * travels for latency +/- jitter. Must be called under group->mtx.
+ *
+ * @return arrival time, 0 if the link is not simulated
+ */
+static uint64_t dummy_link_send(struct dummy_link* link, uint64_t* busy,
+                                uint64_t now, size_t size)
+{
+    if (!link->latency && !link->jitter && !link->bandwidth) return 0;
+
+    uint64_t const start = *busy > now ? *busy : now;
+    uint64_t const tx = link->bandwidth ?
+        (uint64_t)size * 1000000000ULL / link->bandwidth : 0;
+    *busy = start + tx;
+
+    uint64_t latency = link->latency;
+    if (link->jitter)
+    {
+        link->seed += 0x9e3779b97f4a7c15ULL;
+        uint64_t const r = dummy_mix64(link->seed) % (2 * link->jitter + 1);
+        latency = latency + r > link->jitter ? latency + r - link->jitter : 0;
+    }
+
+    return start + tx + latency;
+}
+
+static void dummy_event_free(struct dummy_event* ev)
+{
+    free(ev->view);
+    dummy_buf_release(ev->data);
+    free(ev);
+}
+
+static void dummy_group_put(struct dummy_group* g)
+{
+    pthread_mutex_lock(&dummy_groups_mtx);
+
+    bool const last = (0 == --g->refs);
+    if (last && g->name)
+    {
+        struct dummy_group** p = &dummy_groups;
+        while (*p != g) p = &(*p)->next;
+        *p = g->next;
+    }
+
+    pthread_mutex_unlock(&dummy_groups_mtx);
+
+    if (!last) return;
+
+    pthread_cond_destroy(&g->fc_cond);
+    pthread_mutex_destroy(&g->mtx);
+    free(g->cert_excl);
+    free(g->cert_write);
+    free(g->members);
+    free(g->name);
+    free(g);
+}
+
+/*!
+ * Finds named group or creates a new one, private if name is NULL.
+ *
+ * @return referenced group or NULL if out of memory
+ */
+static struct dummy_group* dummy_group_get(const char* name)
+{
+    pthread_mutex_lock(&dummy_groups_mtx);
+
+    struct dummy_group* g = dummy_groups;
+    while (name && g && strcmp(g->name, name)) g = g->next;
+
+    if (name && g)
+    {
+        g->refs++;
+        pthread_mutex_unlock(&dummy_groups_mtx);
+        return g;
+    }
+
+    g = calloc(1, sizeof(*g));
+    if (g)
+    {
+        pthread_mutex_init(&g->mtx, NULL);
+        pthread_cond_init(&g->fc_cond, NULL);
+        g->refs       = 1;
+        g->name       = name ? strdup(name) : NULL;
+        g->cert_write = calloc(DUMMY_CERT_SLOTS, sizeof(wsrep_seqno_t));
+        g->cert_excl  = calloc(DUMMY_CERT_SLOTS, sizeof(wsrep_seqno_t));
+
+        if ((name && !g->name) || !g->cert_write || !g->cert_excl)
+        {
+            pthread_mutex_unlock(&dummy_groups_mtx);
+            g->name = NULL; /* not linked */
+            dummy_group_put(g);
+            return NULL;
+        }
+
+        if (name)
+        {
+            g->next = dummy_groups;
+            dummy_groups = g;
+        }
+    }
+
+    pthread_mutex_unlock(&dummy_groups_mtx);
+
+    return g;
+}
+
+static void dummy_loopback_destroy(dummy_loopback_t* lb)
+{
+    while (lb->head)
+    {
+        struct dummy_event* const ev = lb->head;
+        lb->head = ev->next;
+        dummy_event_free(ev);
+    }
+
+    if (lb->group) dummy_group_put(lb->group);
+
+    int i;
+    for (i = 0; i < DUMMY_ORDER_SLOTS; i++)
+        pthread_cond_destroy(&lb->order_cond[i]);
+    pthread_cond_destroy(&lb->sync_cond);
+    pthread_cond_destroy(&lb->recv_cond);
+    pthread_mutex_destroy(&lb->mtx);
+
+    free(lb->node_incoming);
+    free(lb->node_name);
+    free(lb);
+}
+
+static dummy_loopback_t* dummy_loopback_create(
+    const struct wsrep_init_args* args, bool cluster)
+{
+    dummy_loopback_t* const lb = calloc(1, sizeof(*lb));
+    if (!lb) return NULL;
+
+    pthread_mutex_init(&lb->mtx, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); /* see dummy_now() */
+    pthread_cond_init(&lb->recv_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&lb->sync_cond, NULL);
+    int i;
+    for (i = 0; i < DUMMY_ORDER_SLOTS; i++)
+        pthread_cond_init(&lb->order_cond[i], NULL);
+
+    lb->app_ctx       = args->app_ctx;
+    lb->node_name     = strdup(args->node_name ? args->node_name : "");
+    lb->node_incoming = strdup(args->node_incoming ? args->node_incoming : "");
+    lb->proto_ver     = args->proto_ver;
+    lb->connected_cb  = args->connected_cb;
+    lb->view_cb       = args->view_cb;
+    lb->apply_cb      = args->apply_cb;
+    lb->synced_cb     = args->synced_cb;
+
+    const char* const opts = args->options;
+    lb->cluster        = cluster;
+    lb->link.latency   = (uint64_t)dummy_option_int(opts, "dummy.latency",0)*1000;
+    lb->link.jitter    = (uint64_t)dummy_option_int(opts, "dummy.jitter", 0)*1000;
+    lb->link.bandwidth = (uint64_t)dummy_option_int(opts, "dummy.bandwidth", 0);
+    lb->link.seed      = (uint64_t)dummy_option_int(opts, "dummy.seed", 0);
+    lb->fc_limit       = dummy_option_int(opts, "dummy.fc_limit",DUMMY_FC_LIMIT);
+
+    /* continue the history of the application state, if any */
+    if (args->state_id)
+    {
+        lb->group_id = args->state_id->uuid;
+        lb->last = args->state_id->seqno > 0 ? args->state_id->seqno : 0;
+    }
+    lb->committed = lb->last;
+    dummy_uuid_generate(&lb->node_id);
+
+    lb->tail = &lb->head;
+
+    if (!cluster) lb->group = dummy_group_get(NULL);
+
+    if (!lb->node_name || !lb->node_incoming || (!cluster && !lb->group))
+    {
+        dummy_loopback_destroy(lb);
+        return NULL;
+    }
+
+    return lb;
+}
+
+/*! Appends event to the member recv() queue, must be called under
+ *  group->mtx */
+static void dummy_event_push(struct dummy_group* g, dummy_loopback_t* m,
+                             struct dummy_event* ev)
+{
+    pthread_mutex_lock(&m->mtx);
+
+    ev->next = NULL;
+    *m->tail = ev;
+    m->tail  = &ev->next;
+
+    if (++m->queue_len > m->fc_limit && m->fc_limit > 0 && !m->fc_on)
+    {
+        m->fc_on = true;
+        if (0 == g->fc_members++) g->fc_since = dummy_now();
+    }
+
+    pthread_cond_signal(&m->recv_cond);
+    pthread_mutex_unlock(&m->mtx);
+}
+
+/*! Clears member flow control flag, must be called under group->mtx */
+static void dummy_fc_clear(struct dummy_group* g, dummy_loopback_t* m)
+{
+    if (!m->fc_on) return;
+
+    m->fc_on = false;
+    if (0 == --g->fc_members)
+    {
+        g->fc_paused += dummy_now() - g->fc_since;
+        pthread_cond_broadcast(&g->fc_cond);
+    }
+}
+
+/*! Releases flow control once member queue is drained enough */
+static void dummy_fc_release(dummy_loopback_t* lb)
+{
+    struct dummy_group* const g = lb->group;
+
+    pthread_mutex_lock(&g->mtx);
+    pthread_mutex_lock(&lb->mtx);
+    if (lb->queue_len <= lb->fc_limit / 2) dummy_fc_clear(g, lb);
+    pthread_mutex_unlock(&lb->mtx);
+    pthread_mutex_unlock(&g->mtx);
+}
+
+/*! Waits while flow control is on, must be called under group->mtx */
+static void dummy_fc_wait(struct dummy_group* g, dummy_loopback_t* lb)
+{
+    while (g->fc_members > 0 && lb->connected)
+        pthread_cond_wait(&g->fc_cond, &g->mtx);
+}
+
+/*! Creates a view event for member self: primary view lists all connected
+ *  group members, other views - none. Must be called under group->mtx. */
+static struct dummy_event* dummy_view_event(struct dummy_group* g,
+                                            const dummy_loopback_t* self,
+                                            wsrep_view_status_t status,
+                                            wsrep_seqno_t seqno)
+{
+    int const memb_num = WSREP_VIEW_PRIMARY == status ? g->members_num : 0;
+
+    struct dummy_event* const ev = calloc(1, sizeof(*ev));
+    size_t const view_size = sizeof(wsrep_view_info_t) +
+        (size_t)(memb_num > 1 ? memb_num - 1 : 0) * sizeof(wsrep_member_info_t);
+    wsrep_view_info_t* const view = calloc(1, view_size);
+
+    if (!ev || !view)
+    {
+        free(view);
+        free(ev);
+        return NULL;
+    }
+
+    view->state_id.uuid  = g->uuid;
+    view->state_id.seqno = seqno;
+    view->view           = WSREP_VIEW_PRIMARY == status ? g->view_no : -1;
+    view->status         = status;
+    view->capabilities   = WSREP_VIEW_PRIMARY == status ?
+        (wsrep_cap_t)DUMMY_CAPS : 0;
+    view->my_idx         = -1;
+    view->memb_num       = memb_num;
+    view->proto_ver      = self->proto_ver;
+
+    int i;
+    for (i = 0; i < memb_num; i++)
+    {
+        const dummy_loopback_t* const m = g->members[i];
+        wsrep_member_info_t* const info = &view->members[i];
+
+        info->id = m->node_id;
+        strncpy(info->name, m->node_name, sizeof(info->name) - 1);
+        strncpy(info->incoming, m->node_incoming, sizeof(info->incoming) - 1);
+        if (m == self) view->my_idx = i;
+    }
+
+    ev->type  = DUMMY_EVENT_VIEW;
+    ev->seqno = seqno;
+    ev->view  = view;
+
+    return ev;
+}
+
+/*! Orders a new primary view and queues it to all members.
+ *  Must be called under group->mtx. */
+static int dummy_view_change(struct dummy_group* g)
+{
+    struct dummy_event* evs[g->members_num > 0 ? g->members_num : 1];
+    wsrep_seqno_t const seqno = g->last + 1;
+    int i;
+
+    g->view_no++;
+    for (i = 0; i < g->members_num; i++)
+    {
+        evs[i] = dummy_view_event(g, g->members[i], WSREP_VIEW_PRIMARY, seqno);
+        if (!evs[i])
+        {
+            while (i--) dummy_event_free(evs[i]);
+            g->view_no--;
+            return -ENOMEM;
+        }
+    }
+
+    g->last = seqno;
+
+    uint64_t const now = dummy_now();
+    for (i = 0; i < g->members_num; i++)
+    {
+        dummy_loopback_t* const m = g->members[i];
+        evs[i]->deliver_at = dummy_link_send(&m->link, &m->link.down_busy,
+                                             now, 0);
+        m->last = seqno;
+        dummy_event_push(g, m, evs[i]);
+    }
+
+    return 0;
+}
+
+/*! Waits until seqno can enter commit order, must be called under lb->mtx */
+static void dummy_order_wait(dummy_loopback_t* lb, wsrep_seqno_t seqno)
+{
+    pthread_cond_t* const cond =
+        &lb->order_cond[(size_t)seqno & (DUMMY_ORDER_SLOTS - 1)];
+
+    while (lb->committed < seqno - 1) pthread_cond_wait(cond, &lb->mtx);
+}
+
+static wsrep_status_t dummy_order_enter(dummy_loopback_t* lb,
+                                        wsrep_seqno_t seqno)
+{
+    pthread_mutex_lock(&lb->mtx);
+    dummy_order_wait(lb, seqno);
+    bool const ok = lb->committed == seqno - 1 && lb->entered != seqno;
+    if (ok) lb->entered = seqno;
+    pthread_mutex_unlock(&lb->mtx);
+
+    return ok ? WSREP_OK : WSREP_NODE_FAIL;
+}
+
+/*! Leaves commit order for seqnos from first to seqno inclusive, commit order
+ *  must have been entered with first */
+static wsrep_status_t dummy_order_leave(dummy_loopback_t* lb,
+                                        wsrep_seqno_t first,
+                                        wsrep_seqno_t seqno)
+{
+    pthread_mutex_lock(&lb->mtx);
+
+    bool const ok = lb->entered == first && lb->committed == first - 1;
+    if (ok)
+    {
+        lb->entered   = 0;
+        lb->committed = seqno;
+        pthread_cond_broadcast(
+            &lb->order_cond[(size_t)(seqno + 1) & (DUMMY_ORDER_SLOTS - 1)]);
+        if (lb->sync_waiters) pthread_cond_broadcast(&lb->sync_cond);
+    }
+
+    pthread_mutex_unlock(&lb->mtx);
+
+    return ok ? WSREP_OK : WSREP_NODE_FAIL;
+}
+
+/*! Makes sure that ordered trx has passed commit order, so that it does not
+ *  stall the following ones */
+static void dummy_trx_finish(wsrep_t* w, struct dummy_trx* trx)
+{
+    if (trx->seqno <= 0 || trx->left) return;
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+
+    if (trx->batch > 0) {
+        /* the batch may have left commit order with its last writeset */
+        pthread_mutex_lock(&lb->mtx);
+        bool const committed = lb->committed >= trx->seqno;
+        pthread_mutex_unlock(&lb->mtx);
+
+        if (committed) {
+            trx->entered = trx->left = true;
+            return;
+        }
+    }
+
+    wsrep_status_t ret = WSREP_OK;
+    if (!trx->entered) ret = dummy_order_enter(lb, trx->seqno);
+    if (!ret) ret = dummy_order_leave(lb, trx->seqno, trx->seqno);
+    trx->entered = trx->left = true;
+
+    if (ret) {
+        dummy_log(w, WSREP_LOG_ERROR,
+                  "Failed to pass commit order on behalf of %lld: %d",
+                  (long long)trx->seqno, (int)ret);
+    }
+}
+
+/*!
+ * Waits until seqno is committed or deadline (if any) passes.
+ * Must be called under lb->mtx.
+ *
+ * @return true if seqno was committed
+ */
+static bool dummy_wait_committed(dummy_loopback_t* lb, wsrep_seqno_t seqno,
+                                 const struct timespec* deadline)
+{
+    lb->sync_waiters++;
+    while (lb->committed < seqno)
+    {
+        if (deadline)
+        {
+            if (ETIMEDOUT ==
+                pthread_cond_timedwait(&lb->sync_cond, &lb->mtx, deadline))
+                break;
+        }
+        else
+        {
+            pthread_cond_wait(&lb->sync_cond, &lb->mtx);
+        }
+    }
+    lb->sync_waiters--;
+
+    return lb->committed >= seqno;
+}
+
+/*! Returns trx context associated with ws_handle, creating it if necessary.
+ *  Must not be called under lb->mtx. */
+static struct dummy_trx* dummy_trx_get(dummy_loopback_t* lb,
+                                       wsrep_ws_handle_t* ws_handle)
+{
+    struct dummy_trx* trx = ws_handle->opaque;
+    if (trx) return trx;
+
+    trx = calloc(1, sizeof(*trx));
+    if (!trx) return NULL;
+
+    pthread_mutex_lock(&lb->mtx);
+    trx->last_seen = lb->committed;
+    pthread_mutex_unlock(&lb->mtx);
+
+    trx->seqno = WSREP_SEQNO_UNDEFINED;
+    trx->local = true;
+    ws_handle->opaque = trx;
+
+    return trx;
+}
+
+/*! FNV-1a hash of the key parts, each part prefixed by its length */
+static uint64_t dummy_key_hash(const wsrep_key_t* key)
+{
+    uint64_t h = 14695981039346656037ULL;
+    size_t i, j;
+
+    for (i = 0; i < key->key_parts_num; i++)
+    {
+        const wsrep_buf_t* const part = &key->key_parts[i];
+        const uint8_t* const ptr = part->ptr;
+        uint64_t const len = part->len;
+
+        for (j = 0; j < sizeof(len); j++)
+        {
+            h ^= (uint8_t)(len >> (j * 8));
+            h *= 1099511628211ULL;
+        }
+        for (j = 0; j < part->len; j++)
+        {
+            h ^= ptr[j];
+            h *= 1099511628211ULL;
+        }
+    }
+
+    return h;
+}
+
+/*!
+ * Checks trx keys against writes ordered after trx->last_seen: SHARED keys
+ * conflict only with EXCLUSIVE writes, other keys with any writes. Must be
+ * called under group->mtx.
+ *
+ * @return true if trx passed certification
+ */
+static bool dummy_certify_keys(struct dummy_group* g, struct dummy_trx* trx)
+{
+    size_t i;
+    for (i = 0; i < trx->keys_num; i++)
+    {
+        const struct dummy_key* const k = &trx->keys[i];
+        size_t const slot = (size_t)k->hash & (DUMMY_CERT_SLOTS - 1);
+        wsrep_seqno_t const* const index =
+            WSREP_KEY_SHARED == k->type ? g->cert_excl : g->cert_write;
+
+        if (index[slot] > trx->last_seen) return false;
+    }
+
+    for (i = 0; i < trx->keys_num; i++)
+    {
+        const struct dummy_key* const k = &trx->keys[i];
+        size_t const slot = (size_t)k->hash & (DUMMY_CERT_SLOTS - 1);
+
+        if (k->type >= WSREP_KEY_UPDATE)    g->cert_write[slot] = trx->seqno;
+        if (k->type == WSREP_KEY_EXCLUSIVE) g->cert_excl[slot]  = trx->seqno;
+    }
+
+    return true;
+}
+
+/*!
+ * Queues ordered writeset to members other than src (all if NULL).
+ * Must be called under group->mtx.
+ *
+ * @return -ENOMEM if some member could not get the writeset
+ */
+static int dummy_writeset_send(struct dummy_group* g,
+                               const dummy_loopback_t* src,
+                               const wsrep_trx_meta_t* meta, uint32_t flags,
+                               struct dummy_buf* data)
+{
+    uint64_t const now = dummy_now();
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < g->members_num; i++)
+    {
+        dummy_loopback_t* const m = g->members[i];
+        if (m == src) continue;
+
+        struct dummy_event* const ev = calloc(1, sizeof(*ev));
+        if (!ev)
+        {
+            ret = -ENOMEM;
+            continue;
+        }
+
+        ev->type       = DUMMY_EVENT_WRITESET;
+        ev->seqno      = meta->gtid.seqno;
+        ev->deliver_at = dummy_link_send(&m->link, &m->link.down_busy, now,
+                                         data ? data->len : 0);
+        ev->trx.seqno  = meta->gtid.seqno;
+        ev->meta       = *meta;
+        ev->flags      = flags;
+        if (data)
+        {
+            __atomic_add_fetch(&data->refs, 1, __ATOMIC_RELAXED);
+            ev->data = data;
+        }
+
+        m->last = meta->gtid.seqno;
+        dummy_event_push(g, m, ev);
+    }
+
+    return ret;
+}
+
+/*!
+ * Delivers a single event to the application.
+ *
+ * @return WSREP_FATAL if application callback failed
+ */
+static wsrep_status_t dummy_event_deliver(wsrep_t* w, void* recv_ctx,
+                                          struct dummy_event* ev,
+                                          wsrep_bool_t* exit_loop)
+{
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    enum wsrep_cb_status cb = WSREP_CB_SUCCESS;
+
+    switch (ev->type)
+    {
+    case DUMMY_EVENT_VIEW:
+        if (WSREP_VIEW_PRIMARY == ev->view->status)
+        {
+            dummy_order_enter(lb, ev->seqno);
+            /* views are delivered in order, so this is race free */
+            if (lb->connected_cb && !lb->joined)
+                cb = lb->connected_cb(lb->app_ctx, ev->view);
+            lb->joined = true;
+            if (WSREP_CB_SUCCESS == cb && lb->view_cb)
+                cb = lb->view_cb(lb->app_ctx, recv_ctx, ev->view, NULL, 0);
+            dummy_order_leave(lb, ev->seqno, ev->seqno);
+        }
+        else
+        {
+            pthread_mutex_lock(&lb->mtx);
+            dummy_wait_committed(lb, ev->seqno, NULL);
+            pthread_mutex_unlock(&lb->mtx);
+            if (lb->view_cb)
+                cb = lb->view_cb(lb->app_ctx, recv_ctx, ev->view, NULL, 0);
+        }
+        break;
+    case DUMMY_EVENT_SYNCED:
+        pthread_mutex_lock(&lb->mtx);
+        dummy_wait_committed(lb, ev->seqno, NULL);
+        pthread_mutex_unlock(&lb->mtx);
+        if (lb->synced_cb) cb = lb->synced_cb(lb->app_ctx);
+        break;
+    case DUMMY_EVENT_WRITESET:
+    {
+        wsrep_ws_handle_t const ws_handle = { ev->meta.stid.trx, &ev->trx };
+        wsrep_buf_t const data =
+            { ev->data ? ev->data->data : NULL, ev->data ? ev->data->len : 0 };
+        if (lb->apply_cb)
+            cb = lb->apply_cb(recv_ctx, &ws_handle, ev->flags, &data,
+                              &ev->meta, exit_loop);
+        /* commit order is entered and left by the application normally */
+        dummy_trx_finish(w, &ev->trx);
+        break;
+    }
+    }
+
+    if (WSREP_CB_SUCCESS != cb)
+    {
+        dummy_log(w, WSREP_LOG_ERROR,
+                  "Application callback failed for event %lld: %d",
+                  (long long)ev->seqno, (int)cb);
+        return WSREP_FATAL;
+    }
+
+    return WSREP_OK;
+}
+
+/*! Arrays passed to the batched apply callback */
+struct dummy_batch
+{
+    wsrep_ws_handle_t* ws_handles;
+    uint32_t*          flags;
+    wsrep_buf_t*       data;
+    wsrep_trx_meta_t*  meta;
+};
+
+static int dummy_batch_init(struct dummy_batch* batch, size_t max)
+{
+    batch->ws_handles = malloc(max * sizeof(*batch->ws_handles));
+    batch->flags      = malloc(max * sizeof(*batch->flags));
+    batch->data       = malloc(max * sizeof(*batch->data));
+    batch->meta       = malloc(max * sizeof(*batch->meta));
+
+    return batch->ws_handles && batch->flags && batch->data && batch->meta ?
+        0 : -ENOMEM;
+}
+
+static void dummy_batch_destroy(struct dummy_batch* batch)
+{
+    free(batch->ws_handles);
+    free(batch->flags);
+    free(batch->data);
+    free(batch->meta);
+}
+
+/*!
+ * Delivers a run of writeset events linked through ev->next as one batch.
+ *
+ * @return WSREP_FATAL if application callback failed
+ */
+static wsrep_status_t dummy_batch_deliver(wsrep_t* w, void* recv_ctx,
+                                          wsrep_apply_batch_cb_t apply_batch_cb,
+                                          struct dummy_batch* batch,
+                                          struct dummy_event* evs,
+                                          wsrep_bool_t* exit_loop)
+{
+    struct dummy_event* ev;
+    size_t count = 0;
+
+    for (ev = evs; ev; ev = ev->next, count++)
+    {
+        ev->trx.batch = evs->seqno;
+        batch->ws_handles[count].trx_id = ev->meta.stid.trx;
+        batch->ws_handles[count].opaque = &ev->trx;
+        batch->flags[count]    = ev->flags;
+        batch->data[count].ptr = ev->data ? ev->data->data : NULL;
+        batch->data[count].len = ev->data ? ev->data->len : 0;
+        batch->meta[count]     = ev->meta;
+    }
+
+    enum wsrep_cb_status const cb =
+        apply_batch_cb(recv_ctx, batch->ws_handles, batch->flags, batch->data,
+                       batch->meta, count, exit_loop);
+
+    /* commit order is entered and left by the application normally */
+    for (ev = evs; ev; ev = ev->next) dummy_trx_finish(w, &ev->trx);
+
+    if (WSREP_CB_SUCCESS != cb)
+    {
+        dummy_log(w, WSREP_LOG_ERROR,
+                  "Application callback failed for events %lld-%lld: %d",
+                  (long long)evs->seqno, (long long)(evs->seqno + (int64_t)count
+                                                     - 1), (int)cb);
+        return WSREP_FATAL;
+    }
+
+    return WSREP_OK;
+}
+
+/*
+ * API implementation
+ */
+
+static wsrep_status_t dummy_disconnect(wsrep_t* w);
 
 static void dummy_free(wsrep_t *w)
 {
@@ -50,6 +1121,11 @@ static void dummy_free(wsrep_t *w)
         free(WSREP_DUMMY(w)->options);
         WSREP_DUMMY(w)->options = NULL;
     }
+    if (DUMMY_LB(w)) {
+        dummy_disconnect(w); /* leave the cluster if still there */
+        dummy_loopback_destroy(DUMMY_LB(w));
+        DUMMY_LB(w) = NULL;
+    }
     free(w->ctx);
     w->ctx = NULL;
 }
@@ -62,12 +1138,40 @@ static wsrep_status_t dummy_init (wsrep_t* w,
     if (args->options) {
         WSREP_DUMMY(w)->options = strdup(args->options);
     }
+
+    size_t len;
+    const char* const mode =
+        dummy_option_find(args->options, "dummy.mode", &len);
+
+    if (!mode || (len == 4 && !strncmp(mode, "noop", len)))
+        return WSREP_OK;
+
+    bool const cluster = (len == 7 && !strncmp(mode, "cluster", len));
+
+    if (!cluster && (len != 8 || strncmp(mode, "loopback", len))) {
+        dummy_log(w, WSREP_LOG_ERROR, "Unknown dummy.mode: '%.*s'",
+                  (int)len, mode);
+        return WSREP_NODE_FAIL;
+    }
+
+    if (!(DUMMY_LB(w) = dummy_loopback_create(args, cluster))) {
+        dummy_log(w, WSREP_LOG_ERROR, "Failed to allocate loopback context");
+        return WSREP_FATAL;
+    }
+
+    /* tracing every call would dominate loopback benchmarks */
+    WSREP_DUMMY(w)->trace = false;
+    dummy_log(w, WSREP_LOG_INFO, "Dummy provider in %s mode",
+              cluster ? "cluster" : "loopback");
+
     return WSREP_OK;
 }
 
-static wsrep_cap_t dummy_capabilities (wsrep_t* w __attribute__((unused)))
+static wsrep_cap_t dummy_capabilities (wsrep_t* w)
 {
-    return 0;
+    if (!w->ctx || !DUMMY_LB(w)) return 0;
+
+    return (wsrep_cap_t)DUMMY_CAPS;
 }
 
 static wsrep_status_t dummy_options_set(
@@ -101,72 +1205,435 @@ static wsrep_status_t dummy_enc_set_key(
 
 static wsrep_status_t dummy_connect(
     wsrep_t* w,
-    const char*  name      __attribute__((unused)),
+    const char*  name,
     const char*  url       __attribute__((unused)),
     const char*  donor     __attribute__((unused)),
     wsrep_bool_t bootstrap __attribute__((unused)))
 {
     WSREP_DBUG_ENTER(w);
-    return WSREP_OK;
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    if (lb->cluster && !lb->group &&
+        !(lb->group = dummy_group_get(name ? name : ""))) {
+        return WSREP_FATAL;
+    }
+
+    struct dummy_group* const g = lb->group;
+    wsrep_status_t ret = WSREP_OK;
+
+    pthread_mutex_lock(&g->mtx);
+
+    if (lb->connected) {
+        ret = WSREP_NOT_ALLOWED;
+        goto out;
+    }
+
+    /* the first member defines the group history, the others must share it
+     * as there is no state transfer */
+    bool const undefined =
+        !wsrep_uuid_compare(&lb->group_id, &WSREP_UUID_UNDEFINED);
+    bool const joining = g->members_num > 0;
+
+    if (!joining) {
+        if (undefined) dummy_uuid_generate(&lb->group_id);
+        g->uuid    = lb->group_id;
+        g->last    = lb->last;
+        g->history = false;
+    }
+    else if (!(undefined && !g->history) &&
+             (wsrep_uuid_compare(&lb->group_id, &g->uuid) ||
+              lb->committed != g->last)) {
+        dummy_log(w, WSREP_LOG_ERROR, "Can't join cluster '%s' at %lld: "
+                  "state transfer is not supported",
+                  name ? name : "", (long long)g->last);
+        ret = WSREP_NODE_FAIL;
+        goto out;
+    }
+
+    dummy_loopback_t** const members =
+        realloc(g->members, (size_t)(g->members_num + 1) * sizeof(*members));
+    struct dummy_event* const synced = calloc(1, sizeof(*synced));
+    if (members) g->members = members;
+    if (!members || !synced) {
+        free(synced);
+        ret = WSREP_FATAL;
+        goto out;
+    }
+
+    pthread_mutex_lock(&lb->mtx);
+    lb->group_id  = g->uuid;
+    if (joining) lb->committed = g->last;
+    lb->connected = true;
+    lb->joined    = false;
+    pthread_mutex_unlock(&lb->mtx);
+
+    g->members[g->members_num++] = lb;
+
+    /* view is a totally ordered event: it takes the next seqno */
+    if (dummy_view_change(g)) {
+        g->members_num--;
+        pthread_mutex_lock(&lb->mtx);
+        lb->connected = false;
+        pthread_mutex_unlock(&lb->mtx);
+        free(synced);
+        ret = WSREP_FATAL;
+        goto out;
+    }
+
+    /* without state transfer the node is synced right away */
+    synced->type  = DUMMY_EVENT_SYNCED;
+    synced->seqno = lb->last;
+    dummy_event_push(g, lb, synced);
+
+out:
+    pthread_mutex_unlock(&g->mtx);
+
+    return ret;
 }
 
 static wsrep_status_t dummy_disconnect(wsrep_t* w)
 {
     WSREP_DBUG_ENTER(w);
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb || !lb->group) return WSREP_OK;
+
+    struct dummy_group* const g = lb->group;
+
+    pthread_mutex_lock(&g->mtx);
+
+    if (lb->connected) {
+        int i;
+        for (i = 0; g->members[i] != lb; i++);
+        memmove(&g->members[i], &g->members[i + 1],
+                (size_t)(g->members_num - i - 1) * sizeof(g->members[0]));
+        g->members_num--;
+
+        /* remaining members are notified by the new view */
+        if (g->members_num > 0 && dummy_view_change(g)) {
+            dummy_log(w, WSREP_LOG_FATAL, "Failed to allocate view");
+            abort();
+        }
+
+        struct dummy_event* const ev =
+            dummy_view_event(g, lb, WSREP_VIEW_DISCONNECTED, lb->last);
+        if (ev) dummy_event_push(g, lb, ev);
+
+        pthread_mutex_lock(&lb->mtx);
+        lb->connected = false;
+        dummy_fc_clear(g, lb);
+        /* idle receivers return once the queue is drained */
+        pthread_cond_broadcast(&lb->recv_cond);
+        pthread_mutex_unlock(&lb->mtx);
+
+        /* wake up those waiting for flow control */
+        pthread_cond_broadcast(&g->fc_cond);
+    }
+
+    pthread_mutex_unlock(&g->mtx);
+
     return WSREP_OK;
 }
 
-static wsrep_status_t dummy_recv(wsrep_t* w,
-                                 void*    recv_ctx __attribute__((unused)))
+/*!
+ * Delivers events until connection is closed. If apply_batch_cb is given,
+ * writesets with consecutive seqnos that have arrived are delivered to it
+ * as a batch of up to max_batch.
+ */
+static wsrep_status_t dummy_recv_events(wsrep_t* w, void* recv_ctx,
+                                        wsrep_apply_batch_cb_t apply_batch_cb,
+                                        size_t max_batch)
+{
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    struct dummy_batch batch = { NULL, NULL, NULL, NULL };
+    if (apply_batch_cb && dummy_batch_init(&batch, max_batch)) {
+        dummy_batch_destroy(&batch);
+        dummy_log(w, WSREP_LOG_ERROR, "Failed to allocate batch of %zu",
+                  max_batch);
+        return WSREP_FATAL;
+    }
+
+    wsrep_status_t ret = WSREP_OK;
+
+    pthread_mutex_lock(&lb->mtx);
+
+    for (;;) {
+        struct dummy_event* ev = lb->head;
+
+        if (!ev) {
+            /* connection closed and all events delivered */
+            if (!lb->connected) break;
+            pthread_cond_wait(&lb->recv_cond, &lb->mtx);
+            continue;
+        }
+
+        uint64_t const now = dummy_now();
+        if (ev->deliver_at > now) {
+            /* still travelling over the simulated link */
+            struct timespec const ts = dummy_timespec(ev->deliver_at);
+            pthread_cond_timedwait(&lb->recv_cond, &lb->mtx, &ts);
+            continue;
+        }
+
+        struct dummy_event* last = ev;
+        int64_t count = 1;
+        if (apply_batch_cb && DUMMY_EVENT_WRITESET == ev->type) {
+            while ((size_t)count < max_batch && last->next &&
+                   DUMMY_EVENT_WRITESET == last->next->type &&
+                   last->next->seqno == last->seqno + 1 &&
+                   last->next->deliver_at <= now) {
+                last = last->next;
+                count++;
+            }
+        }
+
+        lb->head = last->next;
+        last->next = NULL;
+        if (!lb->head) lb->tail = &lb->head;
+        lb->queue_len -= count;
+        bool const fc_check =
+            lb->fc_on && lb->queue_len <= lb->fc_limit / 2;
+
+        if (DUMMY_EVENT_WRITESET == ev->type) {
+            struct dummy_event* e;
+            lb->received += count;
+            for (e = ev; e; e = e->next)
+                lb->received_bytes += e->data ? (int64_t)e->data->len : 0;
+        }
+
+        pthread_mutex_unlock(&lb->mtx);
+
+        if (fc_check) dummy_fc_release(lb);
+
+        wsrep_bool_t exit_loop = false;
+        if (apply_batch_cb && DUMMY_EVENT_WRITESET == ev->type)
+            ret = dummy_batch_deliver(w, recv_ctx, apply_batch_cb, &batch, ev,
+                                      &exit_loop);
+        else
+            ret = dummy_event_deliver(w, recv_ctx, ev, &exit_loop);
+
+        while (ev) {
+            struct dummy_event* const next = ev->next;
+            dummy_event_free(ev);
+            ev = next;
+        }
+
+        if (ret || exit_loop) goto out;
+
+        pthread_mutex_lock(&lb->mtx);
+    }
+
+    pthread_mutex_unlock(&lb->mtx);
+
+out:
+    dummy_batch_destroy(&batch);
+
+    return ret;
+}
+
+static wsrep_status_t dummy_recv(wsrep_t* w, void* recv_ctx)
 {
     WSREP_DBUG_ENTER(w);
-    return WSREP_OK;
+    return dummy_recv_events(w, recv_ctx, NULL, 0);
+}
+
+/*! WSREP_RECV_BATCH_V1 extension */
+static wsrep_status_t dummy_recv_batch(wsrep_t* w, void* recv_ctx,
+                                       wsrep_apply_batch_cb_t apply_batch_cb,
+                                       size_t max_batch)
+{
+    WSREP_DBUG_ENTER(w);
+    return dummy_recv_events(w, recv_ctx, apply_batch_cb,
+                             max_batch > 0 ? max_batch : 1);
 }
 
 static wsrep_status_t dummy_assign_read_view(
     wsrep_t* w,
-    wsrep_ws_handle_t*      ws_handle  __attribute__((unused)),
-    const wsrep_gtid_t*     rv         __attribute__((unused)))
+    wsrep_ws_handle_t*      ws_handle,
+    const wsrep_gtid_t*     rv)
 {
     WSREP_DBUG_ENTER(w);
-    return WSREP_OK;
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    struct dummy_trx* const trx = dummy_trx_get(lb, ws_handle);
+    if (!trx) return WSREP_TRX_FAIL;
+
+    if (!rv) return WSREP_OK;
+
+    pthread_mutex_lock(&lb->mtx);
+    /* read view from a different history can't be certified */
+    bool const ok = !wsrep_uuid_compare(&rv->uuid, &lb->group_id);
+    pthread_mutex_unlock(&lb->mtx);
+
+    if (ok) trx->last_seen = rv->seqno;
+
+    return ok ? WSREP_OK : WSREP_TRX_FAIL;
 }
 
 static wsrep_status_t dummy_certify(
     wsrep_t* w,
-    const wsrep_conn_id_t   conn_id    __attribute__((unused)),
-    wsrep_ws_handle_t*      ws_handle  __attribute__((unused)),
+    const wsrep_conn_id_t   conn_id,
+    wsrep_ws_handle_t*      ws_handle,
     uint32_t                flags      __attribute__((unused)),
-    wsrep_trx_meta_t*       meta       __attribute__((unused)))
+    wsrep_trx_meta_t*       meta)
 {
     WSREP_DBUG_ENTER(w);
-    return WSREP_OK;
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    meta->gtid       = WSREP_GTID_UNDEFINED;
+    meta->depends_on = WSREP_SEQNO_UNDEFINED;
+    meta->stid.node  = lb->node_id;
+    meta->stid.trx   = ws_handle->trx_id;
+    meta->stid.conn  = conn_id;
+
+    struct dummy_trx* const trx = dummy_trx_get(lb, ws_handle);
+    if (!trx) return WSREP_TRX_FAIL;
+
+    struct dummy_group* const g = lb->group;
+    if (!g) return WSREP_CONN_FAIL;
+
+    pthread_mutex_lock(&g->mtx);
+
+    dummy_fc_wait(g, lb);
+
+    /* the writeset travels to the sequencer first */
+    uint64_t const arrival = lb->connected ?
+        dummy_link_send(&lb->link, &lb->link.up_busy, dummy_now(),
+                        trx->data_len) : 0;
+    if (arrival) {
+        pthread_mutex_unlock(&g->mtx);
+        dummy_sleep_until(arrival);
+        pthread_mutex_lock(&g->mtx);
+    }
+
+    if (!lb->connected) {
+        pthread_mutex_unlock(&g->mtx);
+        return WSREP_CONN_FAIL;
+    }
+
+    trx->seqno = ++g->last;
+    lb->last   = trx->seqno;
+    g->history = true;
+
+    bool const ok = dummy_certify_keys(g, trx);
+
+    meta->gtid.uuid  = g->uuid;
+    meta->gtid.seqno = trx->seqno;
+    meta->depends_on = trx->seqno - 1;
+
+    /* others need the writeset even if it failed, to skip its seqno */
+    if (dummy_writeset_send(g, lb, meta, ok ?
+                            WSREP_FLAG_TRX_START | WSREP_FLAG_TRX_END :
+                            WSREP_FLAG_ROLLBACK, ok ? trx->data : NULL)) {
+        dummy_log(w, WSREP_LOG_FATAL, "Failed to allocate writeset event");
+        abort();
+    }
+
+    /* ... and then back to this member, ordered */
+    uint64_t const ordered =
+        dummy_link_send(&lb->link, &lb->link.down_busy, dummy_now(),
+                        trx->data_len);
+
+    pthread_mutex_unlock(&g->mtx);
+
+    pthread_mutex_lock(&lb->mtx);
+    if (ok) {
+        lb->replicated++;
+        lb->replicated_bytes += (int64_t)trx->data_len;
+    }
+    else {
+        lb->cert_failures++;
+    }
+    pthread_mutex_unlock(&lb->mtx);
+
+    if (ordered) dummy_sleep_until(ordered);
+
+    return ok ? WSREP_OK : WSREP_TRX_FAIL;
 }
 
 static wsrep_status_t dummy_commit_order_enter(
     wsrep_t* w,
-    const wsrep_ws_handle_t* ws_handle  __attribute__((unused)),
-    const wsrep_trx_meta_t*  meta       __attribute__((unused)))
+    const wsrep_ws_handle_t* ws_handle,
+    const wsrep_trx_meta_t*  meta)
 {
     WSREP_DBUG_ENTER(w);
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    if (meta->gtid.seqno <= 0) return WSREP_TRX_MISSING;
+
+    wsrep_status_t const ret = dummy_order_enter(lb, meta->gtid.seqno);
+    if (ret) {
+        dummy_log(w, WSREP_LOG_ERROR, "Commit order entered twice by %lld",
+                  (long long)meta->gtid.seqno);
+        return ret;
+    }
+
+    struct dummy_trx* const trx = ws_handle->opaque;
+    if (trx) trx->entered = true;
+
     return WSREP_OK;
 }
 
 static wsrep_status_t dummy_commit_order_leave(
     wsrep_t* w,
-    const wsrep_ws_handle_t* ws_handle  __attribute__((unused)),
-    const wsrep_trx_meta_t*  meta       __attribute__((unused)),
+    const wsrep_ws_handle_t* ws_handle,
+    const wsrep_trx_meta_t*  meta,
     const wsrep_buf_t*       error      __attribute__((unused)))
 {
     WSREP_DBUG_ENTER(w);
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    if (meta->gtid.seqno <= 0) return WSREP_TRX_MISSING;
+
+    /* a batch may leave commit order at once with its last writeset */
+    struct dummy_trx* const trx = ws_handle->opaque;
+    wsrep_seqno_t const first =
+        trx && trx->batch > 0 ? trx->batch : meta->gtid.seqno;
+
+    wsrep_status_t const ret = dummy_order_leave(lb, first, meta->gtid.seqno);
+    if (ret) {
+        dummy_log(w, WSREP_LOG_ERROR,
+                  "Commit order left out of order or not entered by %lld",
+                  (long long)meta->gtid.seqno);
+        return ret;
+    }
+
+    if (trx) trx->left = true;
+
     return WSREP_OK;
 }
 
 static wsrep_status_t dummy_release(
     wsrep_t* w,
-    wsrep_ws_handle_t*  ws_handle  __attribute__((unused)))
+    wsrep_ws_handle_t*  ws_handle)
 {
     WSREP_DBUG_ENTER(w);
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    struct dummy_trx* const trx = ws_handle->opaque;
+    if (!trx || !trx->local) return WSREP_OK; /* appliers are freed in recv */
+
+    dummy_trx_finish(w, trx);
+
+    dummy_buf_release(trx->data);
+    free(trx->keys);
+    free(trx);
+    ws_handle->opaque = NULL;
+
     return WSREP_OK;
 }
 
@@ -200,43 +1667,122 @@ static wsrep_status_t dummy_rollback(
 
 static wsrep_status_t dummy_append_key(
     wsrep_t* w,
-    wsrep_ws_handle_t*     ws_handle  __attribute__((unused)),
-    const wsrep_key_t*     key        __attribute__((unused)),
-    const size_t           key_num    __attribute__((unused)),
-    const wsrep_key_type_t key_type   __attribute__((unused)),
+    wsrep_ws_handle_t*     ws_handle,
+    const wsrep_key_t*     key,
+    const size_t           key_num,
+    const wsrep_key_type_t key_type,
     const bool             copy       __attribute__((unused)))
 {
     WSREP_DBUG_ENTER(w);
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    struct dummy_trx* const trx = dummy_trx_get(lb, ws_handle);
+    if (!trx) return WSREP_TRX_FAIL;
+
+    /* keys are hashed right away, so they never need to be copied */
+    if (trx->keys_num + key_num > trx->keys_size) {
+        size_t size = trx->keys_size ? trx->keys_size : 16;
+        while (size < trx->keys_num + key_num) size *= 2;
+
+        struct dummy_key* const keys =
+            realloc(trx->keys, size * sizeof(*keys));
+        if (!keys) return WSREP_TRX_FAIL;
+
+        trx->keys      = keys;
+        trx->keys_size = size;
+    }
+
+    size_t i;
+    for (i = 0; i < key_num; i++) {
+        trx->keys[trx->keys_num].hash = dummy_key_hash(&key[i]);
+        trx->keys[trx->keys_num].type = key_type;
+        trx->keys_num++;
+    }
+
     return WSREP_OK;
 }
 
 static wsrep_status_t dummy_append_data(
     wsrep_t* w,
-    wsrep_ws_handle_t*      ws_handle  __attribute__((unused)),
-    const struct wsrep_buf* data       __attribute__((unused)),
-    const size_t            count      __attribute__((unused)),
+    wsrep_ws_handle_t*      ws_handle,
+    const struct wsrep_buf* data,
+    const size_t            count,
     const wsrep_data_type_t type       __attribute__((unused)),
     const bool              copy       __attribute__((unused)))
 {
     WSREP_DBUG_ENTER(w);
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    struct dummy_trx* const trx = dummy_trx_get(lb, ws_handle);
+    if (!trx) return WSREP_TRX_FAIL;
+
+    /* in loopback mode there is nobody to deliver local writesets to, only
+     * count them, in cluster mode the data must outlive the transaction */
+    if (lb->cluster &&
+        dummy_buf_append(&trx->data, &trx->data_size, data, count))
+        return WSREP_TRX_FAIL;
+
+    size_t i;
+    for (i = 0; i < count; i++) trx->data_len += data[i].len;
+
     return WSREP_OK;
 }
 
 static wsrep_status_t dummy_sync_wait(
     wsrep_t* w,
-    wsrep_gtid_t* upto __attribute__((unused)),
-    int           tout __attribute__((unused)),
-    wsrep_gtid_t* gtid __attribute__((unused)))
+    wsrep_gtid_t* upto,
+    int           tout,
+    wsrep_gtid_t* gtid)
 {
     WSREP_DBUG_ENTER(w);
-    return WSREP_OK;
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += tout < 0 ? DUMMY_CAUSAL_TIMEOUT : tout;
+
+    /* causal read: wait for everything ordered in the cluster so far */
+    wsrep_seqno_t target = upto ? upto->seqno : 0;
+    if (!upto && lb->group) {
+        pthread_mutex_lock(&lb->group->mtx);
+        target = lb->connected ? lb->group->last : lb->last;
+        pthread_mutex_unlock(&lb->group->mtx);
+    }
+
+    pthread_mutex_lock(&lb->mtx);
+
+    bool const ok = dummy_wait_committed(lb, target, &deadline);
+
+    if (gtid) {
+        gtid->uuid  = lb->group_id;
+        gtid->seqno = lb->committed;
+    }
+
+    pthread_mutex_unlock(&lb->mtx);
+
+    return ok ? WSREP_OK : WSREP_TRX_FAIL;
 }
 
 static wsrep_status_t dummy_last_committed_id(
     wsrep_t* w,
-    wsrep_gtid_t* gtid __attribute__((unused)))
+    wsrep_gtid_t* gtid)
 {
     WSREP_DBUG_ENTER(w);
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    pthread_mutex_lock(&lb->mtx);
+    gtid->uuid  = lb->group_id;
+    gtid->seqno = lb->committed;
+    pthread_mutex_unlock(&lb->mtx);
+
     return WSREP_OK;
 }
 
@@ -259,7 +1805,8 @@ static wsrep_status_t dummy_to_execute_start(
     wsrep_trx_meta_t*       meta    __attribute__((unused)))
 {
     WSREP_DBUG_ENTER(w);
-    return WSREP_OK;
+    /* total order isolation is not supported in loopback mode */
+    return DUMMY_LB(w) ? WSREP_NOT_IMPLEMENTED : WSREP_OK;
 }
 
 static wsrep_status_t dummy_to_execute_end(
@@ -268,30 +1815,96 @@ static wsrep_status_t dummy_to_execute_end(
     const wsrep_buf_t*     err       __attribute__((unused)))
 {
     WSREP_DBUG_ENTER(w);
-    return WSREP_OK;
+    return DUMMY_LB(w) ? WSREP_NOT_IMPLEMENTED : WSREP_OK;
 }
 
 static wsrep_status_t dummy_preordered_collect(
     wsrep_t*                 w,
-    wsrep_po_handle_t*       handle    __attribute__((unused)),
-    const struct wsrep_buf*  data      __attribute__((unused)),
-    size_t                   count     __attribute__((unused)),
+    wsrep_po_handle_t*       handle,
+    const struct wsrep_buf*  data,
+    size_t                   count,
     wsrep_bool_t             copy      __attribute__((unused)))
 {
     WSREP_DBUG_ENTER(w);
+
+    if (!DUMMY_LB(w)) return WSREP_OK;
+
+    struct dummy_po* po = handle->opaque;
+    if (!po) {
+        if (!(po = calloc(1, sizeof(*po)))) return WSREP_TRX_FAIL;
+        handle->opaque = po;
+    }
+
+    /* writeset is delivered after the call returns, so it is always copied */
+    if (dummy_buf_append(&po->data, &po->size, data, count))
+        return WSREP_TRX_FAIL;
+
     return WSREP_OK;
 }
 
 static wsrep_status_t dummy_preordered_commit(
     wsrep_t*                 w,
-    wsrep_po_handle_t*       handle    __attribute__((unused)),
-    const wsrep_uuid_t*      source_id __attribute__((unused)),
-    uint32_t                 flags     __attribute__((unused)),
-    int                      pa_range  __attribute__((unused)),
-    wsrep_bool_t             commit    __attribute__((unused)))
+    wsrep_po_handle_t*       handle,
+    const wsrep_uuid_t*      source_id,
+    uint32_t                 flags,
+    int                      pa_range,
+    wsrep_bool_t             commit)
 {
     WSREP_DBUG_ENTER(w);
-    return WSREP_OK;
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return WSREP_OK;
+
+    struct dummy_po* const po = handle->opaque;
+    handle->opaque = NULL;
+
+    wsrep_status_t ret = commit ? WSREP_TRX_FAIL : WSREP_OK;
+    struct dummy_group* const g = lb->group;
+
+    if (commit && g) {
+        pthread_mutex_lock(&g->mtx);
+
+        dummy_fc_wait(g, lb);
+
+        if (lb->connected) {
+            wsrep_seqno_t const seqno = ++g->last;
+            wsrep_seqno_t const deps  = seqno - 1 - (pa_range > 0 ? pa_range:0);
+
+            wsrep_trx_meta_t meta;
+            memset(&meta, 0, sizeof(meta));
+            meta.gtid.uuid  = g->uuid;
+            meta.gtid.seqno = seqno;
+            meta.stid.node  = *source_id;
+            meta.depends_on = deps > 0 ? deps : 0;
+
+            g->history = true;
+
+            /* preordered events are applied by all members, this one too */
+            if (dummy_writeset_send(g, NULL, &meta, flags |
+                                    WSREP_FLAG_TRX_START | WSREP_FLAG_TRX_END,
+                                    po ? po->data : NULL)) {
+                dummy_log(w, WSREP_LOG_FATAL,
+                          "Failed to allocate writeset event");
+                abort();
+            }
+
+            pthread_mutex_lock(&lb->mtx);
+            lb->replicated++;
+            lb->replicated_bytes += po && po->data ? (int64_t)po->data->len : 0;
+            pthread_mutex_unlock(&lb->mtx);
+
+            ret = WSREP_OK;
+        }
+
+        pthread_mutex_unlock(&g->mtx);
+    }
+
+    if (po) {
+        dummy_buf_release(po->data);
+        free(po);
+    }
+
+    return ret;
 }
 
 static wsrep_status_t dummy_sst_sent(
@@ -326,22 +1939,96 @@ static struct wsrep_stats_var dummy_stats[] = {
     { NULL, WSREP_VAR_STRING, { 0 } }
 };
 
+/*! Loopback mode stats, names follow those of Galera */
+enum {
+    DUMMY_STATS_REPLICATED,
+    DUMMY_STATS_REPLICATED_BYTES,
+    DUMMY_STATS_RECEIVED,
+    DUMMY_STATS_RECEIVED_BYTES,
+    DUMMY_STATS_CERT_FAILURES,
+    DUMMY_STATS_FC_PAUSED,
+    DUMMY_STATS_LAST_COMMITTED,
+    DUMMY_STATS_RECV_QUEUE,
+    DUMMY_STATS_CLUSTER_SIZE,
+    DUMMY_STATS_MAX
+};
+
+static const char* const dummy_stats_names[DUMMY_STATS_MAX] = {
+    "replicated",
+    "replicated_bytes",
+    "received",
+    "received_bytes",
+    "local_cert_failures",
+    "flow_control_paused_ns",
+    "last_committed",
+    "local_recv_queue",
+    "cluster_size"
+};
+
 static struct wsrep_stats_var* dummy_stats_get (wsrep_t* w)
 {
     WSREP_DBUG_ENTER(w);
-    return dummy_stats;
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return dummy_stats;
+
+    struct wsrep_stats_var* const stats =
+        calloc(DUMMY_STATS_MAX + 1, sizeof(*stats));
+    if (!stats) return NULL;
+
+    int64_t values[DUMMY_STATS_MAX] = { 0, };
+
+    if (lb->group) {
+        struct dummy_group* const g = lb->group;
+        pthread_mutex_lock(&g->mtx);
+        uint64_t const paused = g->fc_paused +
+            (g->fc_members ? dummy_now() - g->fc_since : 0);
+        values[DUMMY_STATS_FC_PAUSED]    = (int64_t)paused;
+        values[DUMMY_STATS_CLUSTER_SIZE] = lb->connected ? g->members_num : 0;
+        pthread_mutex_unlock(&g->mtx);
+    }
+
+    pthread_mutex_lock(&lb->mtx);
+    values[DUMMY_STATS_REPLICATED]       = lb->replicated;
+    values[DUMMY_STATS_REPLICATED_BYTES] = lb->replicated_bytes;
+    values[DUMMY_STATS_RECEIVED]         = lb->received;
+    values[DUMMY_STATS_RECEIVED_BYTES]   = lb->received_bytes;
+    values[DUMMY_STATS_CERT_FAILURES]    = lb->cert_failures;
+    values[DUMMY_STATS_LAST_COMMITTED]   = lb->committed;
+    values[DUMMY_STATS_RECV_QUEUE]       = lb->queue_len;
+    pthread_mutex_unlock(&lb->mtx);
+
+    int i;
+    for (i = 0; i < DUMMY_STATS_MAX; i++) {
+        stats[i].name          = dummy_stats_names[i];
+        stats[i].type          = WSREP_VAR_INT64;
+        stats[i].value._int64  = values[i];
+    }
+    stats[DUMMY_STATS_MAX] = dummy_stats[0]; /* terminator */
+
+    return stats;
 }
 
 static void dummy_stats_free (
     wsrep_t* w,
-    struct wsrep_stats_var* stats __attribute__((unused)))
+    struct wsrep_stats_var* stats)
 {
     WSREP_DBUG_ENTER(w);
+    if (stats != dummy_stats) free(stats);
 }
 
 static void dummy_stats_reset (wsrep_t* w)
 {
     WSREP_DBUG_ENTER(w);
+
+    dummy_loopback_t* const lb = DUMMY_LB(w);
+    if (!lb) return;
+
+    pthread_mutex_lock(&lb->mtx);
+    lb->replicated = lb->replicated_bytes = 0;
+    lb->received = lb->received_bytes = 0;
+    lb->cert_failures = 0;
+    pthread_mutex_unlock(&lb->mtx);
 }
 
 static wsrep_seqno_t dummy_pause (wsrep_t* w)
@@ -457,6 +2144,24 @@ int wsrep_dummy_loader(wsrep_t* w)
     // initialize private context
     WSREP_DUMMY(w)->log_fn = NULL;
     WSREP_DUMMY(w)->options = NULL;
+    WSREP_DUMMY(w)->trace = true;
+    WSREP_DUMMY(w)->lb = NULL;
 
     return 0;
 }
+
+/*! Looks up extensions implemented by the dummy, see wsrep_dlsym() */
+void* wsrep_dummy_dlsym(const wsrep_t* w, const char* symbol)
+{
+    /* the handle may belong to another built-in wrapper, e.g. interposer */
+    if (w->free != &dummy_free) return NULL;
+
+    union {
+        wsrep_recv_batch_fn_v1 fn;
+        void*                  obj;
+    } alias = { NULL };
+
+    if (!strcmp(symbol, WSREP_RECV_BATCH_V1)) alias.fn = &dummy_recv_batch;
+
+    return alias.obj;
+}
@@ -0,0 +1,1456 @@
+/* Copyright (C) 2025 Codership Oy <info@codersihp.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*! @file Provider call interposer.
+ *
+ * wsrep_load() with WSREP_PROFILE_PREFIX "<spec>" loads provider <spec> and
+ * returns a handle which forwards every call to it and every provider
+ * callback to the application, recording the number of calls and a latency
+ * histogram for each of them.
+ *
+ * Histograms are log-linear: every power of 2 nanoseconds is split into
+ * 8 buckets, so percentiles are reported with 12.5% precision at most.
+ * They are updated with relaxed atomics only and are sharded by thread to
+ * keep concurrent callers off each other cache lines, so the interposer adds
+ * no locking of its own and costs two clock reads per call.
+ *
+ * The recorded figures are appended to stats_get() output as
+ * profile.<call>.{calls,avg_ns,p50_ns,p99_ns,p999_ns,max_ns} for the calls
+ * that were made at least once. They are written to the log when the handle
+ * is freed or when "profile.dump" option is set. "profile.reset" option and
+ * stats_reset() clear them. profile.* options are not passed to the provider.
+ *
+ * With WSREP_INJECT_PREFIX "<spec>" the handle instead injects faults into
+ * the calls and callbacks as configured by inject.<call>.<param> options:
+ *
+ *   delay         - microseconds to wait before the call
+ *   jitter        - maximum random microseconds to add to the delay
+ *   stall         - microseconds of an occasional stall before the call
+ *   stall_rate    - probability of the stall, 0..1
+ *   fail_rate     - probability of WSREP_TRX_FAIL returned instead of the call
+ *   bf_abort_rate - probability of WSREP_BF_ABORT returned instead of the call
+ *
+ * e.g. "inject.certify.stall = 50000; inject.certify.stall_rate = 0.001".
+ * Failures are injected only into the calls which precede ordering:
+ * assign_read_view, append_key, append_data and certify or certify_v1 (which
+ * then leave the GTID in meta undefined), so that the provider never sees the
+ * difference.
+ * inject.seed option seeds the random generators, its value and the order
+ * in which threads make their first calls determine the faults. inject.*
+ * options are not passed to the provider and can be changed on the fly.
+ *
+ * The prefixes can be combined, e.g. "profile:inject:<spec>".
+ *
+ * WSREP_CERTIFY_V1 and WSREP_RECV_BATCH_V1 extensions are interposed as
+ * certify_v1, recv_batch_v1 and apply_batch_cb if the provider exports them,
+ * wsrep_dlsym() finds them on the returned handle. Other extensions looked up
+ * through wsrep_t::dlh are hidden: dlh of the returned handle is NULL. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wsrep_api.h"
+
+#define INTERPOSE_CALLS(X)                                              \
+    X(init) X(capabilities) X(options_set) X(options_get) X(enc_set_key) \
+    X(connect) X(disconnect) X(recv) X(assign_read_view) X(certify)     \
+    X(commit_order_enter) X(commit_order_leave) X(release) X(replay_trx) \
+    X(abort_certification) X(rollback) X(append_key) X(append_data)     \
+    X(sync_wait) X(last_committed_id) X(free_connection)                \
+    X(to_execute_start) X(to_execute_end) X(preordered_collect)         \
+    X(preordered_commit) X(sst_sent) X(sst_received) X(snapshot)        \
+    X(stats_get) X(stats_free) X(stats_reset) X(pause) X(resume)        \
+    X(desync) X(resync) X(lock) X(unlock) X(is_locked)                  \
+    /* provider extensions */                                           \
+    X(certify_v1) X(recv_batch_v1)                                      \
+    /* application callbacks */                                         \
+    X(connected_cb) X(view_cb) X(sst_request_cb) X(encrypt_cb)          \
+    X(apply_cb) X(unordered_cb) X(sst_donate_cb) X(synced_cb)           \
+    X(apply_batch_cb)
+
+enum interpose_call
+{
+#define INTERPOSE_ENUM(_c) INTERPOSE_##_c,
+    INTERPOSE_CALLS(INTERPOSE_ENUM)
+#undef INTERPOSE_ENUM
+    INTERPOSE_MAX
+};
+
+static const char* const interpose_names[INTERPOSE_MAX] =
+{
+#define INTERPOSE_NAME(_c) #_c,
+    INTERPOSE_CALLS(INTERPOSE_NAME)
+#undef INTERPOSE_NAME
+};
+
+/*! Figures reported per call in stats_get() */
+enum interpose_stat
+{
+    INTERPOSE_STAT_CALLS,
+    INTERPOSE_STAT_AVG,
+    INTERPOSE_STAT_P50,
+    INTERPOSE_STAT_P99,
+    INTERPOSE_STAT_P999,
+    INTERPOSE_STAT_MAX_NS,
+    INTERPOSE_STAT_MAX
+};
+
+static const char* const interpose_stat_names[INTERPOSE_STAT_MAX] =
+{
+    "calls", "avg_ns", "p50_ns", "p99_ns", "p999_ns", "max_ns"
+};
+
+/*! 8 linear buckets for values below 8 and for each power of 2 above,
+ *  up to 2^40 ns (18 minutes), longer calls go to the last bucket */
+#define INTERPOSE_BUCKETS ((40 - 3 + 1) * 8)
+/*! Number of histogram copies, threads are spread over them */
+#define INTERPOSE_SHARDS  16
+
+struct interpose_hist
+{
+    uint64_t sum;     /*!< ns */
+    uint64_t max;     /*!< ns */
+    uint64_t buckets[INTERPOSE_BUCKETS];
+};
+
+struct interpose_shard
+{
+    struct interpose_hist hist[INTERPOSE_MAX];
+};
+
+/*! Faults to inject into a call, updated on the fly, so accessed atomically */
+struct interpose_fault
+{
+    uint64_t delay;          /*!< ns */
+    uint64_t jitter;         /*!< ns */
+    uint64_t stall;          /*!< ns */
+    uint64_t stall_rate;     /*!< probability scaled to 2^32 */
+    uint64_t fail_rate;      /*!< probability scaled to 2^32 */
+    uint64_t bf_abort_rate;  /*!< probability scaled to 2^32 */
+};
+
+/*! Injected fault counters reported in stats_get() */
+enum interpose_injected
+{
+    INTERPOSE_INJECTED_DELAYS,
+    INTERPOSE_INJECTED_STALLS,
+    INTERPOSE_INJECTED_FAILURES,
+    INTERPOSE_INJECTED_MAX
+};
+
+static const char* const interpose_injected_names[INTERPOSE_INJECTED_MAX] =
+{
+    "inject.delays", "inject.stalls", "inject.failures"
+};
+
+struct interpose
+{
+    wsrep_t*               inner;
+    const char*            prefix; /*!< of the options, "profile." or "inject." */
+    wsrep_log_cb_t         log_cb;
+    struct wsrep_init_args args; /*!< application context and callbacks */
+
+    /* provider extensions, NULL if not exported */
+    wsrep_certify_fn_v1    certify_v1;
+    wsrep_recv_batch_fn_v1 recv_batch_v1;
+
+    /* profile mode */
+    struct interpose_shard* shards;
+    char names[INTERPOSE_MAX][INTERPOSE_STAT_MAX][64];
+
+    /* inject mode */
+    bool                   inject;
+    uint64_t               seed;
+    struct interpose_fault faults[INTERPOSE_MAX];
+    uint64_t               injected[INTERPOSE_INJECTED_MAX];
+};
+
+/*! recv_ctx passed to the provider, holds that of the application */
+struct interpose_recv
+{
+    struct interpose*      ip;
+    void*                  recv_ctx;
+    wsrep_apply_batch_cb_t apply_batch_cb; /*!< passed to recv_batch_v1() */
+};
+
+/*! stats_get() result, holds the array returned by the provider */
+struct interpose_stats
+{
+    struct wsrep_stats_var* inner;
+    struct wsrep_stats_var  vars[];
+};
+
+#define INTERPOSE(_w)       ((struct interpose*)(_w)->ctx)
+#define INTERPOSE_INNER(_w) (INTERPOSE(_w)->inner)
+
+static inline uint64_t interpose_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline int interpose_bucket(uint64_t ns)
+{
+    if (ns < 8) return (int)ns;
+
+    int const e = 63 - __builtin_clzll(ns);
+    int const b = (e - 2) * 8 + (int)((ns >> (e - 3)) & 7);
+    return b < INTERPOSE_BUCKETS ? b : INTERPOSE_BUCKETS - 1;
+}
+
+/*! @return middle of the bucket range */
+static uint64_t interpose_bucket_value(int b)
+{
+    if (b < 8) return (uint64_t)b;
+
+    int const e = b / 8 + 2;
+    uint64_t const lower = (uint64_t)(8 + b % 8) << (e - 3);
+    return lower + ((1ULL << (e - 3)) >> 1);
+}
+
+static void interpose_record(struct interpose_hist* h, uint64_t ns)
+{
+    __atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[interpose_bucket(ns)], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&h->max, &max, ns, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*! @return number of the calling thread, in the order of first calls */
+static inline unsigned interpose_thread(void)
+{
+    static unsigned next = 0;
+    static __thread unsigned thread = 0; /* 0 - not assigned yet */
+
+    if (!thread) thread = __atomic_add_fetch(&next, 1, __ATOMIC_RELAXED);
+
+    return thread - 1;
+}
+
+/*! @return pseudo-random number from the calling thread sequence */
+static uint64_t interpose_random(const struct interpose* ip)
+{
+    static __thread uint64_t state = 0;
+    static __thread const struct interpose* owner = NULL;
+
+    if (owner != ip)
+    {
+        owner = ip;
+        state = __atomic_load_n(&ip->seed, __ATOMIC_RELAXED) ^
+            ((uint64_t)interpose_thread() << 32);
+    }
+
+    /* splitmix64 */
+    uint64_t x = (state += 0x9e3779b97f4a7c15ULL);
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static bool interpose_chance(const struct interpose* ip, uint64_t rate)
+{
+    return rate && (interpose_random(ip) >> 32) < rate;
+}
+
+static void interpose_sleep(uint64_t ns)
+{
+    struct timespec ts = { (time_t)(ns / 1000000000ULL),
+                           (long)(ns % 1000000000ULL) };
+    while (nanosleep(&ts, &ts) && EINTR == errno);
+}
+
+/*! Injects the configured delays before the call */
+static void interpose_delay(struct interpose* ip, enum interpose_call c)
+{
+    const struct interpose_fault* const f = &ip->faults[c];
+    uint64_t const delay  = __atomic_load_n(&f->delay,  __ATOMIC_RELAXED);
+    uint64_t const jitter = __atomic_load_n(&f->jitter, __ATOMIC_RELAXED);
+    uint64_t const stall  = __atomic_load_n(&f->stall,  __ATOMIC_RELAXED);
+
+    uint64_t ns = delay;
+    if (jitter) ns += interpose_random(ip) % (jitter + 1);
+    if (ns)
+        __atomic_fetch_add(&ip->injected[INTERPOSE_INJECTED_DELAYS], 1,
+                           __ATOMIC_RELAXED);
+
+    if (stall && interpose_chance(ip, __atomic_load_n(&f->stall_rate,
+                                                      __ATOMIC_RELAXED)))
+    {
+        ns += stall;
+        __atomic_fetch_add(&ip->injected[INTERPOSE_INJECTED_STALLS], 1,
+                           __ATOMIC_RELAXED);
+    }
+
+    if (ns) interpose_sleep(ns);
+}
+
+/*!
+ * Decides if the call must fail, only calls preceding ordering may.
+ *
+ * @return WSREP_OK or the status to return instead of making the call
+ */
+static wsrep_status_t interpose_fail(struct interpose* ip,
+                                     enum interpose_call c)
+{
+    if (!ip->inject) return WSREP_OK;
+
+    const struct interpose_fault* const f = &ip->faults[c];
+    wsrep_status_t ret = WSREP_OK;
+
+    if (interpose_chance(ip, __atomic_load_n(&f->fail_rate,
+                                             __ATOMIC_RELAXED)))
+        ret = WSREP_TRX_FAIL;
+    else if (interpose_chance(ip, __atomic_load_n(&f->bf_abort_rate,
+                                                  __ATOMIC_RELAXED)))
+        ret = WSREP_BF_ABORT;
+
+    if (ret)
+        __atomic_fetch_add(&ip->injected[INTERPOSE_INJECTED_FAILURES], 1,
+                           __ATOMIC_RELAXED);
+
+    return ret;
+}
+
+static inline uint64_t interpose_begin(struct interpose* ip,
+                                       enum interpose_call c)
+{
+    if (ip->inject) interpose_delay(ip, c);
+
+    return ip->shards ? interpose_now() : 0;
+}
+
+static inline void interpose_end(struct interpose* ip, enum interpose_call c,
+                                 uint64_t start)
+{
+    if (!ip->shards) return;
+
+    interpose_record(&ip->shards[interpose_thread() % INTERPOSE_SHARDS].hist[c],
+                     interpose_now() - start);
+}
+
+/*! Computes INTERPOSE_STAT_* figures of the call from all shards */
+static void interpose_figures(const struct interpose* ip,
+                              enum interpose_call c,
+                              int64_t figures[INTERPOSE_STAT_MAX])
+{
+    uint64_t calls = 0, sum = 0, max = 0;
+    uint64_t buckets[INTERPOSE_BUCKETS] = { 0, };
+    int i, b;
+
+    for (i = 0; i < INTERPOSE_SHARDS; i++)
+    {
+        const struct interpose_hist* const h = &ip->shards[i].hist[c];
+        uint64_t const m = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+        sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+        if (m > max) max = m;
+
+        /* the number of calls is not counted separately to save an atomic */
+        for (b = 0; b < INTERPOSE_BUCKETS; b++)
+        {
+            uint64_t const n =
+                __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+            buckets[b] += n;
+            calls      += n;
+        }
+    }
+
+    figures[INTERPOSE_STAT_CALLS]  = (int64_t)calls;
+    figures[INTERPOSE_STAT_AVG]    = calls ? (int64_t)(sum / calls) : 0;
+    figures[INTERPOSE_STAT_MAX_NS] = (int64_t)max;
+
+    static const struct { enum interpose_stat stat; uint64_t permille; }
+    pcts[] = {
+        { INTERPOSE_STAT_P50,  500 },
+        { INTERPOSE_STAT_P99,  990 },
+        { INTERPOSE_STAT_P999, 999 }
+    };
+
+    size_t p = 0;
+    uint64_t seen = 0;
+    for (b = 0; b < INTERPOSE_BUCKETS && p < sizeof(pcts)/sizeof(pcts[0]);
+         b++)
+    {
+        seen += buckets[b];
+        while (p < sizeof(pcts)/sizeof(pcts[0]) &&
+               seen * 1000 >= calls * pcts[p].permille)
+        {
+            figures[pcts[p].stat] = (int64_t)interpose_bucket_value(b);
+            p++;
+        }
+    }
+    for (; p < sizeof(pcts)/sizeof(pcts[0]); p++)
+        figures[pcts[p].stat] = figures[INTERPOSE_STAT_MAX_NS];
+}
+
+static void interpose_reset(struct interpose* ip)
+{
+    if (!ip->shards) return;
+
+    int i, c, b;
+    for (i = 0; i < INTERPOSE_SHARDS; i++)
+    for (c = 0; c < INTERPOSE_MAX; c++)
+    {
+        struct interpose_hist* const h = &ip->shards[i].hist[c];
+        __atomic_store_n(&h->sum,   0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->max,   0, __ATOMIC_RELAXED);
+        for (b = 0; b < INTERPOSE_BUCKETS; b++)
+            __atomic_store_n(&h->buckets[b], 0, __ATOMIC_RELAXED);
+    }
+}
+
+static void interpose_log(struct interpose* ip, wsrep_log_level_t level,
+                          const char* msg)
+{
+    if (ip->log_cb)
+        ip->log_cb(level, msg);
+    else
+        fprintf(stderr, "wsrep %.*s: %s\n",
+                (int)strlen(ip->prefix) - 1, ip->prefix, msg);
+}
+
+/*! Writes figures of all calls made so far to the log */
+static void interpose_dump(struct interpose* ip)
+{
+    if (!ip->shards) return;
+
+    interpose_log(ip, WSREP_LOG_INFO,
+                  "provider call profile (ns): "
+                  "calls, avg, p50, p99, p99.9, max");
+
+    int c;
+    for (c = 0; c < INTERPOSE_MAX; c++)
+    {
+        int64_t f[INTERPOSE_STAT_MAX];
+        interpose_figures(ip, (enum interpose_call)c, f);
+        if (!f[INTERPOSE_STAT_CALLS]) continue;
+
+        char msg[256];
+        snprintf(msg, sizeof(msg),
+                 "%20s: %12lld %10lld %10lld %10lld %10lld %10lld",
+                 interpose_names[c],
+                 (long long)f[INTERPOSE_STAT_CALLS],
+                 (long long)f[INTERPOSE_STAT_AVG],
+                 (long long)f[INTERPOSE_STAT_P50],
+                 (long long)f[INTERPOSE_STAT_P99],
+                 (long long)f[INTERPOSE_STAT_P999],
+                 (long long)f[INTERPOSE_STAT_MAX_NS]);
+        interpose_log(ip, WSREP_LOG_INFO, msg);
+    }
+}
+
+/*! @return true if inject.<call>.<param> option was recognized */
+static bool interpose_fault_set(struct interpose* ip, const char* key,
+                                size_t key_len, const char* val)
+{
+    const char* const dot = memchr(key, '.', key_len);
+    if (!dot) return false;
+
+    int c;
+    for (c = 0; c < INTERPOSE_MAX; c++)
+    {
+        if (strlen(interpose_names[c]) == (size_t)(dot - key) &&
+            !strncmp(key, interpose_names[c], (size_t)(dot - key)))
+            break;
+    }
+    if (INTERPOSE_MAX == c) return false;
+
+    const char* const param = dot + 1;
+    size_t const param_len = key_len - (size_t)(param - key);
+    double const v = strtod(val, NULL);
+    if (!(v >= 0)) return false;
+
+    /* durations are in microseconds, rates are probabilities */
+    uint64_t const ns   = (uint64_t)(v * 1000);
+    uint64_t const rate = (uint64_t)((v < 1.0 ? v : 1.0) * 4294967296.0);
+    struct interpose_fault* const f = &ip->faults[c];
+    bool const preorder = (INTERPOSE_assign_read_view == c ||
+                           INTERPOSE_append_key == c ||
+                           INTERPOSE_append_data == c ||
+                           INTERPOSE_certify == c);
+
+#define INTERPOSE_PARAM(_p) \
+    (strlen(#_p) == param_len && !strncmp(param, #_p, param_len))
+
+    uint64_t* field;
+    uint64_t  value;
+
+    if      (INTERPOSE_PARAM(delay))      { field = &f->delay;  value = ns; }
+    else if (INTERPOSE_PARAM(jitter))     { field = &f->jitter; value = ns; }
+    else if (INTERPOSE_PARAM(stall))      { field = &f->stall;  value = ns; }
+    else if (INTERPOSE_PARAM(stall_rate)) { field = &f->stall_rate;
+                                            value = rate; }
+    else if (INTERPOSE_PARAM(fail_rate) && preorder)
+    {
+        field = &f->fail_rate;
+        value = rate;
+    }
+    else if (INTERPOSE_PARAM(bf_abort_rate) && preorder)
+    {
+        field = &f->bf_abort_rate;
+        value = rate;
+    }
+    else
+        return false;
+
+    __atomic_store_n(field, value, __ATOMIC_RELAXED);
+
+#undef INTERPOSE_PARAM
+
+    return true;
+}
+
+/*!
+ * Executes own (profile.* or inject.*) options found in
+ * "key1 = value1; key2 = value2" string and copies the rest to a newly
+ * allocated string.
+ *
+ * @return the rest of options or NULL if out of memory
+ */
+static char* interpose_options(struct interpose* ip, const char* opts)
+{
+    size_t const len = opts ? strlen(opts) : 0;
+    char* const rest = malloc(len + 1);
+    if (!rest) return NULL;
+
+    size_t rest_len = 0;
+    while (opts && *opts)
+    {
+        while (*opts == ' ' || *opts == ';') opts++;
+
+        const char* end = opts;
+        while (*end && *end != ';') end += ('\\' == *end && end[1]) ? 2 : 1;
+
+        if (!strncmp(opts, ip->prefix, strlen(ip->prefix)))
+        {
+            const char* const key = opts + strlen(ip->prefix);
+            size_t const key_len = strcspn(key, " =;");
+            const char* val = key + key_len;
+            while (' ' == *val || '=' == *val) val++;
+
+            if (!ip->inject && 4 == key_len && !strncmp(key, "dump", key_len))
+                interpose_dump(ip);
+            else if (!ip->inject && 5 == key_len &&
+                     !strncmp(key, "reset", key_len))
+                interpose_reset(ip);
+            else if (ip->inject && 4 == key_len &&
+                     !strncmp(key, "seed", key_len))
+                __atomic_store_n(&ip->seed, strtoull(val, NULL, 10),
+                                 __ATOMIC_RELAXED);
+            else if (ip->inject && interpose_fault_set(ip, key, key_len, val))
+                ;
+            else
+            {
+                char msg[128];
+                snprintf(msg, sizeof(msg), "Unknown option: '%.*s'",
+                         (int)(end - opts), opts);
+                interpose_log(ip, WSREP_LOG_WARN, msg);
+            }
+        }
+        else if (end > opts)
+        {
+            if (rest_len) rest[rest_len++] = ';';
+            memcpy(rest + rest_len, opts, (size_t)(end - opts));
+            rest_len += (size_t)(end - opts);
+        }
+
+        opts = end;
+    }
+    rest[rest_len] = '\0';
+
+    return rest;
+}
+
+/*
+ * Application callbacks
+ */
+
+static enum wsrep_cb_status interpose_connected_cb(
+    void*                    app_ctx,
+    const wsrep_view_info_t* view)
+{
+    struct interpose* const ip = app_ctx;
+    uint64_t const start = interpose_begin(ip, INTERPOSE_connected_cb);
+    enum wsrep_cb_status const ret =
+        ip->args.connected_cb(ip->args.app_ctx, view);
+    interpose_end(ip, INTERPOSE_connected_cb, start);
+    return ret;
+}
+
+static enum wsrep_cb_status interpose_view_cb(
+    void*                    app_ctx,
+    void*                    recv_ctx,
+    const wsrep_view_info_t* view,
+    const char*              state,
+    size_t                   state_len)
+{
+    struct interpose* const ip = app_ctx;
+    struct interpose_recv* const rc = recv_ctx;
+    uint64_t const start = interpose_begin(ip, INTERPOSE_view_cb);
+    enum wsrep_cb_status const ret =
+        ip->args.view_cb(ip->args.app_ctx, rc ? rc->recv_ctx : NULL, view,
+                         state, state_len);
+    interpose_end(ip, INTERPOSE_view_cb, start);
+    return ret;
+}
+
+static enum wsrep_cb_status interpose_sst_request_cb(
+    void*   app_ctx,
+    void**  sst_req,
+    size_t* sst_req_len)
+{
+    struct interpose* const ip = app_ctx;
+    uint64_t const start = interpose_begin(ip, INTERPOSE_sst_request_cb);
+    enum wsrep_cb_status const ret =
+        ip->args.sst_request_cb(ip->args.app_ctx, sst_req, sst_req_len);
+    interpose_end(ip, INTERPOSE_sst_request_cb, start);
+    return ret;
+}
+
+static int interpose_encrypt_cb(
+    void*                 app_ctx,
+    wsrep_enc_ctx_t*      enc_ctx,
+    const wsrep_buf_t*    input,
+    void*                 output,
+    wsrep_enc_direction_t direction,
+    bool                  last)
+{
+    struct interpose* const ip = app_ctx;
+    uint64_t const start = interpose_begin(ip, INTERPOSE_encrypt_cb);
+    int const ret = ip->args.encrypt_cb(ip->args.app_ctx, enc_ctx, input,
+                                        output, direction, last);
+    interpose_end(ip, INTERPOSE_encrypt_cb, start);
+    return ret;
+}
+
+static enum wsrep_cb_status interpose_apply_cb(
+    void*                    recv_ctx,
+    const wsrep_ws_handle_t* ws_handle,
+    uint32_t                 flags,
+    const wsrep_buf_t*       data,
+    const wsrep_trx_meta_t*  meta,
+    wsrep_bool_t*            exit_loop)
+{
+    struct interpose_recv* const rc = recv_ctx;
+    struct interpose* const ip = rc->ip;
+    uint64_t const start = interpose_begin(ip, INTERPOSE_apply_cb);
+    enum wsrep_cb_status const ret =
+        ip->args.apply_cb(rc->recv_ctx, ws_handle, flags, data, meta,
+                          exit_loop);
+    interpose_end(ip, INTERPOSE_apply_cb, start);
+    return ret;
+}
+
+static enum wsrep_cb_status interpose_apply_batch_cb(
+    void*                    recv_ctx,
+    const wsrep_ws_handle_t* ws_handles,
+    const uint32_t*          flags,
+    const wsrep_buf_t*       data,
+    const wsrep_trx_meta_t*  meta,
+    size_t                   count,
+    wsrep_bool_t*            exit_loop)
+{
+    struct interpose_recv* const rc = recv_ctx;
+    struct interpose* const ip = rc->ip;
+    uint64_t const start = interpose_begin(ip, INTERPOSE_apply_batch_cb);
+    enum wsrep_cb_status const ret =
+        rc->apply_batch_cb(rc->recv_ctx, ws_handles, flags, data, meta, count,
+                           exit_loop);
+    interpose_end(ip, INTERPOSE_apply_batch_cb, start);
+    return ret;
+}
+
+static enum wsrep_cb_status interpose_unordered_cb(
+    void*              recv_ctx,
+    const wsrep_buf_t* data)
+{
+    struct interpose_recv* const rc = recv_ctx;
+    struct interpose* const ip = rc->ip;
+    uint64_t const start = interpose_begin(ip, INTERPOSE_unordered_cb);
+    enum wsrep_cb_status const ret =
+        ip->args.unordered_cb(rc->recv_ctx, data);
+    interpose_end(ip, INTERPOSE_unordered_cb, start);
+    return ret;
+}
+
+static enum wsrep_cb_status interpose_sst_donate_cb(
+    void*               app_ctx,
+    void*               recv_ctx,
+    const wsrep_buf_t*  str_msg,
+    const wsrep_gtid_t* state_id,
+    const wsrep_buf_t*  state,
+    wsrep_bool_t        bypass)
+{
+    struct interpose* const ip = app_ctx;
+    struct interpose_recv* const rc = recv_ctx;
+    uint64_t const start = interpose_begin(ip, INTERPOSE_sst_donate_cb);
+    enum wsrep_cb_status const ret =
+        ip->args.sst_donate_cb(ip->args.app_ctx, rc ? rc->recv_ctx : NULL,
+                               str_msg, state_id, state, bypass);
+    interpose_end(ip, INTERPOSE_sst_donate_cb, start);
+    return ret;
+}
+
+static enum wsrep_cb_status interpose_synced_cb(void* app_ctx)
+{
+    struct interpose* const ip = app_ctx;
+    uint64_t const start = interpose_begin(ip, INTERPOSE_synced_cb);
+    enum wsrep_cb_status const ret = ip->args.synced_cb(ip->args.app_ctx);
+    interpose_end(ip, INTERPOSE_synced_cb, start);
+    return ret;
+}
+
+/*
+ * Provider calls
+ */
+
+static wsrep_status_t interpose_init(wsrep_t* w,
+                                     const struct wsrep_init_args* args)
+{
+    struct interpose* const ip = INTERPOSE(w);
+    uint64_t const start = interpose_begin(ip, INTERPOSE_init);
+
+    ip->args   = *args;
+    ip->log_cb = args->logger_cb;
+
+    char* const options = interpose_options(ip, args->options);
+    if (!options) return WSREP_FATAL;
+
+    /* callbacks get the application context through the interposer one */
+    struct wsrep_init_args a = *args;
+    a.app_ctx        = ip;
+    a.options        = options;
+#define INTERPOSE_CB(_cb) a._cb = args->_cb ? interpose_##_cb : NULL
+    INTERPOSE_CB(connected_cb);
+    INTERPOSE_CB(view_cb);
+    INTERPOSE_CB(sst_request_cb);
+    INTERPOSE_CB(encrypt_cb);
+    INTERPOSE_CB(apply_cb);
+    INTERPOSE_CB(unordered_cb);
+    INTERPOSE_CB(sst_donate_cb);
+    INTERPOSE_CB(synced_cb);
+#undef INTERPOSE_CB
+
+    wsrep_status_t const ret = ip->inner->init(ip->inner, &a);
+    free(options);
+
+    interpose_end(ip, INTERPOSE_init, start);
+    return ret;
+}
+
+static wsrep_cap_t interpose_capabilities(wsrep_t* w)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_capabilities);
+    wsrep_cap_t const ret =
+        INTERPOSE_INNER(w)->capabilities(INTERPOSE_INNER(w));
+    interpose_end(INTERPOSE(w), INTERPOSE_capabilities, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_options_set(wsrep_t* w, const char* conf)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_options_set);
+
+    char* const rest = interpose_options(INTERPOSE(w), conf);
+    if (!rest) return WSREP_FATAL;
+
+    /* nothing to pass if there were only profile.* options */
+    wsrep_status_t const ret = (conf && !*rest) ? WSREP_OK :
+        INTERPOSE_INNER(w)->options_set(INTERPOSE_INNER(w), conf ? rest:NULL);
+    free(rest);
+
+    interpose_end(INTERPOSE(w), INTERPOSE_options_set, start);
+    return ret;
+}
+
+static char* interpose_options_get(wsrep_t* w)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_options_get);
+    char* const ret = INTERPOSE_INNER(w)->options_get(INTERPOSE_INNER(w));
+    interpose_end(INTERPOSE(w), INTERPOSE_options_get, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_enc_set_key(wsrep_t* w,
+                                            const wsrep_enc_key_t* key)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_enc_set_key);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->enc_set_key(INTERPOSE_INNER(w), key);
+    interpose_end(INTERPOSE(w), INTERPOSE_enc_set_key, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_connect(wsrep_t*     w,
+                                        const char*  cluster_name,
+                                        const char*  cluster_url,
+                                        const char*  state_donor,
+                                        wsrep_bool_t bootstrap)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_connect);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->connect(INTERPOSE_INNER(w), cluster_name,
+                                    cluster_url, state_donor, bootstrap);
+    interpose_end(INTERPOSE(w), INTERPOSE_connect, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_disconnect(wsrep_t* w)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_disconnect);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->disconnect(INTERPOSE_INNER(w));
+    interpose_end(INTERPOSE(w), INTERPOSE_disconnect, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_recv(wsrep_t* w, void* recv_ctx)
+{
+    struct interpose_recv rc = { INTERPOSE(w), recv_ctx, NULL };
+
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_recv);
+    wsrep_status_t const ret = INTERPOSE_INNER(w)->recv(INTERPOSE_INNER(w),
+                                                        &rc);
+    interpose_end(INTERPOSE(w), INTERPOSE_recv, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_assign_read_view(wsrep_t*            w,
+                                                 wsrep_ws_handle_t*  handle,
+                                                 const wsrep_gtid_t* rv)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_assign_read_view);
+    wsrep_status_t ret = interpose_fail(INTERPOSE(w),
+                                        INTERPOSE_assign_read_view);
+    if (!ret)
+        ret = INTERPOSE_INNER(w)->assign_read_view(INTERPOSE_INNER(w), handle,
+                                                   rv);
+    interpose_end(INTERPOSE(w), INTERPOSE_assign_read_view, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_certify(wsrep_t*           w,
+                                        wsrep_conn_id_t    conn_id,
+                                        wsrep_ws_handle_t* ws_handle,
+                                        uint32_t           flags,
+                                        wsrep_trx_meta_t*  meta)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_certify);
+    wsrep_status_t ret = interpose_fail(INTERPOSE(w), INTERPOSE_certify);
+    if (ret)
+    {
+        /* as if replication failed: the writeset was not ordered */
+        meta->gtid       = WSREP_GTID_UNDEFINED;
+        meta->depends_on = WSREP_SEQNO_UNDEFINED;
+    }
+    else
+        ret = INTERPOSE_INNER(w)->certify(INTERPOSE_INNER(w), conn_id,
+                                          ws_handle, flags, meta);
+    interpose_end(INTERPOSE(w), INTERPOSE_certify, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_commit_order_enter(
+    wsrep_t*                 w,
+    const wsrep_ws_handle_t* ws_handle,
+    const wsrep_trx_meta_t*  meta)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_commit_order_enter);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->commit_order_enter(INTERPOSE_INNER(w), ws_handle,
+                                               meta);
+    interpose_end(INTERPOSE(w), INTERPOSE_commit_order_enter, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_commit_order_leave(
+    wsrep_t*                 w,
+    const wsrep_ws_handle_t* ws_handle,
+    const wsrep_trx_meta_t*  meta,
+    const wsrep_buf_t*       error)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_commit_order_leave);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->commit_order_leave(INTERPOSE_INNER(w), ws_handle,
+                                               meta, error);
+    interpose_end(INTERPOSE(w), INTERPOSE_commit_order_leave, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_release(wsrep_t*           w,
+                                        wsrep_ws_handle_t* ws_handle)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_release);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->release(INTERPOSE_INNER(w), ws_handle);
+    interpose_end(INTERPOSE(w), INTERPOSE_release, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_replay_trx(wsrep_t*                 w,
+                                           const wsrep_ws_handle_t* ws_handle,
+                                           void*                    trx_ctx)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_replay_trx);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->replay_trx(INTERPOSE_INNER(w), ws_handle, trx_ctx);
+    interpose_end(INTERPOSE(w), INTERPOSE_replay_trx, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_abort_certification(
+    wsrep_t*       w,
+    wsrep_seqno_t  bf_seqno,
+    wsrep_trx_id_t victim_trx,
+    wsrep_seqno_t* victim_seqno)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_abort_certification);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->abort_certification(INTERPOSE_INNER(w), bf_seqno,
+                                                victim_trx, victim_seqno);
+    interpose_end(INTERPOSE(w), INTERPOSE_abort_certification, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_rollback(wsrep_t*           w,
+                                         wsrep_trx_id_t     trx,
+                                         const wsrep_buf_t* data)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_rollback);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->rollback(INTERPOSE_INNER(w), trx, data);
+    interpose_end(INTERPOSE(w), INTERPOSE_rollback, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_append_key(wsrep_t*            w,
+                                           wsrep_ws_handle_t*  ws_handle,
+                                           const wsrep_key_t*  keys,
+                                           size_t              count,
+                                           enum wsrep_key_type type,
+                                           wsrep_bool_t        copy)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_append_key);
+    wsrep_status_t ret = interpose_fail(INTERPOSE(w), INTERPOSE_append_key);
+    if (!ret)
+        ret = INTERPOSE_INNER(w)->append_key(INTERPOSE_INNER(w), ws_handle,
+                                             keys, count, type, copy);
+    interpose_end(INTERPOSE(w), INTERPOSE_append_key, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_append_data(wsrep_t*             w,
+                                            wsrep_ws_handle_t*   ws_handle,
+                                            const wsrep_buf_t*   data,
+                                            size_t               count,
+                                            enum wsrep_data_type type,
+                                            wsrep_bool_t         copy)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_append_data);
+    wsrep_status_t ret = interpose_fail(INTERPOSE(w), INTERPOSE_append_data);
+    if (!ret)
+        ret = INTERPOSE_INNER(w)->append_data(INTERPOSE_INNER(w), ws_handle,
+                                              data, count, type, copy);
+    interpose_end(INTERPOSE(w), INTERPOSE_append_data, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_sync_wait(wsrep_t*      w,
+                                          wsrep_gtid_t* upto,
+                                          int           tout,
+                                          wsrep_gtid_t* gtid)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_sync_wait);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->sync_wait(INTERPOSE_INNER(w), upto, tout, gtid);
+    interpose_end(INTERPOSE(w), INTERPOSE_sync_wait, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_last_committed_id(wsrep_t*      w,
+                                                  wsrep_gtid_t* gtid)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_last_committed_id);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->last_committed_id(INTERPOSE_INNER(w), gtid);
+    interpose_end(INTERPOSE(w), INTERPOSE_last_committed_id, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_free_connection(wsrep_t*        w,
+                                                wsrep_conn_id_t conn_id)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_free_connection);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->free_connection(INTERPOSE_INNER(w), conn_id);
+    interpose_end(INTERPOSE(w), INTERPOSE_free_connection, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_to_execute_start(wsrep_t*           w,
+                                                 wsrep_conn_id_t    conn_id,
+                                                 const wsrep_key_t* keys,
+                                                 size_t             keys_num,
+                                                 const wsrep_buf_t* action,
+                                                 size_t             count,
+                                                 uint32_t           flags,
+                                                 wsrep_trx_meta_t*  meta)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_to_execute_start);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->to_execute_start(INTERPOSE_INNER(w), conn_id,
+                                             keys, keys_num, action, count,
+                                             flags, meta);
+    interpose_end(INTERPOSE(w), INTERPOSE_to_execute_start, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_to_execute_end(wsrep_t*           w,
+                                               wsrep_conn_id_t    conn_id,
+                                               const wsrep_buf_t* error)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_to_execute_end);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->to_execute_end(INTERPOSE_INNER(w), conn_id, error);
+    interpose_end(INTERPOSE(w), INTERPOSE_to_execute_end, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_preordered_collect(wsrep_t*           w,
+                                                   wsrep_po_handle_t* handle,
+                                                   const wsrep_buf_t* data,
+                                                   size_t             count,
+                                                   wsrep_bool_t       copy)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_preordered_collect);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->preordered_collect(INTERPOSE_INNER(w), handle,
+                                               data, count, copy);
+    interpose_end(INTERPOSE(w), INTERPOSE_preordered_collect, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_preordered_commit(wsrep_t*            w,
+                                                  wsrep_po_handle_t*  handle,
+                                                  const wsrep_uuid_t* source_id,
+                                                  uint32_t            flags,
+                                                  int                 pa_range,
+                                                  wsrep_bool_t        commit)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_preordered_commit);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->preordered_commit(INTERPOSE_INNER(w), handle,
+                                              source_id, flags, pa_range,
+                                              commit);
+    interpose_end(INTERPOSE(w), INTERPOSE_preordered_commit, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_sst_sent(wsrep_t*            w,
+                                         const wsrep_gtid_t* state_id,
+                                         int                 rcode)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_sst_sent);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->sst_sent(INTERPOSE_INNER(w), state_id, rcode);
+    interpose_end(INTERPOSE(w), INTERPOSE_sst_sent, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_sst_received(wsrep_t*            w,
+                                             const wsrep_gtid_t* state_id,
+                                             const wsrep_buf_t*  state,
+                                             int                 rcode)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_sst_received);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->sst_received(INTERPOSE_INNER(w), state_id, state,
+                                         rcode);
+    interpose_end(INTERPOSE(w), INTERPOSE_sst_received, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_snapshot(wsrep_t*           w,
+                                         const wsrep_buf_t* msg,
+                                         const char*        donor_spec)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_snapshot);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->snapshot(INTERPOSE_INNER(w), msg, donor_spec);
+    interpose_end(INTERPOSE(w), INTERPOSE_snapshot, start);
+    return ret;
+}
+
+static struct wsrep_stats_var* interpose_stats_get(wsrep_t* w)
+{
+    struct interpose* const ip = INTERPOSE(w);
+
+    uint64_t const start = interpose_begin(ip, INTERPOSE_stats_get);
+    struct wsrep_stats_var* const inner =
+        ip->inner->stats_get(ip->inner);
+    interpose_end(ip, INTERPOSE_stats_get, start);
+
+    size_t inner_num = 0;
+    while (inner && inner[inner_num].name) inner_num++;
+
+    size_t const vars_num = inner_num + INTERPOSE_MAX * INTERPOSE_STAT_MAX +
+        INTERPOSE_INJECTED_MAX + 1;
+    struct interpose_stats* const stats =
+        malloc(sizeof(*stats) + vars_num * sizeof(stats->vars[0]));
+    if (!stats)
+    {
+        if (inner) ip->inner->stats_free(ip->inner, inner);
+        return NULL;
+    }
+
+    stats->inner = inner;
+    if (inner_num) memcpy(stats->vars, inner, inner_num * sizeof(*inner));
+
+    struct wsrep_stats_var* var = stats->vars + inner_num;
+    int c, s;
+    for (c = 0; ip->shards && c < INTERPOSE_MAX; c++)
+    {
+        int64_t f[INTERPOSE_STAT_MAX];
+        interpose_figures(ip, (enum interpose_call)c, f);
+        if (!f[INTERPOSE_STAT_CALLS]) continue;
+
+        for (s = 0; s < INTERPOSE_STAT_MAX; s++, var++)
+        {
+            var->name          = ip->names[c][s];
+            var->type          = WSREP_VAR_INT64;
+            var->value._int64  = f[s];
+        }
+    }
+
+    int i;
+    for (i = 0; ip->inject && i < INTERPOSE_INJECTED_MAX; i++, var++)
+    {
+        var->name          = interpose_injected_names[i];
+        var->type          = WSREP_VAR_INT64;
+        var->value._int64  =
+            (int64_t)__atomic_load_n(&ip->injected[i], __ATOMIC_RELAXED);
+    }
+
+    var->name          = NULL; /* terminator */
+    var->type          = WSREP_VAR_STRING;
+    var->value._string = NULL;
+
+    return stats->vars;
+}
+
+static void interpose_stats_free(wsrep_t* w, struct wsrep_stats_var* vars)
+{
+    if (!vars) return;
+
+    struct interpose_stats* const stats = (struct interpose_stats*)
+        ((char*)vars - offsetof(struct interpose_stats, vars));
+
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_stats_free);
+    if (stats->inner)
+        INTERPOSE_INNER(w)->stats_free(INTERPOSE_INNER(w), stats->inner);
+    interpose_end(INTERPOSE(w), INTERPOSE_stats_free, start);
+
+    free(stats);
+}
+
+static void interpose_stats_reset(wsrep_t* w)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_stats_reset);
+    INTERPOSE_INNER(w)->stats_reset(INTERPOSE_INNER(w));
+    interpose_end(INTERPOSE(w), INTERPOSE_stats_reset, start);
+
+    interpose_reset(INTERPOSE(w));
+}
+
+static wsrep_seqno_t interpose_pause(wsrep_t* w)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_pause);
+    wsrep_seqno_t const ret = INTERPOSE_INNER(w)->pause(INTERPOSE_INNER(w));
+    interpose_end(INTERPOSE(w), INTERPOSE_pause, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_resume(wsrep_t* w)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_resume);
+    wsrep_status_t const ret = INTERPOSE_INNER(w)->resume(INTERPOSE_INNER(w));
+    interpose_end(INTERPOSE(w), INTERPOSE_resume, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_desync(wsrep_t* w)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_desync);
+    wsrep_status_t const ret = INTERPOSE_INNER(w)->desync(INTERPOSE_INNER(w));
+    interpose_end(INTERPOSE(w), INTERPOSE_desync, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_resync(wsrep_t* w)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_resync);
+    wsrep_status_t const ret = INTERPOSE_INNER(w)->resync(INTERPOSE_INNER(w));
+    interpose_end(INTERPOSE(w), INTERPOSE_resync, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_lock(wsrep_t*     w,
+                                     const char*  name,
+                                     wsrep_bool_t shared,
+                                     uint64_t     owner,
+                                     int64_t      tout)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_lock);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->lock(INTERPOSE_INNER(w), name, shared, owner,
+                                 tout);
+    interpose_end(INTERPOSE(w), INTERPOSE_lock, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_unlock(wsrep_t*    w,
+                                       const char* name,
+                                       uint64_t    owner)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w), INTERPOSE_unlock);
+    wsrep_status_t const ret =
+        INTERPOSE_INNER(w)->unlock(INTERPOSE_INNER(w), name, owner);
+    interpose_end(INTERPOSE(w), INTERPOSE_unlock, start);
+    return ret;
+}
+
+static wsrep_bool_t interpose_is_locked(wsrep_t*      w,
+                                        const char*   name,
+                                        uint64_t*     conn,
+                                        wsrep_uuid_t* node)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_is_locked);
+    wsrep_bool_t const ret =
+        INTERPOSE_INNER(w)->is_locked(INTERPOSE_INNER(w), name, conn, node);
+    interpose_end(INTERPOSE(w), INTERPOSE_is_locked, start);
+    return ret;
+}
+
+/*
+ * Provider extensions
+ */
+
+static wsrep_status_t interpose_certify_v1(wsrep_t*              w,
+                                           wsrep_conn_id_t       conn_id,
+                                           wsrep_ws_handle_t*    ws_handle,
+                                           uint32_t              flags,
+                                           wsrep_trx_meta_t*     meta,
+                                           const wsrep_seq_cb_t* seq_cb)
+{
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_certify_v1);
+    wsrep_status_t ret = interpose_fail(INTERPOSE(w), INTERPOSE_certify_v1);
+    if (ret)
+    {
+        /* as if replication failed: the writeset was not ordered */
+        meta->gtid       = WSREP_GTID_UNDEFINED;
+        meta->depends_on = WSREP_SEQNO_UNDEFINED;
+    }
+    else
+        ret = INTERPOSE(w)->certify_v1(INTERPOSE_INNER(w), conn_id, ws_handle,
+                                       flags, meta, seq_cb);
+    interpose_end(INTERPOSE(w), INTERPOSE_certify_v1, start);
+    return ret;
+}
+
+static wsrep_status_t interpose_recv_batch_v1(
+    wsrep_t*               w,
+    void*                  recv_ctx,
+    wsrep_apply_batch_cb_t apply_batch_cb,
+    size_t                 max_batch)
+{
+    struct interpose_recv rc = { INTERPOSE(w), recv_ctx, apply_batch_cb };
+
+    uint64_t const start = interpose_begin(INTERPOSE(w),
+                                           INTERPOSE_recv_batch_v1);
+    wsrep_status_t const ret =
+        INTERPOSE(w)->recv_batch_v1(INTERPOSE_INNER(w), &rc,
+                                    interpose_apply_batch_cb, max_batch);
+    interpose_end(INTERPOSE(w), INTERPOSE_recv_batch_v1, start);
+    return ret;
+}
+
+static void interpose_free(wsrep_t* w)
+{
+    struct interpose* const ip = INTERPOSE(w);
+    if (!ip) return;
+
+    interpose_dump(ip);
+
+    /* the provider is released here as wsrep_unload() can't see it */
+    ip->inner->free(ip->inner);
+    wsrep_unload(ip->inner);
+
+    free(ip->shards);
+    free(ip);
+    w->ctx = NULL;
+}
+
+static wsrep_t interpose_iface = {
+    WSREP_INTERFACE_VERSION,
+    &interpose_init,
+    &interpose_capabilities,
+    &interpose_options_set,
+    &interpose_options_get,
+    &interpose_enc_set_key,
+    &interpose_connect,
+    &interpose_disconnect,
+    &interpose_recv,
+    &interpose_assign_read_view,
+    &interpose_certify,
+    &interpose_commit_order_enter,
+    &interpose_commit_order_leave,
+    &interpose_release,
+    &interpose_replay_trx,
+    &interpose_abort_certification,
+    &interpose_rollback,
+    &interpose_append_key,
+    &interpose_append_data,
+    &interpose_sync_wait,
+    &interpose_last_committed_id,
+    &interpose_free_connection,
+    &interpose_to_execute_start,
+    &interpose_to_execute_end,
+    &interpose_preordered_collect,
+    &interpose_preordered_commit,
+    &interpose_sst_sent,
+    &interpose_sst_received,
+    &interpose_snapshot,
+    &interpose_stats_get,
+    &interpose_stats_free,
+    &interpose_stats_reset,
+    &interpose_pause,
+    &interpose_resume,
+    &interpose_desync,
+    &interpose_resync,
+    &interpose_lock,
+    &interpose_unlock,
+    &interpose_is_locked,
+    NULL,
+    NULL,
+    NULL,
+    &interpose_free,
+    NULL,
+    NULL
+};
+
+/*!
+ * Loads provider spec following WSREP_PROFILE_PREFIX or WSREP_INJECT_PREFIX
+ * and wraps it into the interposer handle.
+ *
+ * @return zero on success, errno on failure
+ */
+int wsrep_interpose_loader(const char* spec, wsrep_t* w)
+{
+    bool const inject =
+        !strncmp(spec, WSREP_INJECT_PREFIX, strlen(WSREP_INJECT_PREFIX));
+    const char* const inner_spec = spec +
+        strlen(inject ? WSREP_INJECT_PREFIX : WSREP_PROFILE_PREFIX);
+
+    struct interpose* const ip = calloc(1, sizeof(*ip));
+    if (!ip) return ENOMEM;
+
+    ip->inject = inject;
+    ip->prefix = inject ? "inject." : "profile.";
+    if (!inject && !(ip->shards = calloc(INTERPOSE_SHARDS,
+                                         sizeof(*ip->shards))))
+    {
+        free(ip);
+        return ENOMEM;
+    }
+
+    int const ret = wsrep_load(inner_spec, &ip->inner, NULL);
+    if (ret)
+    {
+        free(ip->shards);
+        free(ip);
+        return ret;
+    }
+
+    *(void**)(&ip->certify_v1)    = wsrep_dlsym(ip->inner, WSREP_CERTIFY_V1);
+    *(void**)(&ip->recv_batch_v1) = wsrep_dlsym(ip->inner, WSREP_RECV_BATCH_V1);
+
+    int c, s;
+    for (c = 0; c < INTERPOSE_MAX; c++)
+        for (s = 0; s < INTERPOSE_STAT_MAX; s++)
+            snprintf(ip->names[c][s], sizeof(ip->names[c][s]), "%s%s.%s",
+                     ip->prefix, interpose_names[c],
+                     interpose_stat_names[s]);
+
+    *w = interpose_iface;
+    w->provider_name    = ip->inner->provider_name;
+    w->provider_version = ip->inner->provider_version;
+    w->provider_vendor  = ip->inner->provider_vendor;
+    w->ctx              = ip;
+
+    return 0;
+}
+
+/*! Looks up provider extensions interposed by the handle, see wsrep_dlsym() */
+void* wsrep_interpose_dlsym(const wsrep_t* w, const char* symbol)
+{
+    /* the handle may belong to another built-in provider, e.g. dummy */
+    if (w->free != &interpose_free) return NULL;
+
+    const struct interpose* const ip = INTERPOSE(w);
+
+    union {
+        wsrep_certify_fn_v1    certify;
+        wsrep_recv_batch_fn_v1 recv_batch;
+        void*                  obj;
+    } alias = { NULL };
+
+    if (!strcmp(symbol, WSREP_CERTIFY_V1) && ip->certify_v1)
+        alias.certify = &interpose_certify_v1;
+    else if (!strcmp(symbol, WSREP_RECV_BATCH_V1) && ip->recv_batch_v1)
+        alias.recv_batch = &interpose_recv_batch_v1;
+
+    return alias.obj;
+}
@@ -132,6 +132,9 @@ static int wsrep_check_version_symbol(void *dlh)
 }
 
 extern int wsrep_dummy_loader(wsrep_t *w);
+extern void *wsrep_dummy_dlsym(const wsrep_t *w, const char *symbol);
+extern int wsrep_interpose_loader(const char *spec, wsrep_t *w);
+extern void *wsrep_interpose_dlsym(const wsrep_t *w, const char *symbol);
 
 int wsrep_load(const char *spec, wsrep_t **hptr, wsrep_log_cb_t log_cb)
 {
@@ -165,6 +168,15 @@ int wsrep_load(const char *spec, wsrep_t **hptr, wsrep_log_cb_t log_cb)
         return ret;
     }
 
+    if (!strncmp(spec, WSREP_PROFILE_PREFIX, strlen(WSREP_PROFILE_PREFIX)) ||
+        !strncmp(spec, WSREP_INJECT_PREFIX, strlen(WSREP_INJECT_PREFIX))) {
+        if ((ret = wsrep_interpose_loader(spec, *hptr)) != 0) {
+            free (*hptr);
+            *hptr = NULL;
+        }
+        return ret;
+    }
+
     int open_flags = RTLD_NOW | RTLD_LOCAL;
 #ifdef __SANITIZE_ADDRESS__
     /* Keep the shared object to allow ASAN resolve symbols and report
@@ -244,3 +256,17 @@ void wsrep_unload(wsrep_t *hptr)
         free(hptr);
     }
 }
+
+void *wsrep_dlsym(const wsrep_t *hptr, const char *symbol)
+{
+    if (!hptr || !symbol)
+        return NULL;
+
+    if (hptr->dlh)
+        return dlsym(hptr->dlh, symbol);
+
+    /* the dummy provider and the interposer are built in, look them up by
+     * the handle */
+    void *const ret = wsrep_interpose_dlsym(hptr, symbol);
+    return ret ? ret : wsrep_dummy_dlsym(hptr, symbol);
+}